@@ -0,0 +1,34 @@
+// ----- Allocation accounting (opt-in: build with -DNSM_ALLOC_COUNT=ON) -----
+//
+// The probe and UI hot paths are meant to do zero heap allocations once warmed up.
+// With NSM_ALLOC_COUNT the global operator new is replaced by a counting one (in
+// netserialmon.cpp) and every worker cycle / UI tick checks its own thread's delta.
+// Offending cycles are reported on stderr; with NSM_ALLOC_STRICT=1 in the
+// environment the first one aborts.
+#ifndef NSM_ALLOC_COUNT_H
+#define NSM_ALLOC_COUNT_H
+
+namespace nsm {
+
+struct AllocSite {
+    const char* name;
+    unsigned long long cycles = 0;
+    unsigned long long steady_allocs = 0;   // allocations after warm-up
+    unsigned long long worst_cycle = 0;
+    unsigned long long mark = 0;
+    explicit AllocSite(const char* n) : name(n) {}
+};
+
+#ifdef NSM_ALLOC_COUNT
+void alloc_cycle_begin(AllocSite& site);
+void alloc_cycle_end(AllocSite& site);
+void alloc_report(const AllocSite& site);
+#else
+inline void alloc_cycle_begin(AllocSite&) {}
+inline void alloc_cycle_end(AllocSite&) {}
+inline void alloc_report(const AllocSite&) {}
+#endif
+
+}  // namespace nsm
+
+#endif  // NSM_ALLOC_COUNT_H
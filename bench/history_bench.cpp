@@ -0,0 +1,214 @@
+/*
+ * Encode/decode throughput and size of the compressed history (history.h) on
+ * synthetic probe series, and how much of a file a time or value scan reads.
+ *
+ *   nsm_history_bench [SAMPLES]        default 1000000 per series
+ *
+ * Raw size is counted as 16 bytes per sample, an 8-byte time and an 8-byte
+ * double, against which the ratio is given. Every series is also decoded and
+ * compared with its input sample by sample; a mismatch fails the run.
+ */
+#include "history.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point t0) {
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+// A probe on interval_ms, its results landing when its script is done, so with
+// a few ms of jitter; the state flips now and then.
+std::vector<nsm::HistorySample> make_series(const char* kind, std::size_t n, unsigned seed) {
+    std::mt19937_64 rng(seed);
+    std::normal_distribution<double> jitter(0.0, 4.0), rtt(12.0, 1.5);
+    std::vector<nsm::HistorySample> out(n);
+    long long t = 1760000000000LL;
+    nsm::ProbeState st = nsm::ProbeState::Ok;
+    double load = 40;
+    const std::string k = kind;
+    for (std::size_t i = 0; i < n; ++i) {
+        t += 2000 + static_cast<long long>(std::lround(jitter(rng)));
+        if (rng() % 2000 == 0) st = st == nsm::ProbeState::Ok ? nsm::ProbeState::Fail : nsm::ProbeState::Ok;
+        double v = NAN;
+        if (k == "integer") {
+            if (rng() % 20 == 0) load += static_cast<double>(static_cast<int>(rng() % 3) - 1);
+            v = load;
+        } else if (k == "rtt-0.1") {
+            v = std::round(rtt(rng) * 10) / 10;         // "time=12.3 ms"
+            if (rng() % 5000 == 0) v = 250.0;
+        } else if (k == "rtt-raw") {
+            v = rtt(rng);
+        }
+        out[i] = nsm::HistorySample{t, st, v};
+    }
+    return out;
+}
+
+// All blocks of a series, back to back as in a file.
+std::vector<unsigned char> encode(const std::vector<nsm::HistorySample>& in, unsigned* blocks) {
+    std::vector<unsigned char> out;
+    nsm::HistoryEncoder enc;
+    *blocks = 0;
+    auto seal = [&] {
+        std::size_t len;
+        const unsigned char* b = enc.seal(len);
+        out.insert(out.end(), b, b + len);
+        enc.reset();
+        ++*blocks;
+    };
+    for (const auto& s : in) {
+        if (enc.append(s)) continue;
+        seal();
+        enc.append(s);
+    }
+    if (enc.count()) seal();
+    return out;
+}
+
+std::size_t decode(const std::vector<unsigned char>& file, double* checksum) {
+    constexpr std::size_t head = nsm::HistoryEncoder::kHeader, foot = nsm::HistoryEncoder::kFooter;
+    std::size_t n = 0;
+    double sum = 0;
+    for (std::size_t off = 0; off < file.size();) {
+        const unsigned char* b = file.data() + off;
+        const std::size_t len = b[4] | b[5] << 8 | b[6] << 16 | static_cast<std::size_t>(b[7]) << 24;
+        const unsigned char* f = b + head + len;
+        nsm::HistoryDecoder dec(b + head, len, f[0] | f[1] << 8 | f[2] << 16 | static_cast<unsigned>(f[3]) << 24);
+        nsm::HistorySample s;
+        while (dec.next(s)) {
+            sum += static_cast<double>(s.t_ms & 0xFFFF) + (std::isnan(s.value) ? 0 : s.value);
+            ++n;
+        }
+        off += head + len + foot;
+    }
+    *checksum = sum;
+    return n;
+}
+
+// Decode again, outside the timing, and compare every sample with the input: time,
+// state and the value's bits (any NaN for "no metric"). Reports the first mismatch.
+bool verify(const char* kind, const std::vector<unsigned char>& file, const std::vector<nsm::HistorySample>& in) {
+    constexpr std::size_t head = nsm::HistoryEncoder::kHeader, foot = nsm::HistoryEncoder::kFooter;
+    std::size_t i = 0;
+    for (std::size_t off = 0; off < file.size();) {
+        const unsigned char* b = file.data() + off;
+        const std::size_t len = b[4] | b[5] << 8 | b[6] << 16 | static_cast<std::size_t>(b[7]) << 24;
+        const unsigned char* f = b + head + len;
+        nsm::HistoryDecoder dec(b + head, len, f[0] | f[1] << 8 | f[2] << 16 | static_cast<unsigned>(f[3]) << 24);
+        nsm::HistorySample s;
+        for (; dec.next(s); ++i) {
+            if (i >= in.size()) {
+                std::fprintf(stderr, "%s: more samples decoded than encoded\n", kind);
+                return false;
+            }
+            std::uint64_t got, want;
+            std::memcpy(&got, &s.value, sizeof(got));
+            std::memcpy(&want, &in[i].value, sizeof(want));
+            const bool same_value = got == want || (std::isnan(s.value) && std::isnan(in[i].value));
+            if (s.t_ms != in[i].t_ms || s.state != in[i].state || !same_value) {
+                std::fprintf(stderr, "%s: sample %zu decoded as (%lld, %s, %.17g), encoded (%lld, %s, %.17g)\n", kind,
+                             i, s.t_ms, nsm::state_name(s.state), s.value, in[i].t_ms, nsm::state_name(in[i].state),
+                             in[i].value);
+                return false;
+            }
+        }
+        off += head + len + foot;
+    }
+    if (i != in.size()) {
+        std::fprintf(stderr, "%s: decoded %zu of %zu samples\n", kind, i, in.size());
+        return false;
+    }
+    return true;
+}
+
+void scan(const char* what, const std::string& path, const nsm::HistoryQuery& q, std::size_t file_bytes) {
+    std::vector<nsm::HistorySample> out;
+    nsm::HistoryScanStats st;
+    const auto t0 = Clock::now();
+    nsm::read_history(path, q, out, &st);
+    const double sec = seconds_since(t0);
+    std::printf("  %-26s %8zu samples  %5u/%u blocks skipped  %9llu of %zu bytes read  %.2f ms\n", what,
+                out.size(), st.skipped, st.blocks, st.bytes_read, file_bytes, sec * 1000);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    if (n < 2) {
+        std::fprintf(stderr, "usage: %s [SAMPLES]\n", argv[0]);
+        return 2;
+    }
+    std::printf("%zu samples per series, 2 s interval; raw = 16 bytes/sample\n\n", n);
+    std::printf("%-10s %10s %10s %7s %11s %13s %13s\n", "series", "raw", "encoded", "ratio", "bits/sample",
+                "encode Ms/s", "decode Ms/s");
+    const char* kinds[] = {"state", "integer", "rtt-0.1", "rtt-raw"};
+    std::vector<unsigned char> rtt_file, state_file;
+    std::vector<nsm::HistorySample> rtt_series;
+    for (const char* kind : kinds) {
+        const auto series = make_series(kind, n, 17);
+        unsigned blocks = 0;
+        auto t0 = Clock::now();
+        std::vector<unsigned char> file = encode(series, &blocks);
+        const double enc_s = seconds_since(t0);
+        double checksum = 0;
+        t0 = Clock::now();
+        const std::size_t decoded = decode(file, &checksum);
+        const double dec_s = seconds_since(t0);
+        if (decoded != n || !verify(kind, file, series)) {
+            if (decoded != n) std::fprintf(stderr, "%s: decoded %zu of %zu samples\n", kind, decoded, n);
+            return 1;
+        }
+        const double raw = 16.0 * static_cast<double>(n);
+        std::printf("%-10s %10.0f %10zu %6.1fx %11.2f %13.1f %13.1f\n", kind, raw, file.size(),
+                    raw / static_cast<double>(file.size()), 8.0 * static_cast<double>(file.size()) / n,
+                    n / enc_s / 1e6, n / dec_s / 1e6);
+        if (std::string(kind) == "state") state_file = std::move(file);
+        if (std::string(kind) == "rtt-0.1") {
+            rtt_file = std::move(file);
+            rtt_series = series;
+        }
+    }
+
+    // Scans of files written by history_append_block()
+    char dir[] = "/tmp/nsm-history-bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    const std::string state_path = nsm::history_file(dir, "state"), rtt_path = nsm::history_file(dir, "rtt");
+    if (!nsm::history_append_block(state_path, state_file.data(), state_file.size(), 0) ||
+        !nsm::history_append_block(rtt_path, rtt_file.data(), rtt_file.size(), 0)) {
+        std::perror("history_append_block");
+        return 1;
+    }
+    const long long last = rtt_series.back().t_ms;
+    std::printf("\nscans\n");
+    nsm::HistoryQuery q;
+    scan("state: everything", state_path, q, state_file.size());
+    q.from_ms = last - 3600 * 1000;
+    scan("state: last hour", state_path, q, state_file.size());
+    q.from_ms = last - 24 * 3600 * 1000LL;
+    scan("rtt-0.1: last day", rtt_path, q, rtt_file.size());
+    q = nsm::HistoryQuery();
+    q.min_value = 100;
+    scan("rtt-0.1: values >= 100", rtt_path, q, rtt_file.size());
+
+    unlink(state_path.c_str());
+    unlink(rtt_path.c_str());
+    rmdir(dir);
+    return 0;
+}
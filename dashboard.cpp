@@ -0,0 +1,293 @@
+/*
+ * Web dashboard: HTTP/1.1 server with a Server-Sent Events push (see dashboard.h)
+ */
+
+#include "dashboard.h"
+#include "fanout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <strings.h>
+
+namespace nsm {
+
+namespace {
+
+constexpr int kMaxClients = 64;
+constexpr std::size_t kMaxRequest = 8192;           // request head; longer ones are refused
+constexpr std::size_t kMaxPending = 256 * 1024;     // unsent bytes before a slow client is dropped
+constexpr int kRefreshMs = 1000;                    // metric-only changes are picked up this often
+constexpr int kKeepaliveMs = 15000;                 // SSE comment so proxies keep idle streams open
+
+const char kPage[] = R"html(<!DOCTYPE html>
+<html><head><meta charset="utf-8"><title>Net &amp; Serial Monitor</title>
+<style>
+body{font-family:sans-serif;margin:1em}
+table{border-collapse:collapse}
+td,th{padding:2px 10px;border-bottom:1px solid #ddd;text-align:left}
+td.n{text-align:right}
+.ok{background:#9e9}.degraded{background:#ee7}.fail{background:#e88}.unknown{background:#ccc}
+.stale{opacity:.5}
+#conn{color:#888}
+</style></head>
+<body><h3>Net &amp; Serial Monitor <span id="conn">connecting</span></h3>
+<table><thead><tr><th>Group</th><th>Probe</th><th>State</th><th>Metric</th><th>p99</th><th>Available</th><th>Changed</th></tr></thead>
+<tbody id="rows"></tbody></table>
+<script>
+var probes = [];
+function num(v) { return v === null ? "-" : String(+v.toPrecision(6)); }
+function row(p) {
+  var tr = document.createElement("tr");
+  var cells = [p.group, p.name, p.state + (p.stale ? "?" : ""), num(p.metric), num(p.p99),
+               p.availability === null ? "-" : (p.availability * 100).toFixed(1) + "%",
+               p.last_change ? new Date(p.last_change * 1000).toLocaleTimeString() : "-"];
+  cells.forEach(function (text, i) {
+    var td = document.createElement("td");
+    td.textContent = text;
+    if (i == 2) td.className = p.state + (p.stale ? " stale" : "");
+    if (i >= 3) td.className = "n";
+    tr.appendChild(td);
+  });
+  return tr;
+}
+function render() {
+  var body = document.getElementById("rows");
+  body.textContent = "";
+  probes.forEach(function (p) { body.appendChild(row(p)); });
+}
+var es = new EventSource("events");
+es.addEventListener("snapshot", function (e) { probes = JSON.parse(e.data); render(); });
+es.addEventListener("delta", function (e) {
+  JSON.parse(e.data).forEach(function (p) { probes[p.i] = p; });
+  render();
+});
+es.onopen = function () { document.getElementById("conn").textContent = ""; };
+es.onerror = function () { document.getElementById("conn").textContent = "(reconnecting)"; };
+</script></body></html>
+)html";
+
+void append_json_string(std::string& out, const std::string& s) {
+    out += '"';
+    for (const char ch : s) {
+        const unsigned char c = static_cast<unsigned char>(ch);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += ch;
+        } else if (c < 0x20) {
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += ch;
+        }
+    }
+    out += '"';
+}
+
+void append_number(std::string& out, double v) {
+    if (std::isnan(v) || std::isinf(v)) {
+        out += "null";
+        return;
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.10g", v);
+    out += buf;
+}
+
+void append_probe(std::string& out, std::size_t index, const ProbeView& p) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "{\"i\":%zu,\"name\":", index);
+    out += buf;
+    append_json_string(out, p.name);
+    out += ",\"group\":";
+    append_json_string(out, p.group);
+    out += ",\"state\":\"";
+    out += state_name(p.state);
+    out += p.stale ? "\",\"stale\":true" : "\",\"stale\":false";
+    out += ",\"metric\":";
+    append_number(out, p.metric);
+    out += ",\"p99\":";
+    append_number(out, p.p99);
+    out += ",\"availability\":";
+    append_number(out, p.availability);
+    std::snprintf(buf, sizeof(buf), ",\"last_change\":%lld}", p.last_change);
+    out += buf;
+}
+
+// Copy the value of header name in a request head to out ("" if absent), cut to len - 1 chars.
+void header_value(const std::string& head, const char* name, char* out, std::size_t len) {
+    out[0] = '\0';
+    const std::size_t name_len = std::strlen(name);
+    for (std::size_t line = head.find("\r\n"); line != std::string::npos; line = head.find("\r\n", line + 2)) {
+        const char* p = head.c_str() + line + 2;
+        if (strncasecmp(p, name, name_len) != 0 || p[name_len] != ':') continue;
+        p += name_len + 1;
+        while (*p == ' ' || *p == '\t') ++p;
+        std::size_t n = std::strcspn(p, "\r\n");
+        n = std::min(n, len - 1);
+        std::memcpy(out, p, n);
+        out[n] = '\0';
+        return;
+    }
+}
+
+bool same_number(double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); }
+
+const char kPing[] = ": ping\n\n";
+const char kBusy[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n";
+
+}  // namespace
+
+struct Dashboard::Impl : fanout::Server {
+    Options opts;
+    std::string event;              // scratch for a snapshot event sent to one client
+
+    std::mutex image_mu;            // guards image, image_tag (publish_image runs on any thread)
+    std::shared_ptr<const std::string> image;
+    unsigned image_tag = 0;
+
+    Impl(Monitor& m, Options o)
+        : Server(m, {"http", kMaxClients, kMaxPending, kRefreshMs, kKeepaliveMs, kPing, sizeof(kPing) - 1, kBusy}),
+          opts(std::move(o)) {}
+
+    void respond(fanout::Client& c, const char* status, const char* type, const std::string& body) {
+        char head[256];
+        const int n = std::snprintf(head, sizeof(head),
+                                    "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                                    "Cache-Control: no-cache\r\nConnection: close\r\n\r\n",
+                                    status, type, body.size());
+        send_to(c, head, static_cast<std::size_t>(n));
+        send_to(c, body.data(), body.size());
+        c.close_when_sent = true;
+        if (c.fd >= 0 && c.out.empty()) drop(c);
+    }
+
+    // if_none_match: that request header's value, "" if absent
+    void send_image(fanout::Client& c, const char* if_none_match) {
+        std::shared_ptr<const std::string> png;
+        unsigned tag;
+        {
+            std::lock_guard<std::mutex> lk(image_mu);
+            png = image;
+            tag = image_tag;
+        }
+        if (!png) {
+            respond(c, "404 Not Found", "text/plain", "no image published\n");
+            return;
+        }
+        char etag[16];
+        std::snprintf(etag, sizeof(etag), "\"%u\"", tag);
+        const bool same = std::strstr(if_none_match, etag) != nullptr;
+        char head[256];
+        const int n = std::snprintf(head, sizeof(head),
+                                    "HTTP/1.1 %s\r\nContent-Type: image/png\r\nContent-Length: %zu\r\nETag: %s\r\n"
+                                    "Cache-Control: no-cache\r\nConnection: close\r\n\r\n",
+                                    same ? "304 Not Modified" : "200 OK", same ? std::size_t{0} : png->size(), etag);
+        send_to(c, head, static_cast<std::size_t>(n));
+        if (!same) send_to(c, png->data(), png->size());
+        c.close_when_sent = true;
+        if (c.fd >= 0 && c.out.empty()) drop(c);
+    }
+
+    void handle_request(fanout::Client& c) {
+        char method[8] = "", target[256] = "";
+        std::sscanf(c.in.c_str(), "%7s %255s", method, target);
+        if (char* q = std::strchr(target, '?')) *q = '\0';
+        char if_none_match[64];
+        header_value(c.in, "If-None-Match", if_none_match, sizeof(if_none_match));
+        c.in.clear();
+        if (std::strcmp(method, "GET") != 0) {
+            respond(c, "405 Method Not Allowed", "text/plain", "only GET\n");
+        } else if (std::strcmp(target, "/") == 0 || std::strcmp(target, "/index.html") == 0) {
+            respond(c, "200 OK", "text/html; charset=utf-8", kPage);
+        } else if (std::strcmp(target, "/state.json") == 0) {
+            refresh();
+            respond(c, "200 OK", "application/json", snapshot());
+        } else if (std::strcmp(target, "/status.png") == 0) {
+            send_image(c, if_none_match);
+        } else if (std::strcmp(target, "/events") == 0) {
+            static const char head[] =
+                "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                "Connection: keep-alive\r\nAccess-Control-Allow-Origin: *\r\n\r\nretry: 2000\n\n";
+            refresh();          // brings the others up to date first
+            c.subscribed = true;
+            send_to(c, head, sizeof(head) - 1);
+            encode_structure(event);
+            send_to(c, event.data(), event.size());
+        } else {
+            respond(c, "404 Not Found", "text/plain", "not found\n");
+        }
+    }
+
+    bool on_input(fanout::Client& c, const char* data, std::size_t len) override {
+        if (c.subscribed) return true;      // nothing more is expected from a subscriber
+        c.in.append(data, len);
+        if (c.in.find("\r\n\r\n") != std::string::npos) {
+            handle_request(c);
+            return false;
+        }
+        if (c.in.size() > kMaxRequest) {
+            respond(c, "431 Request Header Fields Too Large", "text/plain", "request too large\n");
+            return false;
+        }
+        return true;
+    }
+
+    bool same_values(const ProbeView& a, const ProbeView& b) const override {
+        return a.state == b.state && a.stale == b.stale && same_number(a.metric, b.metric) &&
+               same_number(a.p99, b.p99) && same_number(a.availability, b.availability) &&
+               a.last_change == b.last_change;
+    }
+
+    void encode_snapshot(std::string& out) override {
+        out += '[';
+        for (std::size_t i = 0; i < sent().size(); ++i) {
+            if (i) out += ',';
+            append_probe(out, i, sent()[i]);
+        }
+        out += ']';
+    }
+
+    void encode_structure(std::string& out) override {
+        out = "event: snapshot\ndata: ";
+        out += snapshot();
+        out += "\n\n";
+    }
+
+    void encode_delta(std::string& out, const std::vector<std::size_t>& changed) override {
+        out = "event: delta\ndata: [";
+        for (std::size_t k = 0; k < changed.size(); ++k) {
+            if (k) out += ',';
+            append_probe(out, changed[k], current()[changed[k]]);
+        }
+        out += "]\n\n";
+    }
+};
+
+Dashboard::Dashboard(Monitor& monitor, Options opts) : impl_(std::make_unique<Impl>(monitor, std::move(opts))) {}
+
+Dashboard::~Dashboard() { stop(); }
+
+bool Dashboard::start() {
+    Impl& d = *impl_;
+    if (!d.start(d.opts.address, d.opts.port)) return false;
+    std::fprintf(stderr, "http: dashboard on %s port %d\n", d.opts.address.c_str(), d.opts.port);
+    return true;
+}
+
+void Dashboard::publish_image(std::shared_ptr<const std::string> png, unsigned tag) {
+    Impl& d = *impl_;
+    std::lock_guard<std::mutex> lk(d.image_mu);
+    d.image = std::move(png);
+    d.image_tag = tag;
+}
+
+void Dashboard::stop() { impl_->stop(); }
+
+}  // namespace nsm
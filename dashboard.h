@@ -0,0 +1,59 @@
+/*
+ * Web dashboard for a Monitor: a small built-in HTTP server
+ *
+ *   GET /            status page (static HTML that subscribes to /events)
+ *   GET /events      Server-Sent Events: a "snapshot" event with every probe on
+ *                    connect and whenever the set of probes changes, then "delta"
+ *                    events with only the probes whose values changed
+ *   GET /state.json  the current snapshot as JSON, for scripts and curl
+ *   GET /status.png  the last image handed to publish_image(), if any
+ *
+ * Everything runs on one poll() thread. Each change is encoded once and the same
+ * bytes are queued to every connected client, so idle viewers cost nothing but
+ * their sockets and a keepalive comment now and then.
+ *
+ *     nsm::Dashboard web(monitor, {"0.0.0.0", 8080});
+ *     web.start();
+ *     // curl -N http://127.0.0.1:8080/events
+ */
+#ifndef NSM_DASHBOARD_H
+#define NSM_DASHBOARD_H
+
+#include "netserialmon.h"
+
+#include <memory>
+#include <string>
+
+namespace nsm {
+
+class Dashboard {
+public:
+    struct Options {
+        std::string address = "127.0.0.1";     // "0.0.0.0" or "::" to serve the network
+        int port = 8080;
+    };
+
+    Dashboard(Monitor& monitor, Options opts);
+    ~Dashboard();                   // stops the server
+    Dashboard(const Dashboard&) = delete;
+    Dashboard& operator=(const Dashboard&) = delete;
+
+    // Bind and start serving. False, with a message on stderr, if the address
+    // cannot be bound.
+    bool start();
+    void stop();
+
+    // Serve png at /status.png from now on. The bytes are shared, not copied, so a
+    // front end that renders only on changes makes every poll a plain write of
+    // cached bytes. tag identifies the content (e.g. the state generation) and is
+    // sent as the ETag; a poll with a matching If-None-Match gets 304. Any thread.
+    void publish_image(std::shared_ptr<const std::string> png, unsigned tag);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace nsm
+
+#endif  // NSM_DASHBOARD_H
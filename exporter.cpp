@@ -0,0 +1,319 @@
+/*
+ * UDP push exporter: StatsD and InfluxDB line protocol (see exporter.h)
+ */
+
+#include "exporter.h"
+#include "alloc_count.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace nsm {
+
+namespace {
+
+constexpr int kMaxLine = 512;       // longer lines are dropped (only absurdly long names get there)
+
+// Nagios-style code, which keeps StatsD gauges non-negative: a leading '-' there means "decrement".
+int state_code(ProbeState st) {
+    switch (st) {
+        case ProbeState::Ok:       return 0;
+        case ProbeState::Degraded: return 1;
+        case ProbeState::Fail:     return 2;
+        case ProbeState::Unknown:
+        default:                   return 3;
+    }
+}
+
+// StatsD: one dotted path component; anything but [A-Za-z0-9_-] becomes '_'.
+void statsd_name(const char* s, char* out, std::size_t len) {
+    std::size_t n = 0;
+    for (; *s && n + 1 < len; ++s) {
+        const char c = *s;
+        const bool keep = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                          c == '_' || c == '-';
+        out[n++] = keep ? c : '_';
+    }
+    out[n] = '\0';
+}
+
+// Influx line protocol: backslash before the characters special in measurements and tags.
+void influx_escape(const char* s, char* out, std::size_t len) {
+    std::size_t n = 0;
+    for (; *s && n + 2 < len; ++s) {
+        if (*s == ',' || *s == ' ' || *s == '=' || *s == '\\') out[n++] = '\\';
+        out[n++] = *s;
+    }
+    out[n] = '\0';
+}
+
+long long realtime_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+}  // namespace
+
+struct UdpExporter::Impl {
+    const Monitor& monitor;
+    Options opts;
+    int fd = -1;
+    std::thread thread;
+    std::mutex mu;                  // guards stopping, for the interval wait
+    std::condition_variable cv;
+    bool stopping = false;
+
+    // Only touched by the export thread; sized at start(), reused every push.
+    std::vector<ProbeView> probes;
+    std::vector<char> datagram;
+    std::size_t used = 0;
+    unsigned long long pending_lines = 0;
+    char line[kMaxLine];
+    EngineCounters last_engine;     // StatsD counters are sent as increments
+    bool startup_sent = false;      // the startup timeline goes out once
+    AllocSite allocs{"export"};
+
+    std::atomic<unsigned long long> datagrams{0}, lines{0}, dropped{0}, dropped_lines{0};
+
+    Impl(const Monitor& m, Options o) : monitor(m), opts(std::move(o)) {}
+
+    bool connect_collector() {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* res = nullptr;
+        char port[16];
+        std::snprintf(port, sizeof(port), "%d", opts.port);
+        if (int rc = getaddrinfo(opts.host.c_str(), port, &hints, &res); rc != 0) {
+            std::fprintf(stderr, "export: %s: %s\n", opts.host.c_str(), gai_strerror(rc));
+            return false;
+        }
+        for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(res);
+        if (fd < 0) {
+            std::fprintf(stderr, "export: cannot reach %s port %d: %s\n", opts.host.c_str(), opts.port,
+                         std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    void flush() {
+        if (!used) return;
+        // Without blocking: a full socket buffer loses this datagram rather than delaying the next.
+        if (send(fd, datagram.data(), used, MSG_DONTWAIT) == static_cast<ssize_t>(used)) {
+            datagrams.fetch_add(1, std::memory_order_relaxed);
+            lines.fetch_add(pending_lines, std::memory_order_relaxed);
+        } else {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            dropped_lines.fetch_add(pending_lines, std::memory_order_relaxed);
+        }
+        used = 0;
+        pending_lines = 0;
+    }
+
+    // Format one line (or a few, for a negative StatsD gauge) and queue it.
+    void emit(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list ap;
+        va_start(ap, fmt);
+        const int n = std::vsnprintf(line, sizeof(line), fmt, ap);
+        va_end(ap);
+        if (n < 0 || n + 1 > static_cast<int>(sizeof(line)) || n + 1 > static_cast<int>(datagram.size())) {
+            dropped_lines.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (used + n + 1 > datagram.size()) flush();
+        std::memcpy(datagram.data() + used, line, static_cast<std::size_t>(n));
+        used += static_cast<std::size_t>(n);
+        datagram[used++] = '\n';
+        ++pending_lines;
+    }
+
+    void gauge(const char* name, const char* what, double v) {
+        if (!std::isfinite(v)) return;
+        if (v < 0) emit("%s.%s:0|g\n%s.%s:%.9g|g", name, what, name, what, v);
+        else emit("%s.%s:%.9g|g", name, what, v);
+    }
+
+    void push_statsd() {
+        char name[160], label[40];
+        for (const ProbeView& p : probes) {
+            char probe[96];
+            statsd_name(p.name.c_str(), probe, sizeof(probe));
+            std::snprintf(name, sizeof(name), "%s.%s", opts.prefix.c_str(), probe);
+            emit("%s.state:%d|g", name, state_code(p.state));
+            gauge(name, "metric", p.metric);
+            gauge(name, "p99", p.p99);
+            gauge(name, "availability", p.availability);
+            for (int i = 0; i < p.perf_count; ++i) {
+                char what[48];
+                statsd_name(p.perf[i].label, label, sizeof(label));
+                std::snprintf(what, sizeof(what), "perf.%s", label);
+                gauge(name, what, p.perf[i].value);
+            }
+        }
+        const EngineCounters now = monitor.counters();
+        emit("%s.engine.results:%llu|c", opts.prefix.c_str(), now.results - last_engine.results);
+        emit("%s.engine.spawns:%llu|c", opts.prefix.c_str(), now.spawns - last_engine.spawns);
+        last_engine = now;
+    }
+
+    void push_influx() {
+        const long long stamp = realtime_ns();
+        char measurement[64], probe[160], group[160], label[72], uom[24];
+        influx_escape(opts.prefix.c_str(), measurement, sizeof(measurement));
+        for (const ProbeView& p : probes) {
+            influx_escape(p.name.c_str(), probe, sizeof(probe));
+            influx_escape(p.group.c_str(), group, sizeof(group));
+            // Fields without a (finite) value are left out; the protocol has no NaN.
+            char fields[192];
+            int n = std::snprintf(fields, sizeof(fields), "state=\"%s\",code=%di,stale=%s", state_name(p.state),
+                                  state_code(p.state), p.stale ? "true" : "false");
+            const struct { const char* key; double v; } nums[] = {
+                {"metric", p.metric}, {"p99", p.p99}, {"availability", p.availability}};
+            for (const auto& f : nums)
+                if (std::isfinite(f.v) && n > 0 && n < static_cast<int>(sizeof(fields)))
+                    n += std::snprintf(fields + n, sizeof(fields) - n, ",%s=%.9g", f.key, f.v);
+            emit("%s_probe,probe=%s%s%s %s %lld", measurement, probe, group[0] ? ",group=" : "", group, fields, stamp);
+            for (int i = 0; i < p.perf_count; ++i) {
+                if (!std::isfinite(p.perf[i].value)) continue;
+                influx_escape(p.perf[i].label, label, sizeof(label));
+                influx_escape(p.perf[i].uom, uom, sizeof(uom));
+                emit("%s_perf,probe=%s,label=%s%s%s value=%.9g %lld", measurement, probe, label, uom[0] ? ",uom=" : "",
+                     uom, p.perf[i].value, stamp);
+            }
+        }
+        const EngineCounters now = monitor.counters();
+        emit("%s_engine results=%llui,spawns=%llui,wakeups=%llui %lld", measurement, now.results, now.spawns,
+             now.wakeups, stamp);
+    }
+
+    // Startup marks in ms since the process started; steps not taken are left out.
+    void push_startup(long long stamp) {
+        const StartupTimeline t = monitor.startup();
+        const long long t0 = t.process_start ? t.process_start : t.main_entry;
+        const struct { const char* key; long long mark; } marks[] = {
+            {"main", t.main_entry}, {"ui_init", t.ui_init}, {"window_shown", t.window_shown},
+            {"first_paint", t.first_paint}, {"first_spawn", t.first_spawn}};
+        const char* prefix = opts.prefix.c_str();
+        if (opts.format == Format::StatsD) {
+            char probe[96];
+            for (const auto& m : marks)
+                if (m.mark) emit("%s.startup.%s:%.1f|ms", prefix, m.key, (m.mark - t0) / 1000.0);
+            for (const ProbeView& p : probes) {
+                statsd_name(p.name.c_str(), probe, sizeof(probe));
+                emit("%s.startup.first_result.%s:%.1f|ms", prefix, probe, (p.first_result - t0) / 1000.0);
+            }
+            return;
+        }
+        char measurement[64], probe[160], fields[192];
+        influx_escape(prefix, measurement, sizeof(measurement));
+        int n = 0;
+        for (const auto& m : marks)
+            if (m.mark && n >= 0 && n < static_cast<int>(sizeof(fields)))
+                n += std::snprintf(fields + n, sizeof(fields) - n, "%s%s=%.1f", n ? "," : "", m.key,
+                                   (m.mark - t0) / 1000.0);
+        if (n > 0) emit("%s_startup %s %lld", measurement, fields, stamp);
+        for (const ProbeView& p : probes) {
+            influx_escape(p.name.c_str(), probe, sizeof(probe));
+            emit("%s_startup,probe=%s first_result=%.1f %lld", measurement, probe, (p.first_result - t0) / 1000.0,
+                 stamp);
+        }
+    }
+
+    void push() {
+        alloc_cycle_begin(allocs);
+        monitor.snapshot(probes);
+        if (opts.format == Format::StatsD) push_statsd();
+        else push_influx();
+        if (!startup_sent && !probes.empty() &&
+            std::all_of(probes.begin(), probes.end(), [](const ProbeView& p) { return p.first_result != 0; })) {
+            push_startup(realtime_ns());
+            startup_sent = true;
+        }
+        flush();
+        alloc_cycle_end(allocs);
+    }
+
+    void run() {
+        const auto interval = std::chrono::milliseconds(std::max(opts.interval_ms, 100));
+        auto next = std::chrono::steady_clock::now() + interval;
+        std::unique_lock<std::mutex> lk(mu);
+        for (;;) {
+            cv.wait_until(lk, next, [&] { return stopping; });
+            const bool last = stopping;
+            lk.unlock();
+            push();
+            lk.lock();
+            if (last) return;
+            // Keep the cadence; after a stall start over rather than catch up.
+            next = std::max(next + interval, std::chrono::steady_clock::now());
+        }
+    }
+};
+
+UdpExporter::UdpExporter(const Monitor& monitor, Options opts)
+    : impl_(std::make_unique<Impl>(monitor, std::move(opts))) {}
+
+UdpExporter::~UdpExporter() { stop(); }
+
+bool UdpExporter::start() {
+    Impl& e = *impl_;
+    if (e.thread.joinable()) return true;
+    if (!e.connect_collector()) return false;
+    e.datagram.resize(static_cast<std::size_t>(std::max(e.opts.max_datagram, 64)));
+    e.stopping = false;
+    e.thread = std::thread([&e] { e.run(); });
+    std::fprintf(stderr, "export: %s to %s port %d every %d ms\n",
+                 e.opts.format == Format::StatsD ? "statsd" : "influx", e.opts.host.c_str(), e.opts.port,
+                 e.opts.interval_ms);
+    return true;
+}
+
+void UdpExporter::stop() {
+    Impl& e = *impl_;
+    if (!e.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(e.mu);
+        e.stopping = true;
+    }
+    e.cv.notify_all();
+    e.thread.join();
+    close(e.fd);
+    e.fd = -1;
+    alloc_report(e.allocs);
+}
+
+UdpExporter::Counters UdpExporter::counters() const {
+    const Impl& e = *impl_;
+    Counters c;
+    c.datagrams = e.datagrams.load(std::memory_order_relaxed);
+    c.lines = e.lines.load(std::memory_order_relaxed);
+    c.dropped = e.dropped.load(std::memory_order_relaxed);
+    c.dropped_lines = e.dropped_lines.load(std::memory_order_relaxed);
+    return c;
+}
+
+}  // namespace nsm
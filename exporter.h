@@ -0,0 +1,79 @@
+/*
+ * Push exporter for a Monitor: probe states and metrics over UDP, for sites that
+ * collect with StatsD or InfluxDB instead of scraping
+ *
+ *   StatsD     nsm.<probe>.state:0|g           0 ok, 1 degraded, 2 fail, 3 unknown
+ *              nsm.<probe>.metric:12.3|g       also p99, availability, perf.<label>
+ *              nsm.engine.results:42|c         results and spawns since the last push
+ *   Influx     nsm_probe,probe=<probe>,group=<group> state="ok",code=0i,metric=12.3,... <ns>
+ *              nsm_perf,probe=<probe>,label=<label>,uom=ms value=0.8 <ns>
+ *              nsm_engine results=1234i,spawns=56i,wakeups=789i <ns>
+ *   startup    once every probe has reported, the startup timeline
+ *              (Monitor::startup) in ms since the process started:
+ *              nsm.startup.first_spawn:6.7|ms, nsm.startup.first_result.<probe>:39.9|ms
+ *              nsm_startup main=5.8,first_spawn=6.7 <ns>
+ *              nsm_startup,probe=<probe> first_result=39.9 <ns>
+ *
+ * Every interval one thread takes a snapshot and formats it line by line into a
+ * buffer allocated once, sending a datagram whenever the next line would not fit
+ * (max_datagram, one MTU by default) and the rest at the end. So an interval
+ * costs one send() per datagram, whatever the number of probes; nothing is
+ * allocated in steady state. A failed send() counts as a drop; nothing is
+ * retried, the next interval carries fresh values anyway.
+ *
+ *     nsm::UdpExporter statsd(monitor, {nsm::UdpExporter::Format::StatsD, "127.0.0.1", 8125});
+ *     statsd.start();
+ *     // nc -klu 8125
+ */
+#ifndef NSM_EXPORTER_H
+#define NSM_EXPORTER_H
+
+#include "netserialmon.h"
+
+#include <memory>
+#include <string>
+
+namespace nsm {
+
+class UdpExporter {
+public:
+    enum class Format { StatsD, Influx };
+
+    struct Options {
+        Format format = Format::StatsD;
+        std::string host = "127.0.0.1";
+        int port = 8125;                    // InfluxDB's UDP listener usually is 8089
+        int interval_ms = 10000;
+        std::string prefix = "nsm";         // StatsD name prefix / Influx measurement prefix
+        int max_datagram = 1432;            // payload bytes: 1500 MTU less IPv6 and UDP headers, rounded down
+    };
+
+    // Running totals; rates come from the difference of two reads.
+    struct Counters {
+        unsigned long long datagrams = 0;   // sent
+        unsigned long long lines = 0;       // sent, in those datagrams
+        unsigned long long dropped = 0;     // datagrams send() refused
+        unsigned long long dropped_lines = 0;   // in those, plus lines too long for any datagram
+    };
+
+    UdpExporter(const Monitor& monitor, Options opts);
+    ~UdpExporter();                 // stops the exporter
+    UdpExporter(const UdpExporter&) = delete;
+    UdpExporter& operator=(const UdpExporter&) = delete;
+
+    // Resolve the collector and start pushing. False, with a message on stderr, if
+    // the host cannot be resolved.
+    bool start();
+    // Push one last time, then stop.
+    void stop();
+
+    Counters counters() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace nsm
+
+#endif  // NSM_EXPORTER_H
@@ -0,0 +1,251 @@
+/*
+ * Listening, fan-out and poll loop shared by the dashboard and the feed (see fanout.h)
+ */
+
+#include "fanout.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace nsm {
+namespace fanout {
+
+long long monotonic_ms() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool Server::bind_listener(const std::string& address, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+    addrinfo* res = nullptr;
+    char port_str[16];
+    std::snprintf(port_str, sizeof(port_str), "%d", port);
+    if (int rc = getaddrinfo(address.empty() ? nullptr : address.c_str(), port_str, &hints, &res); rc != 0) {
+        std::fprintf(stderr, "%s: %s: %s\n", settings_.tag, address.c_str(), gai_strerror(rc));
+        return false;
+    }
+    int err = 0;
+    for (addrinfo* ai = res; ai && listen_fd_ < 0; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0) {
+            listen_fd_ = fd;
+        } else {
+            err = errno;
+            close(fd);
+        }
+    }
+    freeaddrinfo(res);
+    if (listen_fd_ < 0) {
+        std::fprintf(stderr, "%s: cannot listen on %s port %d: %s\n", settings_.tag, address.c_str(), port,
+                     std::strerror(err));
+        return false;
+    }
+    return true;
+}
+
+bool Server::start(const std::string& address, int port) {
+    if (thread_.joinable()) return true;
+    if (!bind_listener(address, port)) return false;
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        std::fprintf(stderr, "%s: eventfd: %s\n", settings_.tag, std::strerror(errno));
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    // State changes wake the server at once; metric-only changes wait for the next refresh.
+    subscription_ = monitor_.subscribe([this](unsigned) { wake(); });
+    monitor_.snapshot(sent_);       // what the first clients get
+    snapshot_valid_ = false;
+    stopping_.store(false);
+    thread_ = std::thread([this] { run(); });
+    return true;
+}
+
+void Server::stop() {
+    if (!thread_.joinable()) return;
+    monitor_.unsubscribe(subscription_);
+    stopping_.store(true);
+    wake();
+    thread_.join();
+    for (Client& c : clients_) drop(c);
+    clients_.clear();
+    close(listen_fd_);
+    close(wake_fd_);
+    listen_fd_ = wake_fd_ = -1;
+}
+
+void Server::wake() {
+    const std::uint64_t one = 1;
+    (void)!write(wake_fd_, &one, sizeof(one));
+}
+
+// Queue bytes to a client, sending at once what the socket takes.
+void Server::send_to(Client& c, const char* data, std::size_t len) {
+    if (c.fd < 0) return;
+    if (c.out.empty()) {
+        const ssize_t n = send(c.fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            drop(c);
+            return;
+        }
+        const std::size_t sent_now = n > 0 ? static_cast<std::size_t>(n) : 0;
+        data += sent_now;
+        len -= sent_now;
+    }
+    if (c.out.size() + len > settings_.max_pending) {
+        drop(c);        // it stopped reading; never let one client hold memory
+        return;
+    }
+    c.out.append(data, len);
+    c.last_write_ms = monotonic_ms();
+}
+
+void Server::flush(Client& c) {
+    while (!c.out.empty()) {
+        const ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            c.out.erase(0, static_cast<std::size_t>(n));
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        drop(c);
+        return;
+    }
+    if (c.close_when_sent) drop(c);
+}
+
+void Server::drop(Client& c) {
+    if (c.fd >= 0) close(c.fd);
+    c.fd = -1;
+}
+
+void Server::read_from(Client& c) {
+    char buf[2048];
+    ssize_t n;
+    while ((n = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        if (!on_input(c, buf, static_cast<std::size_t>(n))) return;
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) drop(c);
+}
+
+const std::string& Server::snapshot() {
+    if (!snapshot_valid_) {
+        snapshot_.clear();
+        encode_snapshot(snapshot_);
+        snapshot_valid_ = true;
+    }
+    return snapshot_;
+}
+
+void Server::refresh() {
+    monitor_.snapshot(current_);
+    bool structure = current_.size() != sent_.size();
+    for (std::size_t i = 0; !structure && i < current_.size(); ++i)
+        structure = current_[i].name != sent_[i].name || current_[i].group != sent_[i].group;
+    message_.clear();
+    if (structure) {
+        sent_ = current_;
+        snapshot_valid_ = false;
+        encode_structure(message_);
+        broadcast();
+        return;
+    }
+    changed_.clear();
+    for (std::size_t i = 0; i < current_.size(); ++i)
+        if (!same_values(current_[i], sent_[i])) changed_.push_back(i);
+    if (changed_.empty()) return;
+    encode_delta(message_, changed_);
+    for (const std::size_t i : changed_) sent_[i] = current_[i];
+    snapshot_valid_ = false;
+    broadcast();
+}
+
+void Server::broadcast() {
+    for (Client& c : clients_)
+        if (c.subscribed) send_to(c, message_.data(), message_.size());
+}
+
+void Server::keepalive(long long now) {
+    for (Client& c : clients_)
+        if (c.subscribed && c.out.empty() && now - c.last_write_ms >= settings_.keepalive_ms)
+            send_to(c, settings_.ping, settings_.ping_len);
+}
+
+void Server::accept_clients() {
+    int fd;
+    while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (static_cast<int>(clients_.size()) >= settings_.max_clients) {
+            if (settings_.busy)
+                (void)!send(fd, settings_.busy, std::strlen(settings_.busy), MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            continue;
+        }
+        Client c;
+        c.fd = fd;
+        c.last_write_ms = monotonic_ms();
+        on_accept(c);
+        clients_.push_back(std::move(c));
+    }
+}
+
+void Server::run() {
+    std::vector<pollfd> pfds;
+    long long next_refresh = monotonic_ms() + settings_.refresh_ms;
+    while (!stopping_.load()) {
+        pfds.clear();
+        pfds.push_back(pollfd{wake_fd_, POLLIN, 0});
+        pfds.push_back(pollfd{listen_fd_, POLLIN, 0});
+        for (const Client& c : clients_)
+            pfds.push_back(pollfd{c.fd, static_cast<short>(POLLIN | (c.out.empty() ? 0 : POLLOUT)), 0});
+        const int timeout = static_cast<int>(std::max(0LL, next_refresh - monotonic_ms()));
+        if (poll(pfds.data(), pfds.size(), timeout) < 0 && errno != EINTR) {
+            std::fprintf(stderr, "%s: poll: %s\n", settings_.tag, std::strerror(errno));
+            break;
+        }
+        if (stopping_.load()) break;
+
+        bool changed = false;
+        if (pfds[0].revents) {
+            std::uint64_t n;
+            while (read(wake_fd_, &n, sizeof(n)) > 0) {}
+            changed = true;
+        }
+        // Bring the snapshot up to date before new clients get it.
+        const long long now = monotonic_ms();
+        if (changed || now >= next_refresh) {
+            refresh();
+            keepalive(now);
+            next_refresh = now + settings_.refresh_ms;
+        }
+        // New clients are appended after the polled ones; only those have pfds.
+        const std::size_t polled = pfds.size() - 2;
+        if (pfds[1].revents) accept_clients();
+        for (std::size_t i = 0; i < polled; ++i) {
+            Client& c = clients_[i];
+            if (c.fd < 0) continue;
+            if (pfds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) read_from(c);
+            if (c.fd >= 0 && (pfds[i + 2].revents & POLLOUT)) flush(c);
+        }
+        clients_.erase(std::remove_if(clients_.begin(), clients_.end(), [](const Client& c) { return c.fd < 0; }),
+                       clients_.end());
+    }
+}
+
+}  // namespace fanout
+}  // namespace nsm
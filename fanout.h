@@ -0,0 +1,113 @@
+/*
+ * Client plumbing shared by the dashboard (dashboard.h) and the state feed
+ * (feed.h); internal to the library.
+ *
+ * A Server listens on a TCP address and runs one poll() thread that accepts
+ * clients, reads what they send, and pushes the Monitor's changes to the ones
+ * that subscribed: it keeps the probe list last sent, and on a wakeup or every
+ * refresh_ms compares a fresh snapshot against it. A changed list of names goes
+ * out whole, otherwise only the probes whose values changed; the subclass says
+ * what counts as a change and encodes both messages once for every client.
+ * Sockets are non-blocking and a client that stops reading is dropped once
+ * max_pending bytes queue up for it.
+ */
+#ifndef NSM_FANOUT_H
+#define NSM_FANOUT_H
+
+#include "netserialmon.h"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nsm {
+namespace fanout {
+
+long long monotonic_ms();
+
+struct Client {
+    int fd = -1;
+    std::string in;                 // request bytes kept by on_input
+    std::string out;                // queued, not yet accepted by the socket
+    bool subscribed = false;        // gets broadcasts and keepalives
+    bool close_when_sent = false;
+    long long last_write_ms = 0;
+};
+
+struct Settings {
+    const char* tag;                // message prefix: "http", "feed"
+    int max_clients;
+    std::size_t max_pending;        // unsent bytes before a slow client is dropped
+    int refresh_ms;                 // metric-only changes are picked up this often
+    int keepalive_ms;               // idle subscribers get ping after this long
+    const char* ping;
+    std::size_t ping_len;
+    const char* busy;               // sent to clients over max_clients, or nullptr
+};
+
+class Server {
+public:
+    Server(Monitor& monitor, const Settings& settings) : monitor_(monitor), settings_(settings) {}
+    virtual ~Server() = default;    // the owner calls stop() first: the thread calls the hooks
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Bind and start the thread. False, with a message on stderr, if the
+    // address cannot be bound.
+    bool start(const std::string& address, int port);
+    void stop();
+
+protected:
+    // All hooks run on the server thread.
+    virtual void on_accept(Client&) {}
+    // Bytes from c; false to stop reading from it for this wakeup.
+    virtual bool on_input(Client&, const char*, std::size_t) { return true; }
+    virtual bool same_values(const ProbeView& a, const ProbeView& b) const = 0;
+    virtual void encode_snapshot(std::string& out) = 0;     // of sent()
+    // What subscribers get when sent() has just been replaced by a new list.
+    virtual void encode_structure(std::string& out) = 0;
+    // What subscribers get for the probes at changed, new values in current().
+    virtual void encode_delta(std::string& out, const std::vector<std::size_t>& changed) = 0;
+
+    // Take a snapshot and push what changed since the last one to the subscribers.
+    void refresh();
+    const std::string& snapshot();      // encode_snapshot() of sent(), cached until it changes
+    void send_to(Client& c, const char* data, std::size_t len);
+    void drop(Client& c);
+
+    const std::vector<ProbeView>& sent() const { return sent_; }
+    const std::vector<ProbeView>& current() const { return current_; }
+
+private:
+    Monitor& monitor_;
+    const Settings settings_;
+    int listen_fd_ = -1;
+    int wake_fd_ = -1;              // eventfd: a probe changed, or stop
+    int subscription_ = 0;
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;
+    std::vector<Client> clients_;
+
+    // Last state sent to subscribers, and its encodings
+    std::vector<ProbeView> sent_, current_;
+    std::vector<std::size_t> changed_;
+    std::string snapshot_;
+    bool snapshot_valid_ = false;
+    std::string message_;           // scratch for the message being fanned out
+
+    bool bind_listener(const std::string& address, int port);
+    void wake();
+    void flush(Client& c);
+    void read_from(Client& c);
+    void broadcast();
+    void keepalive(long long now);
+    void accept_clients();
+    void run();
+};
+
+}  // namespace fanout
+}  // namespace nsm
+
+#endif  // NSM_FANOUT_H
@@ -0,0 +1,111 @@
+/*
+ * State feed for parent monitors: snapshot on connect, binary deltas after (see feed.h)
+ */
+
+#include "feed.h"
+#include "fanout.h"
+#include "feed_proto.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace nsm {
+
+namespace {
+
+constexpr int kMaxParents = 16;
+constexpr std::size_t kMaxPending = 256 * 1024;     // unsent bytes before a slow parent is dropped
+constexpr int kRefreshMs = 1000;                    // metric-only changes are picked up this often
+constexpr int kKeepaliveMs = 15000;                 // parents give up on a link silent for 45 s
+
+const char kPing[] = {1, static_cast<char>(feed::kKeepalive)};
+
+bool same_metric(double a, double b) {
+    return (std::isnan(a) && std::isnan(b)) ||
+           (!std::isnan(a) && !std::isnan(b) && feed::wire_metric(a) == feed::wire_metric(b));
+}
+
+}  // namespace
+
+struct FeedServer::Impl : fanout::Server {
+    Options opts;
+    std::string body;               // scratch for the frame being encoded
+
+    std::atomic<unsigned long long> snapshots{0}, deltas{0}, changes{0}, bytes{0};
+
+    Impl(Monitor& m, Options o)
+        : Server(m, {"feed", kMaxParents, kMaxPending, kRefreshMs, kKeepaliveMs, kPing, sizeof(kPing), nullptr}),
+          opts(std::move(o)) {}
+
+    // Parents send nothing (reading only notices when they hang up) and get
+    // every change from the hello on.
+    void on_accept(fanout::Client& c) override {
+        c.subscribed = true;
+        send_to(c, feed::kHello, feed::kHelloLen);
+        const std::string& snap = snapshot();
+        send_to(c, snap.data(), snap.size());
+    }
+
+    // What a parent sees of a probe; p99, availability and perfdata stay local.
+    bool same_values(const ProbeView& a, const ProbeView& b) const override {
+        return a.state == b.state && a.stale == b.stale && same_metric(a.metric, b.metric);
+    }
+
+    void encode_snapshot(std::string& out) override {
+        body.assign(1, static_cast<char>(feed::kSnapshot));
+        feed::put_varint(body, sent().size());
+        for (const ProbeView& p : sent()) {
+            feed::put_string(body, p.name);
+            feed::put_string(body, p.group);
+            feed::put_value(body, p.state, p.stale, p.metric);
+        }
+        feed::put_frame(out, body);
+    }
+
+    void encode_structure(std::string& out) override {
+        out = snapshot();
+        snapshots.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(out.size(), std::memory_order_relaxed);
+    }
+
+    void encode_delta(std::string& out, const std::vector<std::size_t>& changed) override {
+        body.assign(1, static_cast<char>(feed::kDelta));
+        feed::put_varint(body, changed.size());
+        for (const std::size_t i : changed) {
+            feed::put_varint(body, i);
+            feed::put_value(body, current()[i].state, current()[i].stale, current()[i].metric);
+        }
+        feed::put_frame(out, body);
+        deltas.fetch_add(1, std::memory_order_relaxed);
+        changes.fetch_add(changed.size(), std::memory_order_relaxed);
+        bytes.fetch_add(out.size(), std::memory_order_relaxed);
+    }
+};
+
+FeedServer::FeedServer(Monitor& monitor, Options opts) : impl_(std::make_unique<Impl>(monitor, std::move(opts))) {}
+
+FeedServer::~FeedServer() { stop(); }
+
+bool FeedServer::start() {
+    Impl& f = *impl_;
+    if (!f.start(f.opts.address, f.opts.port)) return false;
+    std::fprintf(stderr, "feed: serving parents on %s port %d\n", f.opts.address.c_str(), f.opts.port);
+    return true;
+}
+
+void FeedServer::stop() { impl_->stop(); }
+
+FeedServer::Counters FeedServer::counters() const {
+    const Impl& f = *impl_;
+    Counters c;
+    c.snapshots = f.snapshots.load(std::memory_order_relaxed);
+    c.deltas = f.deltas.load(std::memory_order_relaxed);
+    c.changes = f.changes.load(std::memory_order_relaxed);
+    c.bytes = f.bytes.load(std::memory_order_relaxed);
+    return c;
+}
+
+}  // namespace nsm
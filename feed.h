@@ -0,0 +1,62 @@
+/*
+ * State feed of a Monitor for parent monitors: a small TCP server speaking a
+ * compact binary delta protocol (see feed_proto.h)
+ *
+ * A parent lists its children in its config,
+ *
+ *   [child pi-17]
+ *   address = 10.0.0.17:7010
+ *
+ * and gets a snapshot of every probe on connect, then only what changed: a
+ * probe's index, state and metric in a few bytes. Everything runs on one poll()
+ * thread; each change is encoded once and queued to every parent, and parents
+ * that stop reading are dropped.
+ *
+ *     nsm::FeedServer feed(monitor, {"0.0.0.0", 7010});
+ *     feed.start();
+ */
+#ifndef NSM_FEED_H
+#define NSM_FEED_H
+
+#include "netserialmon.h"
+
+#include <memory>
+#include <string>
+
+namespace nsm {
+
+class FeedServer {
+public:
+    struct Options {
+        std::string address = "127.0.0.1";     // "0.0.0.0" or "::" to serve the network
+        int port = 7010;
+    };
+
+    // Running totals, for comparing against full status dumps.
+    struct Counters {
+        unsigned long long snapshots = 0;   // snapshot frames encoded
+        unsigned long long deltas = 0;      // delta frames encoded
+        unsigned long long changes = 0;     // probes in those deltas
+        unsigned long long bytes = 0;       // encoded, counted once however many parents get them
+    };
+
+    FeedServer(Monitor& monitor, Options opts);
+    ~FeedServer();                  // stops the server
+    FeedServer(const FeedServer&) = delete;
+    FeedServer& operator=(const FeedServer&) = delete;
+
+    // Bind and start serving. False, with a message on stderr, if the address
+    // cannot be bound.
+    bool start();
+    void stop();
+
+    Counters counters() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace nsm
+
+#endif  // NSM_FEED_H
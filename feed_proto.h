@@ -0,0 +1,118 @@
+/*
+ * Wire format between a child monitor's FeedServer (feed.h) and the [child NAME]
+ * links of a parent monitor; internal to the library.
+ *
+ * On connect the child sends the hello "NSMF" 0x01, then frames:
+ *
+ *   frame     varint body length, body
+ *   body      type byte, payload
+ *   'S'       snapshot: varint count, then per probe
+ *               varint length + name, varint length + group, varint flags, [metric]
+ *   'D'       delta: varint count, then per changed probe
+ *               varint index (into the last snapshot), varint flags, [metric]
+ *   'K'       keepalive, empty; sent when the link has been idle
+ *
+ *   flags     bits 0-1: state + 1 (0 unknown, 1 fail, 2 ok, 3 degraded)
+ *             bit 2: stale; bit 3: a metric follows
+ *   metric    IEEE 754 single precision, little endian
+ *
+ * Varints are LEB128 (7 bits per byte, low group first), so one changed probe of
+ * a child with fewer than 128 probes costs 6 bytes plus the frame's 3.
+ */
+#ifndef NSM_FEED_PROTO_H
+#define NSM_FEED_PROTO_H
+
+#include "netserialmon.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace nsm {
+namespace feed {
+
+constexpr char kHello[] = "NSMF\x01";
+constexpr std::size_t kHelloLen = 5;
+constexpr std::size_t kMaxFrame = 1 << 20;      // a parent drops links that announce more
+
+enum : unsigned char { kSnapshot = 'S', kDelta = 'D', kKeepalive = 'K' };
+enum : unsigned { kStale = 4, kHasMetric = 8 };
+
+inline void put_varint(std::string& out, std::uint64_t v) {
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+// False if the input ends inside the varint or it is longer than 64 bits allow.
+inline bool get_varint(const unsigned char*& p, const unsigned char* end, std::uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        const unsigned char b = *p++;
+        v |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline void put_string(std::string& out, const std::string& s) {
+    put_varint(out, s.size());
+    out += s;
+}
+
+inline bool get_string(const unsigned char*& p, const unsigned char* end, std::string& s) {
+    std::uint64_t n;
+    if (!get_varint(p, end, n) || n > static_cast<std::uint64_t>(end - p)) return false;
+    s.assign(reinterpret_cast<const char*>(p), static_cast<std::size_t>(n));
+    p += n;
+    return true;
+}
+
+// The metric travels as a float: plenty for display, and a change below its
+// precision is no change on the wire either. Compare through this.
+inline float wire_metric(double v) { return static_cast<float>(v); }
+
+inline void put_value(std::string& out, ProbeState st, bool stale, double metric) {
+    const bool has_metric = !std::isnan(metric);
+    put_varint(out, static_cast<unsigned>(static_cast<int>(st) + 1) | (stale ? kStale : 0u) |
+                        (has_metric ? kHasMetric : 0u));
+    if (!has_metric) return;
+    const float f = wire_metric(metric);
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    const char b[4] = {static_cast<char>(bits), static_cast<char>(bits >> 8), static_cast<char>(bits >> 16),
+                       static_cast<char>(bits >> 24)};
+    out.append(b, 4);
+}
+
+inline bool get_value(const unsigned char*& p, const unsigned char* end, ProbeState& st, bool& stale,
+                      double& metric) {
+    std::uint64_t flags;
+    if (!get_varint(p, end, flags)) return false;
+    st = static_cast<ProbeState>(static_cast<int>(flags & 3) - 1);
+    stale = (flags & kStale) != 0;
+    metric = NAN;
+    if (!(flags & kHasMetric)) return true;
+    if (end - p < 4) return false;
+    const std::uint32_t bits = static_cast<std::uint32_t>(p[0]) | static_cast<std::uint32_t>(p[1]) << 8 |
+                               static_cast<std::uint32_t>(p[2]) << 16 | static_cast<std::uint32_t>(p[3]) << 24;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    metric = f;
+    p += 4;
+    return true;
+}
+
+// Append body (type byte and payload) to out as one frame.
+inline void put_frame(std::string& out, const std::string& body) {
+    put_varint(out, body.size());
+    out += body;
+}
+
+}  // namespace feed
+}  // namespace nsm
+
+#endif  // NSM_FEED_PROTO_H
@@ -0,0 +1,451 @@
+/*
+ * Compressed result history: block codec and history files (see history.h)
+ */
+
+#include "history.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nsm {
+
+namespace {
+
+constexpr char kBlockMagic[4] = {'N', 'S', 'M', 'B'};
+constexpr char kFooterMagic[4] = {'N', 'S', 'M', 'E'};
+constexpr std::size_t kHeader = HistoryEncoder::kHeader, kFooter = HistoryEncoder::kFooter;
+constexpr std::size_t kMaxPayload = 1 << 24;     // larger lengths mean a damaged file
+// Most bits one sample can take: time 5 + 64, state 1 + 2, metric 2 + 5 + 6 + 64.
+constexpr std::size_t kMaxSampleBits = 149;
+
+// One NaN for all: NaNs differ in their payload bits, which would defeat the XOR.
+std::uint64_t value_bits(double v) {
+    if (std::isnan(v)) v = NAN;
+    std::uint64_t b;
+    std::memcpy(&b, &v, sizeof(b));
+    return b;
+}
+
+double bits_value(std::uint64_t b) {
+    double v;
+    std::memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+void put_u32(unsigned char* p, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+void put_u64(unsigned char* p, std::uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+std::uint32_t get_u32(const unsigned char* p) {
+    std::uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+std::uint64_t get_u64(const unsigned char* p) {
+    std::uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+// Time codes for the delta of delta: '0' for none, else a prefix and the value
+// offset into an unsigned field of that many bits.
+struct DodBucket {
+    std::uint64_t prefix;
+    int prefix_bits, bits;
+};
+constexpr DodBucket kDod[] = {{0b10, 2, 7}, {0b110, 3, 9}, {0b1110, 4, 12}, {0b11110, 5, 32}};
+
+bool matches(const HistorySample& s, const HistoryQuery& q) {
+    if (s.t_ms < q.from_ms || s.t_ms > q.to_ms) return false;
+    if (q.min_value == -INFINITY && q.max_value == INFINITY) return true;
+    return !std::isnan(s.value) && s.value >= q.min_value && s.value <= q.max_value;
+}
+
+bool block_may_match(const HistoryBlockInfo& b, const HistoryQuery& q) {
+    if (b.t_max < q.from_ms || b.t_min > q.to_ms) return false;
+    if (q.min_value == -INFINITY && q.max_value == INFINITY) return true;
+    return !std::isnan(b.min) && b.max >= q.min_value && b.min <= q.max_value;
+}
+
+bool read_exact(int fd, unsigned char* buf, std::size_t len, off_t off) {
+    while (len) {
+        const ssize_t n = pread(fd, buf, len, off);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= static_cast<std::size_t>(n);
+        off += n;
+    }
+    return true;
+}
+
+bool write_exact(int fd, const unsigned char* buf, std::size_t len, off_t off) {
+    while (len) {
+        const ssize_t n = pwrite(fd, buf, len, off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= static_cast<std::size_t>(n);
+        off += n;
+    }
+    return true;
+}
+
+// The block at off, if it is complete: its payload length and footer.
+bool read_block(int fd, off_t off, off_t size, std::uint32_t& len, HistoryBlockInfo& info) {
+    unsigned char head[kHeader], foot[kFooter];
+    if (off + static_cast<off_t>(kHeader + kFooter) > size || !read_exact(fd, head, kHeader, off)) return false;
+    len = get_u32(head + 4);
+    if (std::memcmp(head, kBlockMagic, 4) != 0 || len > kMaxPayload ||
+        off + static_cast<off_t>(kHeader + len + kFooter) > size ||
+        !read_exact(fd, foot, kFooter, off + static_cast<off_t>(kHeader + len)))
+        return false;
+    if (std::memcmp(foot + 40, kFooterMagic, 4) != 0 || get_u32(foot + 4) != len) return false;
+    info.count = get_u32(foot);
+    info.t_min = static_cast<long long>(get_u64(foot + 8));
+    info.t_max = static_cast<long long>(get_u64(foot + 16));
+    info.min = bits_value(get_u64(foot + 24));
+    info.max = bits_value(get_u64(foot + 32));
+    return true;
+}
+
+// Where the intact blocks of a file end. The last block is checked through the
+// length in its footer; only if that fails is the file walked from the start.
+off_t intact_end(int fd, off_t size) {
+    unsigned char foot[kFooter];
+    if (size >= static_cast<off_t>(kHeader + kFooter) &&
+        read_exact(fd, foot, kFooter, size - static_cast<off_t>(kFooter)) &&
+        std::memcmp(foot + 40, kFooterMagic, 4) == 0) {
+        const off_t start = size - static_cast<off_t>(kHeader + kFooter + get_u32(foot + 4));
+        std::uint32_t len;
+        HistoryBlockInfo info;
+        if (start >= 0 && read_block(fd, start, size, len, info)) return size;
+    }
+    off_t off = 0;
+    std::uint32_t len;
+    HistoryBlockInfo info;
+    while (read_block(fd, off, size, len, info)) off += static_cast<off_t>(kHeader + len + kFooter);
+    return off;
+}
+
+// Drop the oldest blocks so that at most keep bytes remain, via a temp file that
+// is synced before the rename so that a crash leaves either the old or the new file.
+bool trim(const std::string& path, int fd, off_t size, off_t keep) {
+    off_t off = 0;
+    std::uint32_t len;
+    HistoryBlockInfo info;
+    while (size - off > keep && read_block(fd, off, size, len, info)) off += static_cast<off_t>(kHeader + len + kFooter);
+    if (off == 0) return true;
+    std::vector<unsigned char> tail(static_cast<std::size_t>(size - off));
+    if (!read_exact(fd, tail.data(), tail.size(), off)) return false;
+    const std::string tmp = path + ".tmp";
+    const int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) return false;
+    bool ok = write_exact(out, tail.data(), tail.size(), 0);
+    ok = (fsync(out) == 0) && ok;
+    ok = (close(out) == 0) && ok;
+    if (ok && std::rename(tmp.c_str(), path.c_str()) == 0) return true;
+    unlink(tmp.c_str());
+    return false;
+}
+
+}  // namespace
+
+// ----- Encoder -----
+
+HistoryEncoder::HistoryEncoder(unsigned max_samples, std::size_t max_bytes)
+    : max_samples_(std::max(max_samples, 1u)),
+      max_bits_(std::max(max_bytes, kMaxSampleBits / 8 + 1) * 8),
+      buf_(kHeader + max_bits_ / 8 + kFooter) {}
+
+void HistoryEncoder::put(std::uint64_t v, int n) {
+    while (n > 0) {
+        const int room = 8 - static_cast<int>(bits_ % 8);
+        const int take = std::min(room, n);
+        const unsigned chunk = static_cast<unsigned>(v >> (n - take)) & ((1u << take) - 1);
+        buf_[kHeader + bits_ / 8] |= static_cast<unsigned char>(chunk << (room - take));
+        bits_ += static_cast<std::size_t>(take);
+        n -= take;
+    }
+}
+
+bool HistoryEncoder::append(const HistorySample& s) {
+    if (info_.count >= max_samples_ || bits_ + kMaxSampleBits > max_bits_) return false;
+    if (sealed_) {
+        std::memset(buf_.data() + kHeader + payload_size(), 0, kFooter);
+        sealed_ = false;
+    }
+    const std::uint64_t bits = value_bits(s.value);
+    const unsigned st = static_cast<unsigned>(static_cast<int>(s.state) + 1) & 3;
+    if (info_.count == 0) {
+        put(static_cast<std::uint64_t>(s.t_ms), 64);
+        put(st, 2);
+        put(bits, 64);
+        info_.t_min = info_.t_max = s.t_ms;
+        prev_delta_ = 0;
+    } else {
+        // Wrapping arithmetic: any two times round-trip, however far apart.
+        const std::uint64_t delta = static_cast<std::uint64_t>(s.t_ms) - static_cast<std::uint64_t>(prev_t_);
+        const std::uint64_t dod_bits = delta - static_cast<std::uint64_t>(prev_delta_);
+        const long long dod = static_cast<long long>(dod_bits);
+        if (dod == 0) {
+            put(0, 1);
+        } else {
+            bool done = false;
+            for (const DodBucket& b : kDod) {
+                const long long lo = -(1LL << (b.bits - 1)) + 1, hi = 1LL << (b.bits - 1);
+                if (dod < lo || dod > hi) continue;
+                put(b.prefix, b.prefix_bits);
+                put(static_cast<std::uint64_t>(dod - lo), b.bits);
+                done = true;
+                break;
+            }
+            if (!done) {
+                put(0b11111, 5);
+                put(dod_bits, 64);
+            }
+        }
+        prev_delta_ = static_cast<long long>(delta);
+
+        if (st == (static_cast<unsigned>(static_cast<int>(prev_state_) + 1) & 3)) {
+            put(0, 1);
+        } else {
+            put(1, 1);
+            put(st, 2);
+        }
+
+        const std::uint64_t x = bits ^ prev_bits_;
+        if (x == 0) {
+            put(0, 1);
+        } else {
+            const int lead = std::min(__builtin_clzll(x), 31), trail = __builtin_ctzll(x);
+            if (prev_lead_ >= 0 && lead >= prev_lead_ && trail >= prev_trail_) {
+                put(0b10, 2);
+                put(x >> prev_trail_, 64 - prev_lead_ - prev_trail_);
+            } else {
+                const int len = 64 - lead - trail;
+                put(0b11, 2);
+                put(static_cast<unsigned>(lead), 5);
+                put(static_cast<unsigned>(len - 1), 6);
+                put(x >> trail, len);
+                prev_lead_ = lead;
+                prev_trail_ = trail;
+            }
+        }
+        info_.t_min = std::min(info_.t_min, s.t_ms);
+        info_.t_max = std::max(info_.t_max, s.t_ms);
+    }
+    if (!std::isnan(s.value)) {
+        if (std::isnan(info_.min) || s.value < info_.min) info_.min = s.value;
+        if (std::isnan(info_.max) || s.value > info_.max) info_.max = s.value;
+    }
+    prev_t_ = s.t_ms;
+    prev_bits_ = bits;
+    prev_state_ = s.state;
+    ++info_.count;
+    return true;
+}
+
+const unsigned char* HistoryEncoder::seal(std::size_t& len) {
+    const std::size_t payload = payload_size();
+    unsigned char* p = buf_.data();
+    std::memcpy(p, kBlockMagic, 4);
+    put_u32(p + 4, static_cast<std::uint32_t>(payload));
+    unsigned char* f = p + kHeader + payload;
+    put_u32(f, info_.count);
+    put_u32(f + 4, static_cast<std::uint32_t>(payload));
+    put_u64(f + 8, static_cast<std::uint64_t>(info_.t_min));
+    put_u64(f + 16, static_cast<std::uint64_t>(info_.t_max));
+    put_u64(f + 24, value_bits(info_.min));
+    put_u64(f + 32, value_bits(info_.max));
+    std::memcpy(f + 40, kFooterMagic, 4);
+    sealed_ = true;
+    len = kHeader + payload + kFooter;
+    return p;
+}
+
+void HistoryEncoder::reset() {
+    std::memset(buf_.data(), 0, kHeader + payload_size() + (sealed_ ? kFooter : 0));
+    bits_ = 0;
+    info_ = HistoryBlockInfo();
+    prev_t_ = prev_delta_ = 0;
+    prev_bits_ = 0;
+    prev_lead_ = -1;
+    prev_trail_ = 0;
+    prev_state_ = ProbeState::Unknown;
+    sealed_ = false;
+}
+
+// ----- Decoder -----
+
+HistoryDecoder::HistoryDecoder(const unsigned char* payload, std::size_t len, unsigned count)
+    : p_(payload), bits_(len * 8), left_(count) {}
+
+bool HistoryDecoder::get(int n, std::uint64_t& v) {
+    if (pos_ + static_cast<std::size_t>(n) > bits_) return false;
+    v = 0;
+    while (n > 0) {
+        const int room = 8 - static_cast<int>(pos_ % 8);
+        const int take = std::min(room, n);
+        const unsigned byte = p_[pos_ / 8];
+        v = v << take | ((byte >> (room - take)) & ((1u << take) - 1));
+        pos_ += static_cast<std::size_t>(take);
+        n -= take;
+    }
+    return true;
+}
+
+bool HistoryDecoder::next(HistorySample& s) {
+    if (done_ >= left_) return false;
+    std::uint64_t v, st, bits;
+    if (done_ == 0) {
+        if (!get(64, v) || !get(2, st) || !get(64, bits)) return false;
+        s.t_ms = static_cast<long long>(v);
+        prev_delta_ = 0;
+    } else {
+        std::uint64_t bit;
+        int ones = 0;
+        // Count the prefix's ones: 0 to 4 pick a bucket, 5 is the 64-bit escape.
+        while (ones < 5) {
+            if (!get(1, bit)) return false;
+            if (!bit) break;
+            ++ones;
+        }
+        std::uint64_t dod_bits = 0;
+        if (ones == 5) {
+            if (!get(64, dod_bits)) return false;
+        } else if (ones > 0) {
+            const DodBucket& b = kDod[ones - 1];
+            if (!get(b.bits, v)) return false;
+            const long long lo = -(1LL << (b.bits - 1)) + 1;
+            dod_bits = static_cast<std::uint64_t>(static_cast<long long>(v) + lo);
+        }
+        const std::uint64_t delta = static_cast<std::uint64_t>(prev_delta_) + dod_bits;
+        s.t_ms = static_cast<long long>(static_cast<std::uint64_t>(prev_t_) + delta);
+        prev_delta_ = static_cast<long long>(delta);
+
+        if (!get(1, bit)) return false;
+        if (!bit) st = static_cast<unsigned>(static_cast<int>(prev_state_) + 1) & 3;
+        else if (!get(2, st)) return false;
+
+        if (!get(1, bit)) return false;
+        if (!bit) {
+            bits = prev_bits_;
+        } else {
+            if (!get(1, bit)) return false;
+            if (bit) {
+                std::uint64_t lead, len;
+                if (!get(5, lead) || !get(6, len)) return false;
+                prev_lead_ = static_cast<int>(lead);
+                prev_trail_ = 64 - prev_lead_ - static_cast<int>(len + 1);
+                if (prev_trail_ < 0) return false;
+            } else if (prev_lead_ < 0) {
+                return false;
+            }
+            if (!get(64 - prev_lead_ - prev_trail_, v)) return false;
+            bits = prev_bits_ ^ (v << prev_trail_);
+        }
+    }
+    s.state = static_cast<ProbeState>(static_cast<int>(st) - 1);
+    s.value = bits_value(bits);
+    prev_t_ = s.t_ms;
+    prev_bits_ = bits;
+    prev_state_ = s.state;
+    ++done_;
+    return true;
+}
+
+void decode_history(const unsigned char* payload, std::size_t len, unsigned count, const HistoryQuery& q,
+                    std::vector<HistorySample>& out) {
+    HistoryDecoder dec(payload, len, count);
+    HistorySample s;
+    while (dec.next(s))
+        if (matches(s, q)) out.push_back(s);
+}
+
+// ----- Files -----
+
+std::string history_file(const std::string& dir, const std::string& probe) {
+    std::string path = dir;
+    if (!path.empty() && path.back() != '/') path += '/';
+    for (const char c : probe) {
+        const unsigned char u = static_cast<unsigned char>(c);
+        if (std::isalnum(u) || c == '.' || c == '_' || c == '-') {
+            path += c;
+        } else {
+            char esc[4];
+            std::snprintf(esc, sizeof(esc), "%%%02X", u);
+            path += esc;
+        }
+    }
+    return path + ".hist";
+}
+
+bool history_append_block(const std::string& path, const unsigned char* block, std::size_t len,
+                          std::size_t keep_bytes) {
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    off_t end = ok ? intact_end(fd, st.st_size) : 0;
+    if (ok && end != st.st_size) {
+        std::fprintf(stderr, "history: %s: cutting off %lld damaged byte(s) at the end\n", path.c_str(),
+                     static_cast<long long>(st.st_size - end));
+        ok = ftruncate(fd, end) == 0;
+    }
+    ok = ok && write_exact(fd, block, len, end);
+    end += static_cast<off_t>(len);
+    if (ok && keep_bytes && end > static_cast<off_t>(keep_bytes))
+        ok = trim(path, fd, end, static_cast<off_t>(keep_bytes / 4 * 3));
+    const int saved = errno;
+    close(fd);
+    errno = saved;
+    return ok;
+}
+
+bool read_history(const std::string& path, const HistoryQuery& q, std::vector<HistorySample>& out,
+                  HistoryScanStats* stats) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    std::vector<unsigned char> payload;
+    off_t off = 0;
+    std::uint32_t len;
+    HistoryBlockInfo info;
+    while (read_block(fd, off, st.st_size, len, info)) {
+        if (stats) ++stats->blocks;
+        if (block_may_match(info, q)) {
+            payload.resize(len);
+            if (!read_exact(fd, payload.data(), len, off + static_cast<off_t>(kHeader))) break;
+            decode_history(payload.data(), len, info.count, q, out);
+            if (stats) stats->bytes_read += kHeader + len + kFooter;
+        } else if (stats) {
+            ++stats->skipped;
+            stats->bytes_read += kHeader + kFooter;
+        }
+        off += static_cast<off_t>(kHeader + len + kFooter);
+    }
+    close(fd);
+    return true;
+}
+
+}  // namespace nsm
@@ -0,0 +1,148 @@
+/*
+ * Compressed result history: per-probe time series of (time, state, metric),
+ * stored in blocks the way Gorilla (Facebook's in-memory TSDB) does it
+ *
+ *   time       delta of delta to the previous sample, in a 1 to 69 bit code;
+ *              a probe on a steady interval costs a few bits per sample
+ *   state      1 bit while unchanged
+ *   metric     XOR with the previous value's bits, leading and trailing zeros
+ *              left out; 1 bit while unchanged (or absent), and a changing
+ *              value reuses the previous value's bit window where it fits
+ *
+ * A block holds up to max_samples samples in at most max_bytes of payload. On
+ * disk a probe's file is a sequence of blocks,
+ *
+ *   block      "NSMB", u32 payload bytes, payload, footer
+ *   footer     u32 count, u32 payload bytes, i64 t_min, i64 t_max, f64 min,
+ *              f64 max, "NSME"
+ *
+ * (little endian, times in ms since the epoch, min/max over the metrics present,
+ * NAN if none), so a scan reads 8 + 44 bytes of a block that is outside its
+ * time or value range and skips the payload. The length in the footer lets the
+ * writer check the last block without reading the others.
+ *
+ *     nsm::HistoryEncoder enc;
+ *     while (enc.append(sample)) { ... }
+ *     std::size_t len;
+ *     const unsigned char* block = enc.seal(len);
+ *     nsm::history_append_block(path, block, len, 4 << 20);
+ */
+#ifndef NSM_HISTORY_H
+#define NSM_HISTORY_H
+
+#include "netserialmon.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace nsm {
+
+struct HistorySample {
+    long long t_ms = 0;                 // wall clock, ms since the epoch
+    ProbeState state = ProbeState::Unknown;
+    double value = NAN;                 // the probe's metric, NAN if it had none
+};
+
+// A block's footer: what a scan looks at before decoding anything.
+struct HistoryBlockInfo {
+    unsigned count = 0;
+    long long t_min = 0, t_max = 0;
+    double min = NAN, max = NAN;        // over the values that are not NAN
+};
+
+// Builds one block. The buffer is allocated by the constructor; append() and
+// seal() do not allocate.
+class HistoryEncoder {
+public:
+    static constexpr std::size_t kHeader = 8, kFooter = 44;
+
+    explicit HistoryEncoder(unsigned max_samples = 1024, std::size_t max_bytes = 4096);
+
+    // False, leaving the block as it is, when the block is full.
+    bool append(const HistorySample& s);
+    unsigned count() const { return info_.count; }
+    const HistoryBlockInfo& info() const { return info_; }
+    // Payload bytes so far
+    std::size_t payload_size() const { return (bits_ + 7) / 8; }
+
+    // The complete block, header and footer included. Valid until the next
+    // append() or reset().
+    const unsigned char* seal(std::size_t& len);
+    // Start an empty block.
+    void reset();
+
+private:
+    unsigned max_samples_;
+    std::size_t max_bits_;
+    std::vector<unsigned char> buf_;    // header, payload, room for the footer
+    std::size_t bits_ = 0;              // payload bits written
+    HistoryBlockInfo info_;
+    long long prev_t_ = 0, prev_delta_ = 0;
+    std::uint64_t prev_bits_ = 0;
+    int prev_lead_ = -1, prev_trail_ = 0;   // bit window of the last XOR; -1: none yet
+    ProbeState prev_state_ = ProbeState::Unknown;
+    bool sealed_ = false;               // the footer is in buf_
+
+    void put(std::uint64_t v, int n);
+};
+
+// Reads the samples back out of a block's payload; does not allocate.
+class HistoryDecoder {
+public:
+    HistoryDecoder(const unsigned char* payload, std::size_t len, unsigned count);
+    // False at the end of the block, or if the payload is cut short.
+    bool next(HistorySample& s);
+
+private:
+    const unsigned char* p_;
+    std::size_t bits_, pos_ = 0;
+    unsigned left_, done_ = 0;
+    long long prev_t_ = 0, prev_delta_ = 0;
+    std::uint64_t prev_bits_ = 0;
+    int prev_lead_ = -1, prev_trail_ = 0;
+    ProbeState prev_state_ = ProbeState::Unknown;
+
+    bool get(int n, std::uint64_t& v);
+};
+
+// Which samples a scan returns. A value range excludes samples without a metric.
+struct HistoryQuery {
+    long long from_ms = std::numeric_limits<long long>::min();
+    long long to_ms = std::numeric_limits<long long>::max();
+    double min_value = -INFINITY;
+    double max_value = INFINITY;
+};
+
+struct HistoryScanStats {
+    unsigned blocks = 0;                // looked at
+    unsigned skipped = 0;               // of those, rejected by their footer
+    unsigned long long bytes_read = 0;
+};
+
+// DIR/NAME.hist, with characters other than [A-Za-z0-9._-] in NAME as %XX.
+std::string history_file(const std::string& dir, const std::string& probe);
+
+// Append a sealed block to a history file, creating it (not its directory). A
+// partly written block at the end, left by a crash, is cut off first. When the
+// file grows beyond keep_bytes (0: no limit), the oldest blocks are dropped to
+// bring it down to three quarters of that. False, with errno set, on failure.
+bool history_append_block(const std::string& path, const unsigned char* block, std::size_t len,
+                          std::size_t keep_bytes);
+
+// Append the samples of a history file that match q to out, in file order
+// (oldest first); blocks whose footer rules them out are skipped unread. False
+// if the file cannot be read; a damaged block ends the scan.
+bool read_history(const std::string& path, const HistoryQuery& q, std::vector<HistorySample>& out,
+                  HistoryScanStats* stats = nullptr);
+
+// Same for one block's payload, e.g. one that has not been written yet.
+void decode_history(const unsigned char* payload, std::size_t len, unsigned count, const HistoryQuery& q,
+                    std::vector<HistorySample>& out);
+
+}  // namespace nsm
+
+#endif  // NSM_HISTORY_H
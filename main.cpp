@@ -2,101 +2,465 @@
  * Net & Serial Monitor (Raspberry Pi OS, C++/FLTK)
  *
  * Purpose:
- *   A tiny GUI that periodically runs two background subprocesses:
- *     1) "test_network.sh" to check network reachability.
- *     2) "test_serial.sh" to check serial connectivity.
- *   It shows:
- *     - A one-line status text like: "network=OK, serial=connected".
- *     - Three traffic-light-style filled circles horizontally:
- *         [0] network  (green=success, red=failure, gray=unknown at startup)
- *         [1] serial   (green=success, red=failure, gray=unknown at startup)
- *         [2] reserved (always gray for future use)
- *     - An [Exit] button to quit safely.
+ *   A tiny GUI that periodically runs the probes of its config file (by default
+ *   "test_network.sh" and "test_serial.sh") and shows:
+ *     - A grid of filled circles, one per configured probe, captioned with its
+ *       name and metric: green=OK, yellow=degraded, red=failure, gray=unknown.
+ *       A state restored from the previous run is washed out until the probe
+ *       reports again. Probes with a group sit under a heading per group;
+ *       cells wrap into rows, and the grid scrolls once they outgrow the
+ *       window. Gray captionless cells pad the grid to the configured slots.
+ *       Clicking a circle shows the output of that probe's last failed run.
+ *     - A one-line status text, "name=STATE (metric), ..." for every probe,
+ *       with a '?' after a stale state.
+ *     - [Stats], [Table] and [Exit] buttons: monitor self-metrics, a sortable
+ *       table of all probes, and quitting safely.
+ *   Probes, intervals, timeouts and layout come from an optional config file
+ *   that is re-applied whenever it changes on disk.
  *
  * Notes:
- *   - Keep the program small & simple (single source file).
+ *   - Keep the program small & simple: the probe engine is the netserialmon
+ *     library (netserialmon.h); this file is only its FLTK front end.
  *   - All UI labels and comments are in English.
  *   - FLTK is used for minimal dependencies on Raspberry Pi OS.
- *   - UI thread never blocks; worker threads update atomics.
- *   - A periodic FLTK timer polls the atomics and redraws.
+ *   - UI thread never blocks; the library's worker threads update atomics.
+ *   - A periodic FLTK timer copies a snapshot of them and redraws.
  */
 
 #include <FL/Fl.H>
 #include <FL/Fl_Window.H>
 #include <FL/Fl_Box.H>
 #include <FL/Fl_Button.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Image_Surface.H>
+#include <FL/Fl_Scrollbar.H>
+#include <FL/Fl_Table.H>
+#include <FL/Fl_Text_Display.H>
+#include <FL/Fl_Toggle_Button.H>
 #include <FL/fl_draw.H>
-#include <atomic>
-#include <chrono>
+#include "netserialmon.h"
+#include "alloc_count.h"
+#include "dashboard.h"
+#include "exporter.h"
+#include "feed.h"
+#include "png_encode.h"
+#include "service_notify.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
 #include <sstream>
 #include <string>
-#include <thread>
-#include <unistd.h>   // access()
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
-// ----- Simple tri-state: unknown / ok / fail -----
-enum class ProbeState : int { Unknown = -1, Fail = 0, Ok = 1 };
+using nsm::AllocSite;
+using nsm::Config;
+using nsm::LayoutConfig;
+using nsm::Monitor;
+using nsm::ProbeState;
+using nsm::ProbeView;
+using nsm::boottime_us;
 
-// ----- Shared application state for background workers and UI -----
-struct AppState {
-    std::atomic<ProbeState> network{ProbeState::Unknown};
-    std::atomic<ProbeState> serial{ProbeState::Unknown};
-    std::atomic<bool> running{true};
+// ----- Startup timeline (printed with --startup-report, see Monitor::startup) -----
+// The first paint happens in a widget's draw(); the UI timer hands it to the Monitor.
+static long long g_first_paint = 0;
+
+
+// ----- Self-metrics: what the monitor itself costs (Stats button) -----
+//
+// Rates over about a second, from counters that are cheap to keep: the engine's
+// (Monitor::counters), the UI's own below, and the process CPU clock. UI loop
+// lag is how late the 5 Hz timer fires; UI wakeups are event loop iterations,
+// counted by an Fl::add_check() callback.
+class SelfMetrics {
+public:
+    unsigned long long redraws = 0;         // grid and table draws
+    unsigned long long ui_wakeups = 0;
+
+    static long long monotonic_us() {
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    // Called on every UI tick with when it was due.
+    void tick(long long due_us, long long now_us) {
+        const long long lag = now_us - due_us;
+        if (lag > worst_lag_us_) worst_lag_us_ = lag;
+    }
+
+    // Once at least a second has passed: format the overlay (one metric per line)
+    // and a short summary for the status box, and return true.
+    bool sample(const Monitor* monitor, char* overlay, std::size_t overlay_len, char* line, std::size_t line_len) {
+        const long long now = monotonic_us();
+        if (prev_.at && now - prev_.at < 1000000) return false;
+        Totals cur;
+        cur.at = now;
+        cur.cpu_us = cpu_us(CLOCK_PROCESS_CPUTIME_ID);
+        rusage ru{};
+        getrusage(RUSAGE_CHILDREN, &ru);
+        cur.child_cpu_us = tv_us(ru.ru_utime) + tv_us(ru.ru_stime);
+        if (monitor) cur.engine = monitor->counters();
+        cur.redraws = redraws;
+        cur.ui_wakeups = ui_wakeups;
+        if (!prev_.at) {
+            prev_ = cur;
+            return false;
+        }
+
+        const double secs = (cur.at - prev_.at) / 1e6;
+        auto rate = [&](unsigned long long a, unsigned long long b) { return (a - b) / secs; };
+        const double cpu = (cur.cpu_us - prev_.cpu_us) / 1e4 / secs;
+        const double child_cpu = (cur.child_cpu_us - prev_.child_cpu_us) / 1e4 / secs;
+        const double lag_ms = worst_lag_us_ / 1000.0;
+        const double wakeups = rate(cur.ui_wakeups, prev_.ui_wakeups);
+        if (monitor) {
+            std::snprintf(overlay, overlay_len,
+                          "probes/s   %.1f (%.1f pushed)\nchildren   %.1f updates/s, %.0f B/s\n"
+                          "peers      %.1f results/s in, %.1f out\nspawns/s   %.1f\n"
+                          "cpu        %.1f%% (+%.1f%% scripts)\nui lag     %.0f ms\nredraws/s  %.1f\nwakeups/s  %.0f (ui %.0f)",
+                          rate(cur.engine.results, prev_.engine.results), rate(cur.engine.passive, prev_.engine.passive),
+                          rate(cur.engine.child_updates, prev_.engine.child_updates),
+                          rate(cur.engine.child_bytes, prev_.engine.child_bytes),
+                          rate(cur.engine.peer_results, prev_.engine.peer_results),
+                          rate(cur.engine.peer_sent, prev_.engine.peer_sent),
+                          rate(cur.engine.spawns, prev_.engine.spawns),
+                          cpu, child_cpu, lag_ms, rate(cur.redraws, prev_.redraws),
+                          wakeups + rate(cur.engine.wakeups, prev_.engine.wakeups), wakeups);
+        } else {
+            std::snprintf(overlay, overlay_len,
+                          "viewer: no probes here\ncpu        %.1f%%\nui lag     %.0f ms\nredraws/s  %.1f\nwakeups/s  %.0f",
+                          cpu, lag_ms, rate(cur.redraws, prev_.redraws), wakeups);
+        }
+        std::snprintf(line, line_len, "cpu %.1f%%, lag %.0f ms", cpu, lag_ms);
+        prev_ = cur;
+        worst_lag_us_ = 0;
+        return true;
+    }
+
+private:
+    struct Totals {
+        long long at = 0, cpu_us = 0, child_cpu_us = 0;
+        nsm::EngineCounters engine;
+        unsigned long long redraws = 0, ui_wakeups = 0;
+    };
+    Totals prev_;
+    long long worst_lag_us_ = 0;
+
+    static long long cpu_us(clockid_t clock) {
+        timespec ts{};
+        clock_gettime(clock, &ts);
+        return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+    static long long tv_us(const timeval& tv) { return static_cast<long long>(tv.tv_sec) * 1000000 + tv.tv_usec; }
 };
+static SelfMetrics g_self;
 
-// ----- Resolve script path -----
-static std::string resolve_path(const std::string& script) {
-    std::string path;
-    if (const char* p = std::getenv("PATH")) {
-        std::string sp(p);
-        std::stringstream ss(sp);
-        std::string dir;
-        while (std::getline(ss, dir, ':')) {
-            if (dir.empty()) continue;
-            std::string candidate = dir + "/" + script;
-            if (access(candidate.c_str(), X_OK) == 0) {
-                path = candidate;
-                return path;
-            }
+// ----- What the window shows: a copy of the monitor's state -----
+// Refreshed by the UI timer from Monitor::snapshot() in the primary, and from the
+// primary's snapshots in a viewer. Only touched on the UI thread.
+struct DisplayModel {
+    std::vector<ProbeView> probes;      // display order
+    LayoutConfig layout;
+    unsigned generation = 0;
+};
+
+// The values of each probe as last sent somewhere (a rendered image, a viewer
+// snapshot). The generation does not move on metric updates alone, so consumers
+// that must follow the metric compare against this too.
+class ShownValues {
+public:
+    // with_stats: p99, availability and last change count as well.
+    explicit ShownValues(bool with_stats) : with_stats_(with_stats) {}
+
+    // True, remembering m's values, if any differ from the last call (always on the
+    // first). Does not allocate unless the number of probes grew.
+    bool update(const DisplayModel& m) {
+        auto same = [](double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); };
+        bool changed = !valid_ || m.generation != generation_ || m.probes.size() != shown_.size();
+        shown_.resize(m.probes.size());
+        for (std::size_t i = 0; i < m.probes.size(); ++i) {
+            const ProbeView& p = m.probes[i];
+            Values& v = shown_[i];
+            if (v.state == p.state && v.stale == p.stale && same(v.metric, p.metric) &&
+                (!with_stats_ || (same(v.p99, p.p99) && same(v.availability, p.availability) &&
+                                  v.last_change == p.last_change)))
+                continue;
+            v = {p.state, p.stale, p.metric, p.p99, p.availability, p.last_change};
+            changed = true;
         }
+        valid_ = true;
+        generation_ = m.generation;
+        return changed;
     }
-    const char* fallbacks[] = { "/usr/local/bin", "/usr/bin", nullptr };
-    for (int i = 0; fallbacks[i]; ++i) {
-        std::string candidate = std::string(fallbacks[i]) + "/" + script;
-        if (access(candidate.c_str(), X_OK) == 0) {
-            path = candidate;
-            return path;
+
+private:
+    struct Values {
+        ProbeState state = ProbeState::Unknown;
+        bool stale = false;
+        double metric = NAN, p99 = NAN, availability = NAN;
+        long long last_change = 0;
+    };
+    std::vector<Values> shown_;
+    unsigned generation_ = 0;
+    bool valid_ = false;
+    bool with_stats_;
+};
+
+// ----- Window showing a probe's last failure output (opened by clicking its circle) -----
+class OutputWindow {
+public:
+    void show(const char* title, const std::string& text) {
+        if (!win_) {
+            win_ = new Fl_Window(560, 320);
+            buf_ = new Fl_Text_Buffer();
+            view_ = new Fl_Text_Display(5, 5, 550, 310);
+            view_->buffer(buf_);
+            view_->textfont(FL_COURIER);
+            view_->textsize(12);
+            win_->resizable(view_);
+            win_->end();
         }
+        win_->copy_label(title);
+        buf_->text(text.c_str());
+        win_->show();
     }
-    path.clear(); // not found
-    return path;
-}
 
-// ----- Small helper to run a shell command and return success/fail -----
-static inline ProbeState run_command_success(const char* cmd) {
-    // Run command via /bin/sh -c, suppressing output within the command string.
-    int rc = std::system(cmd);
-    // std::system returns -1 on error launching shell; otherwise wait status.
-    // We treat ==0 as success, everything else as failure.
-    return (rc == 0) ? ProbeState::Ok : ProbeState::Fail;
-}
+private:
+    Fl_Window* win_ = nullptr;          // created on first use, lives until exit
+    Fl_Text_Buffer* buf_ = nullptr;
+    Fl_Text_Display* view_ = nullptr;
+};
 
-// ----- Custom widget to draw the three status circles and captions -----
-class StatusPanel : public Fl_Widget {
+// ----- Grid of status circles, one per probe, with captions -----
+//
+// Scales from the three big circles of the default setup to hundreds of small
+// ones: cells wrap into rows and the grid scrolls vertically, probes with a
+// group get a heading per group. Only cells inside the visible rows are drawn,
+// and a tick that changes a few probes redraws just those cells (through
+// FL_DAMAGE_USER1), so drawing cost follows the visible changes, not the
+// number of probes.
+class IndicatorGrid : public Fl_Group {
 public:
-    StatusPanel(int X, int Y, int W, int H, AppState* s)
-        : Fl_Widget(X, Y, W, H), state_(s) {}
+    // monitor is null in a viewer, which has no run output to show.
+    IndicatorGrid(int X, int Y, int W, int H, const DisplayModel* m, const Monitor* monitor)
+        : Fl_Group(X, Y, W, H), model_(m), monitor_(monitor),
+          scrollbar_(X + W - kScrollbarW, Y, kScrollbarW, H) {
+        end();
+        scrollbar_.linesize(20);
+        scrollbar_.callback([](Fl_Widget* w, void* v) {
+            auto* self = static_cast<IndicatorGrid*>(v);
+            self->offset_ = static_cast<Fl_Scrollbar*>(w)->value();
+            self->redraw();
+        }, this);
+        relayout();
+    }
+
+    // Called after the model changed (UI timer). Lays out again when the set of
+    // probes changed; otherwise only the cells whose probe changed are marked.
+    void sync() {
+        if (structure_changed()) {
+            relayout();
+            redraw();
+            return;
+        }
+        bool visible_change = false;
+        for (Cell& c : cells_) {
+            if (c.probe < 0) continue;
+            const ProbeView& p = model_->probes[static_cast<std::size_t>(c.probe)];
+            if (p.state == c.state && p.stale == c.stale && same_metric(p.metric, c.metric)) continue;
+            c.state = p.state;
+            c.stale = p.stale;
+            c.metric = p.metric;
+            c.dirty = true;
+            visible_change = visible_change || is_visible(c);
+        }
+        if (visible_change) damage(FL_DAMAGE_USER1);
+    }
+
+    // Height that shows every row without scrolling, at the current width.
+    int content_height() const { return content_h_; }
+
+    // Text shown in a box over the top right corner (self-metrics); nullptr hides it.
+    // The grid draws it last, so partial cell redraws never paint over it.
+    void overlay(const char* text) {
+        if (!text && overlay_) redraw();        // uncover the cells beneath
+        overlay_ = text;
+        if (text) damage(FL_DAMAGE_USER1);
+        else overlay_w_ = overlay_h_ = 0;
+    }
+
+    void resize(int X, int Y, int W, int H) override {
+        Fl_Widget::resize(X, Y, W, H);
+        scrollbar_.resize(X + W - kScrollbarW, Y, kScrollbarW, H);
+        relayout();
+    }
+
+    int handle(int event) override {
+        if (event == FL_MOUSEWHEEL && scrollbar_.visible()) {
+            scroll_to(offset_ + Fl::event_dy() * row_h_ / 2);
+            return 1;
+        }
+        if (event != FL_PUSH || Fl::event_x() >= x() + view_w()) return Fl_Group::handle(event);
+        if (structure_changed()) relayout();
+
+        // Clicking a probe's circle shows the output of its last failed run.
+        const int cx = Fl::event_x() - x(), cy = Fl::event_y() - y() + offset_;
+        for (const Cell& c : cells_) {
+            if (c.probe < 0 || cx < c.x + (cell_w_ - d_) / 2 || cx > c.x + (cell_w_ + d_) / 2 ||
+                cy < c.y + kPad || cy > c.y + kPad + d_) continue;
+            const std::string& name = model_->probes[static_cast<std::size_t>(c.probe)].name;
+            std::string text;
+            if (!monitor_) text = "Run output is only available in the primary instance.\n";
+            else if (!monitor_->last_failure(name, text)) text = "No failed run captured for this probe.\n";
+            output_.show((name + ": last failure").c_str(), text);
+            return 1;
+        }
+        return 1;
+    }
 
 private:
-    AppState* state_;
+    static constexpr int kScrollbarW = 14;
+    static constexpr int kMargin = 10;
+    static constexpr int kPad = 6;              // above the circle in each cell
+    static constexpr int kMinCellW = 64;        // room for a short caption
+    static constexpr int kHeadingH = 20;
+
+    struct Cell {
+        int probe;                  // index into the model, -1 for a reserved slot
+        int x, y;                   // relative to the content's top left
+        ProbeState state = ProbeState::Unknown;     // as last synced
+        bool stale = false;
+        double metric = NAN;
+        bool dirty = false;         // changed since it was last drawn
+    };
+    struct Heading {
+        int y;
+        int probe;                  // first probe of the group, which names it
+    };
+
+    const DisplayModel* model_;
+    const Monitor* monitor_;
+    Fl_Scrollbar scrollbar_;
+    OutputWindow output_;
+    std::vector<Cell> cells_;       // in content order (y, then x)
+    std::vector<Heading> headings_;
+    std::vector<std::string> laid_out_;     // names then groups the layout was made for
+    LayoutConfig laid_out_layout_;
+    int d_ = 20, cell_w_ = kMinCellW, row_h_ = 60, content_h_ = 0, offset_ = 0;
+    const char* overlay_ = nullptr;
+    int overlay_w_ = 0, overlay_h_ = 0;     // only grows while shown, so a shorter text covers the last one
+
+    static bool same_metric(double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); }
+
+    int view_w() const { return scrollbar_.visible() ? w() - kScrollbarW : w(); }
+
+    bool is_visible(const Cell& c) const { return c.y + row_h_ > offset_ && c.y < offset_ + h(); }
+
+    bool structure_changed() const {
+        const auto& probes = model_->probes;
+        if (laid_out_.size() != probes.size() * 2 || laid_out_layout_.slots != model_->layout.slots ||
+            laid_out_layout_.max_diameter != model_->layout.max_diameter) return true;
+        for (std::size_t i = 0; i < probes.size(); ++i)
+            if (laid_out_[i] != probes[i].name || laid_out_[probes.size() + i] != probes[i].group) return true;
+        return false;
+    }
+
+    // Place every cell. Groups appear in the order of their first probe; probes
+    // without a group come first, under no heading.
+    void relayout() {
+        const auto& probes = model_->probes;
+        laid_out_.clear();
+        for (const auto& p : probes) laid_out_.push_back(p.name);
+        for (const auto& p : probes) laid_out_.push_back(p.group);
+        laid_out_layout_ = model_->layout;
+
+        // Lay out for the full width first; if that overflows, again beside the scrollbar.
+        arrange(w() - kMargin * 2);
+        const bool scroll = content_h_ > h();
+        if (scroll) arrange(w() - kScrollbarW - kMargin * 2);
+        if (scroll) scrollbar_.show(); else scrollbar_.hide();
+        scroll_to(offset_);
+    }
+
+    void arrange(int available) {
+        const auto& probes = model_->probes;
+        // Few probes keep the big circles; many shrink to rows of small ones.
+        const int n = std::max(static_cast<int>(probes.size()), model_->layout.slots);
+        d_ = std::min(std::max(available / std::max(n, 1) - 10, 24), model_->layout.max_diameter);
+        const int cols = std::max(1, std::min(n, available / std::max(d_ + 10, kMinCellW)));
+        cell_w_ = available / cols;
+        row_h_ = kPad + d_ + 8 + 2 * 14 + 2;
+
+        cells_.clear();
+        headings_.clear();
+        std::vector<int> groups{-1};        // first probe of each group; -1: no group
+        for (std::size_t i = 0; i < probes.size(); ++i) {
+            if (probes[i].group.empty()) continue;
+            if (std::none_of(groups.begin() + 1, groups.end(), [&](int g) { return probes[g].group == probes[i].group; }))
+                groups.push_back(static_cast<int>(i));
+        }
+        int y = 0, col = 0;
+        for (int g : groups) {
+            const std::string* group = g < 0 ? nullptr : &probes[static_cast<std::size_t>(g)].group;
+            if (group) {
+                if (col) { y += row_h_; col = 0; }
+                headings_.push_back({y, g});
+                y += kHeadingH;
+            }
+            for (std::size_t i = 0; i < probes.size(); ++i) {
+                if (group ? probes[i].group != *group : !probes[i].group.empty()) continue;
+                place(static_cast<int>(i), col, cols, y);
+            }
+        }
+        // Reserved slots (gray, no caption) after the probes
+        for (int i = static_cast<int>(probes.size()); i < n; ++i) place(-1, col, cols, y);
+        if (col) y += row_h_;
+        content_h_ = y;
+    }
+
+    void place(int probe, int& col, int cols, int& y) {
+        Cell c{probe, kMargin + col * cell_w_, y};
+        if (probe >= 0) {
+            const ProbeView& p = model_->probes[static_cast<std::size_t>(probe)];
+            c.state = p.state;
+            c.stale = p.stale;
+            c.metric = p.metric;
+        }
+        cells_.push_back(c);
+        if (++col == cols) {
+            col = 0;
+            y += row_h_;
+        }
+    }
+
+    void scroll_to(int offset) {
+        offset_ = std::max(0, std::min(offset, content_h_ - h()));
+        scrollbar_.value(offset_, h(), 0, std::max(content_h_, h()));
+        redraw();
+    }
 
     static Fl_Color color_for(ProbeState st) {
         switch (st) {
-            case ProbeState::Ok:     return FL_GREEN;
-            case ProbeState::Fail:   return FL_RED;
+            case ProbeState::Ok:       return FL_GREEN;
+            case ProbeState::Degraded: return FL_YELLOW;
+            case ProbeState::Fail:     return FL_RED;
             case ProbeState::Unknown:
-            default:                 return fl_rgb_color(128,128,128); // gray
+            default:                   return fl_rgb_color(128,128,128); // gray
         }
     }
 
@@ -118,175 +482,1014 @@ private:
         fl_draw(s, tx, ty);
     }
 
+    // Draw one cell over its own background, clipped to the cell so long
+    // captions do not spill into the neighbours.
+    void draw_cell(const Cell& c) {
+        const int X = x() + c.x, Y = y() + c.y - offset_;
+        fl_push_clip(X, Y, cell_w_, row_h_);
+        fl_rectf(X, Y, cell_w_, row_h_, color());
+        const int cx = X + (cell_w_ - d_) / 2, circleY = Y + kPad, captionY = circleY + d_ + 8;
+        if (c.probe < 0) {
+            draw_circle(cx, circleY, d_, fl_rgb_color(128,128,128));
+        } else {
+            Fl_Color fill = color_for(c.state);
+            // Last-known state from the previous run: washed out until refreshed
+            if (c.stale) fill = fl_color_average(fill, FL_WHITE, 0.45f);
+            draw_circle(cx, circleY, d_, fill);
+            draw_caption_centered(X, captionY, cell_w_, model_->probes[static_cast<std::size_t>(c.probe)].name.c_str());
+            if (!std::isnan(c.metric)) {
+                char value[32];
+                std::snprintf(value, sizeof(value), "%g", c.metric);
+                draw_caption_centered(X, captionY + 14, cell_w_, value);
+            }
+        }
+        fl_pop_clip();
+    }
+
+    void draw_overlay() {
+        fl_font(FL_COURIER, 11);
+        int tw = 0, th = 0;
+        fl_measure(overlay_, tw, th, false);
+        overlay_w_ = std::max(overlay_w_, tw + 12);
+        overlay_h_ = std::max(overlay_h_, th + 8);
+        const int X = x() + view_w() - overlay_w_ - 4, Y = y() + 4;
+        fl_rectf(X, Y, overlay_w_, overlay_h_, fl_rgb_color(255, 255, 224));
+        fl_rect(X, Y, overlay_w_, overlay_h_, FL_DARK3);
+        fl_color(FL_BLACK);
+        fl_draw(overlay_, X + 6, Y + 4, overlay_w_ - 12, overlay_h_ - 8, FL_ALIGN_LEFT | FL_ALIGN_TOP | FL_ALIGN_INSIDE);
+    }
+
     void draw() override {
-        // Layout:
-        // left/right margin and gaps so three ~100px circles fit in W.
-        const int margin = 10;
-        const int available = w() - margin*2;
-        // Try to keep diameter near 100, but fit within panel.
-        int d = available / 3 - 10;          // base diameter
-        if (d > 100) d = 100;
-        if (d < 60)  d = 60;                 // keep visible on small panels
-
-        const int gap = (available - 3*d) / 2;
-        const int top = y() + 10;
-        const int left = x() + margin;
-
-        // Vertical positions
-        const int circleY = top;
-        const int captionY = circleY + d + 8;
-
-        // Determine colors from state
-        Fl_Color c0 = color_for(state_->network.load());
-        Fl_Color c1 = color_for(state_->serial.load());
-        Fl_Color c2 = fl_rgb_color(128,128,128); // reserved = gray
-
-        // Draw three circles (network, serial, reserved)
-        int x0 = left;
-        int x1 = left + d + gap;
-        int x2 = left + 2*(d + gap);
-
-        draw_circle(x0, circleY, d, c0);
-        draw_circle(x1, circleY, d, c1);
-        draw_circle(x2, circleY, d, c2);
-
-        // Captions (only for network/serial as requested)
-        draw_caption_centered(x0, captionY, d, "network");
-        draw_caption_centered(x1, captionY, d, "serial");
-        // third intentionally left without caption (reserved)
+        if (!g_first_paint) g_first_paint = boottime_us();
+        ++g_self.redraws;
+        bool all = damage() & FL_DAMAGE_ALL;
+        // A viewer's model can be replaced between timer ticks; never draw a stale layout.
+        if (structure_changed()) {
+            relayout();
+            all = true;
+        }
+        fl_push_clip(x(), y(), view_w(), h());
+        if (all) {
+            fl_rectf(x(), y(), view_w(), h(), color());
+            fl_font(FL_HELVETICA_BOLD, 12);
+            fl_color(FL_BLACK);
+            for (const Heading& hd : headings_) {
+                const int Y = y() + hd.y - offset_;
+                if (Y + kHeadingH > y() && Y < y() + h())
+                    fl_draw(model_->probes[static_cast<std::size_t>(hd.probe)].group.c_str(), x() + kMargin, Y + kHeadingH - 5);
+            }
+        }
+        // Cells are in content order, so the visible ones are a contiguous run.
+        auto first = std::lower_bound(cells_.begin(), cells_.end(), offset_,
+                                      [&](const Cell& c, int top) { return c.y + row_h_ <= top; });
+        for (auto it = first; it != cells_.end() && it->y < offset_ + h(); ++it)
+            if (all || it->dirty) draw_cell(*it);
+        if (overlay_) draw_overlay();
+        fl_pop_clip();
+        for (Cell& c : cells_) c.dirty = false;
+        if (all) draw_child(scrollbar_);
+        else if (damage() & FL_DAMAGE_CHILD) update_child(scrollbar_);
     }
 };
 
-// ----- Compose the one-line status text from atomics -----
-static inline std::string make_status_line(const AppState& s) {
-    auto p = s.network.load();
-    auto q = s.serial.load();
+// ----- PNG snapshot of the grid, for wall displays that can only show images -----
+//
+// A second IndicatorGrid, never shown and always tall enough for every probe, is
+// drawn offscreen and encoded when the state generation changes (at most once a
+// second). The bytes are then only handed out: served by the web dashboard as
+// /status.png and/or written to a file, so any number of displays polling the
+// image cost no rendering or encoding at all.
+class StatusImage {
+public:
+    // web: publish there (may be null); path: also write the file ("" for none).
+    StatusImage(const DisplayModel* m, nsm::Dashboard* web, std::string path)
+        : model_(m), web_(web), path_(std::move(path)), grid_(0, 0, kWidth, kMinHeight, m, nullptr) {}
+
+    // From the UI timer, once the window is up (drawing needs the display). Renders
+    // when anything drawn changed, at most once per kMinIntervalUs.
+    void update(long long now_us) {
+        if (now_us < next_us_ || !shown_.update(*model_)) return;
+        ++rendered_;
+        next_us_ = now_us + kMinIntervalUs;
+        render();
+    }
+
+private:
+    static constexpr int kWidth = 800;
+    static constexpr int kMinHeight = 200;
+    static constexpr long long kMinIntervalUs = 1000000;
+
+    const DisplayModel* model_;
+    nsm::Dashboard* web_;
+    std::string path_;
+    IndicatorGrid grid_;
+    ShownValues shown_{false};      // the grid draws state, stale flag and metric
+    unsigned rendered_ = 0;         // images so far: the ETag
+    long long next_us_ = 0;
+    bool write_failed_ = false;     // reported once, not on every change
+
+    void render() {
+        // Lay out very tall first so no scrollbar takes width, then fit to the rows.
+        grid_.sync();
+        grid_.size(kWidth, 1 << 15);
+        grid_.size(kWidth, std::max(grid_.content_height(), kMinHeight));
+
+        Fl_RGB_Image* img;
+        {
+            Fl_Image_Surface surface(grid_.w(), grid_.h());
+            surface.set_current();
+            surface.draw(&grid_);
+            img = surface.image();
+            Fl_Display_Device::display_device()->set_current();
+        }
+        if (!img) return;
+        auto png = std::make_shared<std::string>();
+        const bool ok = nsm::encode_png(reinterpret_cast<const unsigned char*>(img->data()[0]), img->w(), img->h(),
+                                        img->d(), img->ld(), *png);
+        delete img;
+        if (!ok) return;
+
+        if (!path_.empty()) {
+            const bool written = nsm::write_file_atomic(path_, *png);
+            if (!written && !write_failed_)
+                std::fprintf(stderr, "png: cannot write %s: %s\n", path_.c_str(), std::strerror(errno));
+            write_failed_ = !written;
+        }
+        if (web_) web_->publish_image(std::move(png), rendered_);
+    }
+};
+
+// ----- Table of probes, worst first (opened with the Table button) -----
+//
+// One row per probe with its state, metric, p99, availability and last change.
+// Clicking a column header sorts by it (again: reverse). order_ is kept sorted
+// between ticks: when a tick changes a few probes, each changed row is moved
+// from its old place to its new one (binary search, then a rotate of the rows
+// in between), so re-sorting costs about the number of changed rows times the
+// distance they move, not a sort of the whole table. Fl_Table itself only
+// draws the visible cells.
+class ProbeTable : public Fl_Table {
+public:
+    enum Column { ColName, ColState, ColMetric, ColP99, ColAvailability, ColChange, kCols };
+
+    ProbeTable(int X, int Y, int W, int H, const DisplayModel* m) : Fl_Table(X, Y, W, H), model_(m) {
+        cols(kCols);
+        col_header(1);
+        col_header_height(22);
+        row_height_all(20);
+        col_resize(1);
+        static const int widths[kCols] = {150, 80, 70, 70, 80, 80};
+        for (int c = 0; c < kCols; ++c) col_width(c, widths[c]);
+        when(FL_WHEN_RELEASE);
+        callback([](Fl_Widget* w, void*) {
+            auto* t = static_cast<ProbeTable*>(w);
+            if (Fl::event() == FL_RELEASE && t->callback_context() == CONTEXT_COL_HEADER) t->sort_by(t->callback_col());
+        });
+        end();
+    }
+
+    // Called after the model changed (UI timer, while the table is shown).
+    void sync() {
+        const auto& probes = model_->probes;
+        bool rebuild = rows_.size() != probes.size();
+        for (std::size_t i = 0; !rebuild && i < probes.size(); ++i) rebuild = rows_[i].name != probes[i].name;
+        if (rebuild) {
+            rows_.resize(probes.size());
+            order_.resize(probes.size());
+            pos_.resize(probes.size());
+            for (std::size_t i = 0; i < probes.size(); ++i) {
+                rows_[i].name = probes[i].name;
+                load(rows_[i].v, probes[i]);
+                order_[i] = static_cast<int>(i);
+            }
+            resort();
+            rows(static_cast<int>(probes.size()));
+            return;
+        }
+
+        // Move changed rows one at a time: the others keep their old values, so
+        // they stay sorted among themselves and each move can binary-search.
+        int lo = INT_MAX, hi = -1, changed = 0;
+        for (std::size_t i = 0; i < probes.size(); ++i) {
+            Values next;
+            load(next, probes[i]);
+            if (same(next, rows_[i].v)) continue;
+            const int from = pos_[i];
+            rows_[i].v = next;
+            const int to = reposition(static_cast<int>(i));
+            lo = std::min({lo, from, to});
+            hi = std::max({hi, from, to});
+            ++changed;
+        }
+        if (changed) redraw_range(lo, hi, 0, kCols - 1);
+    }
+
+protected:
+    void draw_cell(TableContext context, int R, int C, int X, int Y, int W, int H) override {
+        static const char* const headers[kCols] = {"Probe", "State", "Metric", "p99", "Available", "Changed"};
+        switch (context) {
+            case CONTEXT_STARTPAGE:
+                ++g_self.redraws;
+                fl_font(FL_HELVETICA, 12);
+                return;
+            case CONTEXT_COL_HEADER: {
+                char label[32];
+                std::snprintf(label, sizeof(label), "%s%s", headers[C],
+                              C == sort_col_ ? (descending_ ? " \xe2\x96\xb2" : " \xe2\x96\xbc") : "");
+                fl_push_clip(X, Y, W, H);
+                fl_draw_box(FL_THIN_UP_BOX, X, Y, W, H, col_header_color());
+                fl_color(FL_BLACK);
+                fl_draw(label, X + 4, Y, W - 8, H, FL_ALIGN_LEFT);
+                fl_pop_clip();
+                return;
+            }
+            case CONTEXT_CELL: {
+                if (R < 0 || R >= static_cast<int>(order_.size())) return;
+                const Row& row = rows_[static_cast<std::size_t>(order_[static_cast<std::size_t>(R)])];
+                const Values& r = row.v;
+                char text[64] = "-";
+                Fl_Color bg = FL_WHITE;
+                switch (C) {
+                    case ColName:   std::snprintf(text, sizeof(text), "%s", row.name.c_str()); break;
+                    case ColState:
+                        std::snprintf(text, sizeof(text), "%s%s", nsm::state_name(r.state), r.stale ? "?" : "");
+                        bg = fl_color_average(state_color(r.state), FL_WHITE, 0.35f);
+                        break;
+                    case ColMetric: if (!std::isnan(r.metric)) std::snprintf(text, sizeof(text), "%g", r.metric); break;
+                    case ColP99:    if (!std::isnan(r.p99)) std::snprintf(text, sizeof(text), "%g", r.p99); break;
+                    case ColAvailability:
+                        if (!std::isnan(r.availability)) std::snprintf(text, sizeof(text), "%.1f%%", r.availability * 100);
+                        break;
+                    case ColChange:
+                        if (r.last_change) {
+                            const std::time_t t = static_cast<std::time_t>(r.last_change);
+                            std::tm tm{};
+                            localtime_r(&t, &tm);
+                            std::strftime(text, sizeof(text), "%H:%M:%S", &tm);
+                        }
+                        break;
+                    default: break;
+                }
+                fl_push_clip(X, Y, W, H);
+                fl_color(bg);
+                fl_rectf(X, Y, W, H);
+                fl_color(FL_BLACK);
+                fl_draw(text, X + 4, Y, W - 8, H, C == ColName || C == ColState ? FL_ALIGN_LEFT : FL_ALIGN_RIGHT);
+                fl_color(FL_LIGHT2);
+                fl_rect(X, Y, W, H);
+                fl_pop_clip();
+                return;
+            }
+            default:
+                return;
+        }
+    }
+
+private:
+    // Copy of a probe's displayed values
+    struct Values {
+        ProbeState state = ProbeState::Unknown;
+        bool stale = false;
+        double metric = NAN, p99 = NAN, availability = NAN;
+        long long last_change = 0;
+    };
+    struct Row {
+        std::string name;
+        Values v;
+    };
+
+    const DisplayModel* model_;
+    std::vector<Row> rows_;         // by probe index
+    std::vector<int> order_;        // display row -> probe index
+    std::vector<int> pos_;          // probe index -> display row
+    int sort_col_ = ColState;       // ColState ascending is "worst first"
+    bool descending_ = false;
+
+    static void load(Values& r, const ProbeView& p) {
+        r.state = p.state;
+        r.stale = p.stale;
+        r.metric = p.metric;
+        r.p99 = p.p99;
+        r.availability = p.availability;
+        r.last_change = p.last_change;
+    }
+
+    static bool same_num(double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); }
 
-    auto to_str = [](ProbeState st) -> const char* {
+    static bool same(const Values& a, const Values& b) {
+        return a.state == b.state && a.stale == b.stale && same_num(a.metric, b.metric) && same_num(a.p99, b.p99) &&
+               same_num(a.availability, b.availability) && a.last_change == b.last_change;
+    }
+
+    static Fl_Color state_color(ProbeState st) {
         switch (st) {
-            case ProbeState::Ok:     return "OK";
-            case ProbeState::Fail:   return "down";
+            case ProbeState::Ok:       return FL_GREEN;
+            case ProbeState::Degraded: return FL_YELLOW;
+            case ProbeState::Fail:     return FL_RED;
             case ProbeState::Unknown:
-            default:                 return "unknown";
+            default:                   return fl_rgb_color(128,128,128);
         }
-    };
+    }
 
-    char buf[128];
-    std::snprintf(buf, sizeof(buf), "network=%s, serial=%s", to_str(p), to_str(q));
-    return std::string(buf);
-}
+    // Worst first: failing, degraded, unknown, ok.
+    static int severity(ProbeState st) {
+        switch (st) {
+            case ProbeState::Fail:     return 0;
+            case ProbeState::Degraded: return 1;
+            case ProbeState::Unknown:  return 2;
+            case ProbeState::Ok:
+            default:                   return 3;
+        }
+    }
 
-// ----- Background worker loops -----
-static void network_worker(AppState* s) {
-    const std::string& script = resolve_path("test_network.sh");
-    if (script.empty()) {
-        s->serial.store(ProbeState::Unknown);
-        return;
+    // -1/0/1; NAN sorts after every number whatever the direction.
+    static int compare_num(double a, double b, bool descending) {
+        if (std::isnan(a) || std::isnan(b)) return std::isnan(a) - std::isnan(b);
+        if (a == b) return 0;
+        return ((a < b) != descending) ? -1 : 1;
     }
 
-    // Redirect output to /dev/null to stay quiet.
-    std::string cmd = "'" + script + "' >/dev/null 2>&1";
-    using namespace std::chrono_literals;
-    while (s->running.load()) {
-        s->network.store(run_command_success(cmd.c_str()));
-        // Sleep in small steps to react quickly to stop
-        for (int i = 0; i < 40 && s->running.load(); ++i) std::this_thread::sleep_for(50ms);
+    // Strict order of probes a and b for the current column; ties by name, then index.
+    bool before(int a, int b) const {
+        const Values& x = rows_[static_cast<std::size_t>(a)].v;
+        const Values& y = rows_[static_cast<std::size_t>(b)].v;
+        int c = 0;
+        switch (sort_col_) {
+            case ColState:
+                c = compare_num(severity(x.state), severity(y.state), descending_);
+                if (!c) c = compare_num(x.availability, y.availability, descending_);
+                break;
+            case ColMetric:       c = compare_num(x.metric, y.metric, descending_); break;
+            case ColP99:          c = compare_num(x.p99, y.p99, descending_); break;
+            case ColAvailability: c = compare_num(x.availability, y.availability, descending_); break;
+            case ColChange:       c = compare_num(static_cast<double>(x.last_change), static_cast<double>(y.last_change), !descending_); break;
+            default: break;
+        }
+        if (c) return c < 0;
+        if (const int n = rows_[static_cast<std::size_t>(a)].name.compare(rows_[static_cast<std::size_t>(b)].name)) return (n < 0) != (sort_col_ == ColName && descending_);
+        return a < b;
     }
-}
 
-static void serial_worker(AppState* s) {
-    // Resolve script only once. If missing, set Unknown and exit the worker.
-    const std::string& script = resolve_path("test_serial.sh");
-    if (script.empty()) {
-        s->serial.store(ProbeState::Unknown);
-        return;
+    void resort() {
+        std::sort(order_.begin(), order_.end(), [this](int a, int b) { return before(a, b); });
+        for (std::size_t r = 0; r < order_.size(); ++r) pos_[static_cast<std::size_t>(order_[r])] = static_cast<int>(r);
     }
 
-    // Redirect output to /dev/null to stay quiet.
-    std::string cmd = "'" + script + "' >/dev/null 2>&1";
-    using namespace std::chrono_literals;
-    while (s->running.load()) {
-        s->serial.store(run_command_success(cmd.c_str()));
-        for (int i = 0; i < 40 && s->running.load(); ++i) std::this_thread::sleep_for(50ms);
+    // Move probe i (whose row values just changed) to its sorted place; returns the new row.
+    int reposition(int i) {
+        const int from = pos_[static_cast<std::size_t>(i)];
+        auto at = order_.begin() + from;
+        int to = from;
+        if (from > 0 && before(i, *(at - 1))) {
+            to = static_cast<int>(std::upper_bound(order_.begin(), at, i, [this](int v, int e) { return before(v, e); }) -
+                                  order_.begin());
+            std::rotate(order_.begin() + to, at, at + 1);
+        } else if (at + 1 != order_.end() && before(*(at + 1), i)) {
+            to = static_cast<int>(std::lower_bound(at + 1, order_.end(), i, [this](int e, int v) { return before(e, v); }) -
+                                  order_.begin()) - 1;
+            std::rotate(at, at + 1, order_.begin() + to + 1);
+        }
+        for (int r = std::min(from, to); r <= std::max(from, to); ++r) pos_[static_cast<std::size_t>(order_[r])] = r;
+        return to;
+    }
+
+    void sort_by(int col) {
+        if (col < 0 || col >= kCols) return;
+        descending_ = (col == sort_col_) ? !descending_ : false;
+        sort_col_ = col;
+        resort();
+        redraw();
+    }
+};
+
+// Window holding the table; created on first use, lives until exit.
+class TableWindow {
+public:
+    explicit TableWindow(const DisplayModel* m) : model_(m) {}
+
+    void toggle() {
+        if (!win_) {
+            win_ = new Fl_Double_Window(560, 400, "Probes");
+            table_ = new ProbeTable(0, 0, 560, 400, model_);
+            win_->resizable(table_);
+            win_->end();
+        }
+        if (win_->shown()) {
+            win_->hide();
+            return;
+        }
+        table_->sync();
+        win_->show();
+    }
+
+    void sync() {
+        if (win_ && win_->shown()) table_->sync();
+    }
+
+private:
+    const DisplayModel* model_;
+    Fl_Double_Window* win_ = nullptr;
+    ProbeTable* table_ = nullptr;
+};
+
+// ----- Single instance: one probe engine per user session -----
+//
+// The first instance binds an abstract Unix socket (no file to clean up; it vanishes
+// with the process). A later launch connects to it and either asks it to raise its
+// window and exits, or with --viewer subscribes as a read-only viewer: the primary
+// pushes a state snapshot whenever the state generation changes, and the viewer
+// only draws it. Probe load therefore stays the same however many windows are open.
+// --instance NAME picks another socket, so differently named instances run side
+// by side (several children and a parent on one machine, say).
+//
+// Snapshot (text, one per change):
+//   layout <slots> <max_diameter>
+//   group <name>                        (applies to the probe lines after it)
+//   probe <state -1|0|1|2> <stale 0|1> <name>   (unknown, fail, ok, degraded)
+//   stats <metric> <p99> <availability> <last_change>   (of the probe before; nan if none)
+//   end
+class SingleInstance {
+public:
+    explicit SingleInstance(std::string name) : name_(std::move(name)) {}
+    SingleInstance(const SingleInstance&) = delete;
+    SingleInstance& operator=(const SingleInstance&) = delete;
+    ~SingleInstance() {
+        for (int fd : viewers_) close(fd);
+        for (int fd : pending_) close(fd);
+        if (listen_fd_ >= 0) close(listen_fd_);
+        if (conn_fd_ >= 0) close(conn_fd_);
+    }
+
+    // Try to become the primary. False means another instance owns the socket.
+    bool listen() {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) return true;    // no coordination possible; run standalone
+        sockaddr_un addr{};
+        const socklen_t alen = address(addr);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), alen) != 0 || ::listen(fd, 8) != 0) {
+            close(fd);
+            return errno != EADDRINUSE;
+        }
+        listen_fd_ = fd;
+        return true;
+    }
+
+    // Connect to the primary and send one command line ("raise" or "watch").
+    bool connect_primary(const char* command) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        sockaddr_un addr{};
+        const socklen_t alen = address(addr);
+        char line[16];
+        const int n = std::snprintf(line, sizeof(line), "%s\n", command);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), alen) != 0 ||
+            send(fd, line, static_cast<std::size_t>(n), MSG_NOSIGNAL) != n) {
+            close(fd);
+            return false;
+        }
+        conn_fd_ = fd;
+        return true;
+    }
+
+    // Primary side: accept commands on the UI thread's event loop.
+    void serve(DisplayModel& m) {
+        if (listen_fd_ < 0) return;
+        m_ = &m;
+        Fl::add_fd(listen_fd_, FL_READ, [](int fd, void* v) {
+            auto* self = static_cast<SingleInstance*>(v);
+            int c;
+            while ((c = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) self->on_client(c);
+        }, this);
+    }
+
+    // Primary side, called from the UI timer: push a snapshot if anything a viewer
+    // shows (state, metric, p99, availability, last change) moved.
+    void publish(const DisplayModel& m) {
+        if (viewers_.empty() || !sent_.update(m)) return;
+        send_snapshot(m);
+    }
+
+    // Viewer side: mirror the primary's snapshots into m.
+    void watch(DisplayModel& m) {
+        m_ = &m;
+        fcntl(conn_fd_, F_SETFL, fcntl(conn_fd_, F_GETFL) | O_NONBLOCK);
+        Fl::add_fd(conn_fd_, FL_READ, [](int, void* v) { static_cast<SingleInstance*>(v)->on_snapshot_data(); }, this);
+    }
+
+private:
+    std::string name_;                  // --instance; empty: the default instance
+    int listen_fd_ = -1;
+    int conn_fd_ = -1;                  // viewer: connection to the primary
+    std::vector<int> viewers_;          // primary: subscribed viewers
+    std::vector<int> pending_;          // primary: accepted, command not read yet
+    ShownValues sent_{true};            // what the viewers were last sent
+    DisplayModel* m_ = nullptr;
+    std::string snapshot_;              // reused; grows with the number of probes
+    std::string inbuf_;                 // viewer: partial snapshot text
+
+    socklen_t address(sockaddr_un& addr) const {
+        addr.sun_family = AF_UNIX;
+        // Abstract namespace: leading NUL, per user so sessions do not collide.
+        int n = std::snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "net-serial-monitor.%u%s%s",
+                              static_cast<unsigned>(getuid()), name_.empty() ? "" : ".", name_.c_str());
+        n = std::min(n, static_cast<int>(sizeof(addr.sun_path)) - 2);
+        return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + n);
     }
-}
 
-// ----- Periodic UI timer: refresh status line and the panel -----
+    static constexpr std::size_t kMaxPending = 8;
+
+    // Commands are a single short line sent right after connect; it is read once
+    // the connection becomes readable, so a silent client never stalls the UI.
+    void on_client(int fd) {
+        if (pending_.size() >= kMaxPending) {   // the oldest has had its chance
+            Fl::remove_fd(pending_.front());
+            close(pending_.front());
+            pending_.erase(pending_.begin());
+        }
+        pending_.push_back(fd);
+        Fl::add_fd(fd, FL_READ, [](int c, void* v) { static_cast<SingleInstance*>(v)->on_command(c); }, this);
+    }
+
+    void on_command(int fd) {
+        char cmd[16] = {};
+        const ssize_t n = recv(fd, cmd, sizeof(cmd) - 1, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+        Fl::remove_fd(fd);
+        pending_.erase(std::find(pending_.begin(), pending_.end(), fd));
+        if (n > 0 && std::strncmp(cmd, "watch", 5) == 0) {
+            // Bring everyone up to date at once so the bookkeeping of what was sent stays shared.
+            viewers_.push_back(fd);
+            sent_.update(*m_);
+            send_snapshot(*m_);
+            return;
+        }
+        if (n > 0 && std::strncmp(cmd, "raise", 5) == 0 && Fl::first_window()) Fl::first_window()->show();
+        close(fd);
+    }
+
+    // Send to every viewer. Viewers that cannot keep up (socket buffer full) or went
+    // away are dropped rather than blocking the UI.
+    void send_snapshot(const DisplayModel& m) {
+        snapshot_.clear();
+        auto add = [&](const char* fmt, auto... args) {
+            char line[512];
+            const int n = std::snprintf(line, sizeof(line), fmt, args...);
+            if (n > 0) snapshot_.append(line, std::min(static_cast<std::size_t>(n), sizeof(line) - 1));
+        };
+        add("layout %d %d\n", m.layout.slots, m.layout.max_diameter);
+        const std::string* group = nullptr;
+        for (const auto& p : m.probes) {
+            if (group ? *group != p.group : !p.group.empty()) add("group %s\n", p.group.c_str());
+            group = &p.group;
+            add("probe %d %d %s\n", static_cast<int>(p.state), p.stale ? 1 : 0, p.name.c_str());
+            add("stats %g %g %g %lld\n", p.metric, p.p99, p.availability, p.last_change);
+        }
+        add("end\n");
+        const std::size_t used = snapshot_.size();
+
+        for (std::size_t i = 0; i < viewers_.size(); ) {
+            const int v = viewers_[i];
+            if (send(v, snapshot_.data(), used, MSG_NOSIGNAL | MSG_DONTWAIT) == static_cast<ssize_t>(used)) { ++i; continue; }
+            close(v);
+            viewers_.erase(viewers_.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+    }
+
+    void on_snapshot_data() {
+        char buf[4096];
+        ssize_t n;
+        while ((n = recv(conn_fd_, buf, sizeof(buf), 0)) > 0) inbuf_.append(buf, static_cast<std::size_t>(n));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            // Primary exited: keep the last picture, but mark everything stale.
+            Fl::remove_fd(conn_fd_);
+            close(conn_fd_);
+            conn_fd_ = -1;
+            for (auto& p : m_->probes) p.stale = true;
+            ++m_->generation;
+            return;
+        }
+        for (std::size_t end; (end = inbuf_.find("end\n")) != std::string::npos; ) {
+            apply_snapshot(inbuf_.substr(0, end));
+            inbuf_.erase(0, end + 4);
+        }
+    }
+
+    void apply_snapshot(const std::string& text) {
+        std::stringstream ss(text);
+        std::string line;
+        std::vector<ProbeView> next;
+        std::string group;
+        int slots = 0, max_d = 100;
+        while (std::getline(ss, line)) {
+            int st = -1, stale = 0, pos = 0;
+            if (std::sscanf(line.c_str(), "layout %d %d", &slots, &max_d) == 2) continue;
+            if (line.compare(0, 6, "group ") == 0) {
+                group = line.substr(6);
+                continue;
+            }
+            if (!next.empty() && std::sscanf(line.c_str(), "stats %lf %lf %lf %lld", &next.back().metric,
+                                             &next.back().p99, &next.back().availability, &next.back().last_change) == 4)
+                continue;
+            if (std::sscanf(line.c_str(), "probe %d %d %n", &st, &stale, &pos) < 2 || pos == 0) continue;
+            ProbeView p;
+            p.name = line.substr(static_cast<std::size_t>(pos));
+            p.group = group;
+            p.state = static_cast<ProbeState>(st);
+            p.stale = stale != 0;
+            next.push_back(std::move(p));
+        }
+        m_->probes.swap(next);
+        m_->layout.slots = slots;
+        m_->layout.max_diameter = max_d;
+        ++m_->generation;
+    }
+};
+
+// ----- Periodic UI timer: refresh status line and the grid -----
 struct UiRefs {
-    AppState* state{};
+    DisplayModel* model{};
+    Monitor* monitor{};             // primary only; a viewer's model is fed by the instance socket
     Fl_Box*   status_box{};
-    StatusPanel* panel{};
+    IndicatorGrid* grid{};
+    TableWindow* table{};
+    char status_text[512]{};    // label storage owned here, reused every tick
+    AllocSite allocs{"ui"};
+    bool startup_report = false;    // print once every probe has a first result
+    SingleInstance* instance{};     // primary: forwards state changes to viewers
+    bool show_stats = false;        // self-metrics overlay and status summary
+    char stats_text[512]{};         // overlay text, owned here like status_text
+    char stats_line[64]{};
+    long long next_tick_us = 0;     // when the timer is due next, for the lag
+    StatusImage* image{};           // null unless --png or --http asks for it
 };
 
+// True once every current probe has published at least one result.
+static bool all_probes_reported(const DisplayModel& m) {
+    for (const auto& p : m.probes)
+        if (!p.first_result) return false;
+    return true;
+}
+
 static void ui_timer_cb(void* userdata) {
     UiRefs* ui = static_cast<UiRefs*>(userdata);
-    if (ui && ui->status_box && ui->panel) {
-        std::string line = make_status_line(*ui->state);
-        ui->status_box->copy_label(line.c_str());
-        ui->panel->redraw();
+    if (ui && ui->status_box && ui->grid) {
+        const long long now = SelfMetrics::monotonic_us();
+        if (ui->next_tick_us) g_self.tick(ui->next_tick_us, now);
+        // FLTK keeps repeat_timeout() on its grid; after a long stall start over.
+        ui->next_tick_us = (ui->next_tick_us && now - ui->next_tick_us < 1000000 ? ui->next_tick_us : now) + 200000;
+        if (ui->monitor) ui->model->generation = ui->monitor->snapshot(ui->model->probes, &ui->model->layout);
+        nsm::alloc_cycle_begin(ui->allocs);
+        char line[sizeof(ui->status_text)];
+        nsm::format_status_line(ui->model->probes, line, sizeof(line));
+        if (g_self.sample(ui->monitor, ui->stats_text, sizeof(ui->stats_text), ui->stats_line, sizeof(ui->stats_line)) &&
+            ui->show_stats)
+            ui->grid->overlay(ui->stats_text);
+        if (ui->show_stats && ui->stats_line[0]) {
+            const std::size_t used = std::strlen(line);
+            std::snprintf(line + used, sizeof(line) - used, "%s%s", used ? " | " : "", ui->stats_line);
+        }
+        if (std::strcmp(line, ui->status_text) != 0) {
+            std::memcpy(ui->status_text, line, sizeof(line));
+            ui->status_box->label(ui->status_text);
+            ui->status_box->redraw();
+        }
+        ui->grid->sync();
+        ui->table->sync();
+        nsm::alloc_cycle_end(ui->allocs);
+        if (ui->instance) ui->instance->publish(*ui->model);
+        if (ui->image) ui->image->update(now);
+
+        if (ui->monitor && g_first_paint) ui->monitor->mark_startup(nsm::StartupStep::FirstPaint, g_first_paint);
+        if (ui->startup_report && all_probes_reported(*ui->model)) {
+            char report[1024];
+            nsm::format_startup_report(ui->monitor->startup(), ui->model->probes, report, sizeof(report));
+            std::fprintf(stderr, "startup: %s\n", report);
+            ui->startup_report = false;
+        }
     }
     // Re-arm timer (5 Hz)
     Fl::repeat_timeout(0.2, ui_timer_cb, userdata);
 }
 
+// ----- Command line (FLTK's own options such as -display are handled by Fl::args) -----
+struct Options {
+    std::string config_path;
+    std::string state_path;
+    std::string plugin_dir = nsm::default_plugin_dir();
+    bool startup_report = false;
+    bool viewer = false;            // attach to a running instance instead of raising it
+    bool headless = false;          // no window: a service, notifying its manager (service_notify.h)
+    std::string instance;           // --instance NAME: run beside the default instance
+    bool http = false;              // serve the web dashboard (primary only)
+    nsm::Dashboard::Options http_opts;
+    bool feed = false;              // serve parent monitors (primary only)
+    nsm::FeedServer::Options feed_opts;
+    std::string png_path;           // keep a PNG of the grid here, updated on changes
+    std::vector<nsm::UdpExporter::Options> exporters;  // StatsD / Influx push (primary only)
+    std::string passive_socket;     // where passive probes' results are pushed (see Monitor::Options)
+    std::string passive_udp_host = "127.0.0.1";
+    int passive_udp_port = 0;
+    std::string history_dir;        // compressed result history (see Monitor::Options)
+    int export_interval_ms = 10000;
+};
+static Options g_opts;
+
+// "[HOST:]PORT"; an IPv6 address goes in brackets ("[::]:8080"). host is left
+// alone when the argument has none.
+static bool parse_host_port(const char* s, std::string& host, int& port) {
+    const char* colon = std::strrchr(s, ':');
+    if (colon && !(s[0] == '[' && colon > s && colon[-1] != ']')) {
+        host.assign(s, static_cast<std::size_t>(colon - s));
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+        s = colon + 1;
+    }
+    char* end = nullptr;
+    const long n = std::strtol(s, &end, 10);
+    if (end == s || *end || n < 1 || n > 65535) return false;
+    port = static_cast<int>(n);
+    return true;
+}
+
+static int parse_option(int argc, char** argv, int& i) {
+    if (std::strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+        g_opts.config_path = argv[i + 1];
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--startup-report") == 0) {
+        g_opts.startup_report = true;
+        i += 1;
+        return 1;
+    }
+    if (std::strcmp(argv[i], "--viewer") == 0) {
+        g_opts.viewer = true;
+        i += 1;
+        return 1;
+    }
+    if (std::strcmp(argv[i], "--headless") == 0) {
+        g_opts.headless = true;
+        i += 1;
+        return 1;
+    }
+    if (std::strcmp(argv[i], "--instance") == 0 && i + 1 < argc) {
+        g_opts.instance = argv[i + 1];
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+        g_opts.history_dir = argv[i + 1];
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+        g_opts.state_path = argv[i + 1];
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--http") == 0 && i + 1 < argc) {
+        if (!parse_host_port(argv[i + 1], g_opts.http_opts.address, g_opts.http_opts.port)) return 0;
+        g_opts.http = true;
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--feed") == 0 && i + 1 < argc) {
+        if (!parse_host_port(argv[i + 1], g_opts.feed_opts.address, g_opts.feed_opts.port)) return 0;
+        g_opts.feed = true;
+        i += 2;
+        return 2;
+    }
+    if ((std::strcmp(argv[i], "--statsd") == 0 || std::strcmp(argv[i], "--influx") == 0) && i + 1 < argc) {
+        nsm::UdpExporter::Options o;
+        o.format = argv[i][2] == 's' ? nsm::UdpExporter::Format::StatsD : nsm::UdpExporter::Format::Influx;
+        o.port = o.format == nsm::UdpExporter::Format::StatsD ? 8125 : 8089;
+        if (!parse_host_port(argv[i + 1], o.host, o.port)) return 0;
+        g_opts.exporters.push_back(std::move(o));
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--passive") == 0 && i + 1 < argc) {
+        g_opts.passive_socket = argv[i + 1];
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--passive-udp") == 0 && i + 1 < argc) {
+        if (!parse_host_port(argv[i + 1], g_opts.passive_udp_host, g_opts.passive_udp_port)) return 0;
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--export-interval") == 0 && i + 1 < argc) {
+        g_opts.export_interval_ms = std::atoi(argv[i + 1]);
+        if (g_opts.export_interval_ms < 100) return 0;
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--png") == 0 && i + 1 < argc) {
+        g_opts.png_path = argv[i + 1];
+        i += 2;
+        return 2;
+    }
+    if (std::strcmp(argv[i], "--plugins") == 0 && i + 1 < argc) {
+        g_opts.plugin_dir = argv[i + 1];
+        i += 2;
+        return 2;
+    }
+    return 0;
+}
+
 // ----- main -----
 int main(int argc, char** argv) {
-    AppState state;
+    const long long main_entry = boottime_us();
+    int argi = 1;
+    if (!Fl::args(argc, argv, argi, parse_option)) {
+        std::fprintf(stderr, "usage: %s [--config FILE] [--state FILE] [--history DIR] [--plugins DIR] [--png FILE]\n"
+                     "       [--http [ADDR:]PORT] [--statsd [HOST:]PORT] [--influx [HOST:]PORT] [--export-interval MS]\n"
+                     "       [--passive SOCKET] [--passive-udp [HOST:]PORT] [--feed [ADDR:]PORT]\n"
+                     "       [--instance NAME] [--startup-report] [--viewer | --headless] [FLTK options]\n", argv[0]);
+        return 2;
+    }
+    if (g_opts.config_path.empty()) g_opts.config_path = nsm::default_config_path();
+    if (g_opts.state_path.empty()) {
+        g_opts.state_path = nsm::default_state_path();
+        // Named instances keep their own state: net-serial-monitor.NAME.state
+        const std::size_t dot = g_opts.state_path.rfind(".state");
+        if (!g_opts.instance.empty() && dot != std::string::npos)
+            g_opts.state_path.insert(dot, "." + g_opts.instance);
+    }
 
-    // Window & basic layout
-    const int W = 320, H = 200;
-    Fl_Window win(W, H, "Net & Serial Monitor");
+    // Headless, the process runs until SIGTERM or SIGINT. Blocked before any thread
+    // starts, so that every thread inherits the mask and sigwait() below gets them.
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGTERM);
+    sigaddset(&stop_signals, SIGINT);
+    if (g_opts.headless) pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
 
-    // Panel area (top)
-    StatusPanel panel(10, 10, W - 20, 160, &state);
+    // One probe engine per session: defer to a running instance if there is one.
+    // A headless service is its own engine and takes no part in this.
+    SingleInstance instance(g_opts.instance);
+    bool primary = g_opts.headless || instance.listen();
+    if (!primary && !instance.connect_primary(g_opts.viewer ? "watch" : "raise")) {
+        primary = instance.listen();    // the other instance just went away; take over
+        if (!primary) {
+            std::fprintf(stderr, "instance: another instance holds the socket but does not answer\n");
+            return 1;
+        }
+    }
+    if (!primary && !g_opts.viewer) return 0;   // it raised its window
+
+    // Plugins first: the config may use the probe types they provide.
+    if (primary) nsm::load_plugins(g_opts.plugin_dir);
+
+    // Load probes (built-in defaults if the file is absent or invalid)
+    Config cfg = nsm::default_config();
+    bool missing = false;
+    if (primary && !nsm::load_config(g_opts.config_path, cfg, &missing) && missing)
+        std::fprintf(stderr, "config: %s not found, using built-in probes\n", g_opts.config_path.c_str());
+
+    // Start probing before any FLTK work so the first real results arrive as early as
+    // possible; until then the last known state is shown (washed out).
+    Monitor::Options engine;
+    engine.state_path = g_opts.state_path;
+    engine.passive_socket = g_opts.passive_socket;
+    engine.passive_udp_host = g_opts.passive_udp_host;
+    engine.passive_udp_port = g_opts.passive_udp_port;
+    engine.history_dir = g_opts.history_dir;
+    Monitor monitor(engine);
+    monitor.mark_startup(nsm::StartupStep::MainEntry, main_entry);
+    DisplayModel model;
+    if (primary) {
+        if (!monitor.start() || !monitor.apply(cfg)) return 1;
+        model.generation = monitor.snapshot(model.probes, &model.layout);
+    }
+    nsm::Dashboard dashboard(monitor, g_opts.http_opts);
+    if (primary && g_opts.http) dashboard.start();     // on failure the window still comes up
+    nsm::FeedServer feed(monitor, g_opts.feed_opts);
+    if (primary && g_opts.feed) feed.start();
+    std::vector<std::unique_ptr<nsm::UdpExporter>> exporters;
+    if (primary) {
+        for (auto o : g_opts.exporters) {
+            o.interval_ms = g_opts.export_interval_ms;
+            exporters.push_back(std::make_unique<nsm::UdpExporter>(monitor, std::move(o)));
+            exporters.back()->start();
+        }
+    }
+
+    // Re-apply the config file whenever it is saved
+    nsm::ConfigWatcher config_watcher(g_opts.config_path, [&] {
+        Config next = cfg;
+        if (nsm::load_config(g_opts.config_path, next) && monitor.apply(next)) cfg = std::move(next);
+    });
+    auto shut_down = [&] {
+        config_watcher.stop();
+        dashboard.stop();
+        if (g_opts.feed && primary) {
+            feed.stop();
+            const nsm::FeedServer::Counters c = feed.counters();
+            std::fprintf(stderr, "feed: %llu snapshot(s), %llu delta(s) with %llu change(s), %llu bytes\n",
+                         c.snapshots, c.deltas, c.changes, c.bytes);
+        }
+        for (auto& e : exporters) {
+            e->stop();
+            const nsm::UdpExporter::Counters c = e->counters();
+            std::fprintf(stderr, "export: %llu datagram(s) with %llu line(s) sent, %llu datagram(s) with %llu line(s) dropped\n",
+                         c.datagrams, c.lines, c.dropped, c.dropped_lines);
+        }
+        monitor.stop();
+    };
+
+    if (g_opts.headless) {
+        config_watcher.start();
+        nsm::ServiceNotifier notifier(monitor);
+        notifier.start();
+        int sig = 0;
+        sigwait(&stop_signals, &sig);
+        std::fprintf(stderr, "headless: %s, stopping\n", strsignal(sig));
+        notifier.stop();
+        if (notifier.watchdog_us()) {
+            const nsm::ServiceNotifier::Counters c = notifier.counters();
+            std::fprintf(stderr, "notify: %llu datagram(s), %llu watchdog ping(s), %llu withheld\n", c.datagrams,
+                         c.pings, c.withheld);
+        }
+        shut_down();
+        return 0;
+    }
+
+    // Window & basic layout; a site-sized config starts with a bigger window
+    const bool many = model.probes.size() > 6;
+    const int W = many ? std::min(720, Fl::w()) : 320, H = many ? std::min(540, Fl::h()) : 200;
+    Fl_Window win(W, H, primary ? "Net & Serial Monitor" : "Net & Serial Monitor (viewer)");
+
+    // Indicator area (top), the part that grows with the window
+    IndicatorGrid grid(0, 5, W, H - 65, &model, primary ? &monitor : nullptr);
 
     // One-line status box (non-editable)
     Fl_Box status_box(0, H - 20, W, 20);
     status_box.box(FL_EMBOSSED_BOX);
     status_box.labelsize(14);
-    status_box.copy_label("network=unknown, serial=unknown");
-
-    // Exit button (bottom-right)
-    Fl_Button exit_btn(W - 110, H - 60, 100, 30, "Exit");
-
-    // Handle exit: stop workers, close window
-    exit_btn.callback(
-        [](Fl_Widget*, void* v) {
-            auto* st = static_cast<AppState*>(v);
-            st->running.store(false);
-            // Hide all windows to make Fl::run() return
-            if (Fl::first_window()) Fl::first_window()->hide();
-        },
-        &state
-    );
+    char initial[512];
+    nsm::format_status_line(model.probes, initial, sizeof(initial));
+    status_box.copy_label(initial);
+
+    // Stats, Table and Exit buttons (bottom-right), kept at their size by a stretching spacer
+    Fl_Group buttons(0, H - 55, W, 30);
+    Fl_Box spacer(0, H - 55, W - 270, 30);
+    Fl_Toggle_Button stats_btn(W - 260, H - 55, 60, 30, "Stats");
+    Fl_Button table_btn(W - 190, H - 55, 80, 30, "Table");
+    Fl_Button exit_btn(W - 110, H - 55, 100, 30, "Exit");
+    buttons.resizable(&spacer);
+    buttons.end();
+
+    TableWindow table(&model);
+    table_btn.callback([](Fl_Widget*, void* v) { static_cast<TableWindow*>(v)->toggle(); }, &table);
+
+    // Handle exit: close the window; the monitor is stopped once Fl::run() returns
+    exit_btn.callback([](Fl_Widget*, void*) {
+        // Hide all windows (table, failure output too) to make Fl::run() return
+        while (Fl::first_window()) Fl::first_window()->hide();
+    });
 
     // Also stop on window close
-    win.callback(
-        [](Fl_Widget*, void* v) {
-            auto* st = static_cast<AppState*>(v);
-            st->running.store(false);
-            if (Fl::first_window()) Fl::first_window()->hide();
-        },
-        &state
-    );
+    win.callback([](Fl_Widget*, void*) {
+        while (Fl::first_window()) Fl::first_window()->hide();
+    });
 
     win.end();
+    win.resizable(&grid);
+    win.size_range(320, 200);
+    monitor.mark_startup(nsm::StartupStep::UiInit, boottime_us());
     win.show(argc, argv);
+    monitor.mark_startup(nsm::StartupStep::WindowShown, boottime_us());
 
-    // Start background threads
-    std::thread t_network(network_worker, &state);
-    std::thread t_ser(serial_worker, &state);
+    if (primary) {
+        config_watcher.start();
+        instance.serve(model);
+    } else {
+        instance.watch(model);
+    }
 
     // Start periodic UI timer
-    UiRefs ui{&state, &status_box, &panel};
+    UiRefs ui{&model, primary ? &monitor : nullptr, &status_box, &grid, &table};
+    stats_btn.callback([](Fl_Widget* w, void* v) {
+        auto* ui = static_cast<UiRefs*>(v);
+        ui->show_stats = static_cast<Fl_Toggle_Button*>(w)->value();
+        ui->grid->overlay(ui->show_stats && ui->stats_text[0] ? ui->stats_text : nullptr);
+    }, &ui);
+    Fl::add_check([](void*) { ++g_self.ui_wakeups; });
+    ui.startup_report = primary && g_opts.startup_report;
+    ui.instance = primary ? &instance : nullptr;
+    const bool serve_image = primary && g_opts.http;
+    std::unique_ptr<StatusImage> image;
+    if (serve_image || !g_opts.png_path.empty())
+        image = std::make_unique<StatusImage>(&model, serve_image ? &dashboard : nullptr, g_opts.png_path);
+    ui.image = image.get();
     Fl::add_timeout(0.2, ui_timer_cb, &ui);
 
     // Enter UI loop
     Fl::run();
 
     // Join workers and exit cleanly
-    state.running.store(false);
-    if (t_network.joinable()) t_network.join();
-    if (t_ser.joinable())  t_ser.join();
+    shut_down();
+    nsm::alloc_report(ui.allocs);
     return 0;
 }
+
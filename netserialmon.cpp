@@ -0,0 +1,3711 @@
+/*
+ * netserialmon - probe engine of Net & Serial Monitor (see netserialmon.h)
+ *
+ * Probes run on worker threads, one per probe. Script output is drained by a
+ * single poll() loop (the reactor) into fixed-size rings and streaming parsers,
+ * scripts are located through an inotify-backed cache, and the last known state
+ * is saved to disk by a background saver. Workers publish results through
+ * atomics and a generation counter; everything a user of the library sees goes
+ * through Monitor.
+ */
+
+#include "netserialmon.h"
+#include "alloc_count.h"
+#include "feed_proto.h"
+#include "history.h"
+#include "nsm_plugin.h"
+#include "output_match.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <climits>  // PATH_MAX
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <dirent.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <strings.h>  // strcasecmp()
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>   // memfd_create()
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>   // access()
+
+#ifdef NSM_ALLOC_COUNT
+// Counting replacement for the global operator new (see alloc_count.h).
+static thread_local unsigned long long t_alloc_count = 0;
+
+// noinline keeps GCC from pairing the inlined malloc/free and warning about a mismatch.
+__attribute__((noinline)) void* operator new(std::size_t n) {
+    ++t_alloc_count;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t n) { return operator new(n); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { operator delete(p); }
+#endif
+
+namespace nsm {
+
+// ----- Probe state names -----
+const char* state_name(ProbeState st) {
+    switch (st) {
+        case ProbeState::Ok:       return "ok";
+        case ProbeState::Degraded: return "degraded";
+        case ProbeState::Fail:     return "fail";
+        case ProbeState::Unknown:
+        default:                   return "unknown";
+    }
+}
+
+ProbeState state_from_name(const std::string& name) {
+    for (ProbeState st : { ProbeState::Ok, ProbeState::Degraded, ProbeState::Fail })
+        if (name == state_name(st)) return st;
+    return ProbeState::Unknown;
+}
+
+
+// ----- Allocation accounting (see alloc_count.h) -----
+#ifdef NSM_ALLOC_COUNT
+static constexpr unsigned kAllocWarmupCycles = 2;
+
+void alloc_cycle_begin(AllocSite& site) { site.mark = t_alloc_count; }
+
+void alloc_cycle_end(AllocSite& site) {
+    const unsigned long long delta = t_alloc_count - site.mark;
+    if (++site.cycles <= kAllocWarmupCycles || delta == 0) return;
+    site.steady_allocs += delta;
+    if (delta > site.worst_cycle) site.worst_cycle = delta;
+    std::fprintf(stderr, "alloc: %s cycle %llu did %llu heap allocation(s)\n", site.name, site.cycles, delta);
+    const char* strict = std::getenv("NSM_ALLOC_STRICT");
+    if (strict && *strict == '1') std::abort();
+}
+
+void alloc_report(const AllocSite& site) {
+    std::fprintf(stderr, "alloc %s: cycles=%llu steady_allocs=%llu worst_cycle=%llu\n",
+                 site.name, site.cycles, site.steady_allocs, site.worst_cycle);
+}
+#endif
+
+// ----- Clock for startup and first-result marks -----
+// CLOCK_BOOTTIME is the clock the kernel uses for the process start time in
+// /proc/self/stat, so marks can be compared with it.
+long long boottime_us() {
+    timespec ts{};
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// When the kernel started this process: field 22 of /proc/self/stat (starttime, in
+// clock ticks since boot) follows the ")" of the comm field.
+static long long process_start_us() {
+    char buf[1024];
+    int fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    const char* p = std::strrchr(buf, ')');
+    if (!p) return 0;
+    unsigned long long ticks = 0;
+    if (std::sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+                    &ticks) != 1) return 0;
+    return static_cast<long long>(ticks * 1000000ULL / static_cast<unsigned long long>(sysconf(_SC_CLK_TCK)));
+}
+
+// Record now into mark unless it is already set (first occurrence wins).
+static void mark_once(std::atomic<long long>& mark) {
+    long long expected = 0;
+    mark.compare_exchange_strong(expected, boottime_us());
+}
+
+// ----- Resolve script path -----
+// Writes the first executable "<dir>/<script>" found in PATH (then the fallbacks)
+// into out. A script containing '/' is taken as a path and only checked.
+// Works on fixed buffers so it can be called from the workers at any time.
+static bool resolve_path(const char* script, char* out, std::size_t len) {
+    if (std::strchr(script, '/')) {
+        int n = std::snprintf(out, len, "%s", script);
+        if (n > 0 && static_cast<std::size_t>(n) < len && access(out, X_OK) == 0) return true;
+        if (len) out[0] = '\0';
+        return false;
+    }
+    auto try_dir = [&](const char* dir, std::size_t dlen) {
+        if (dlen == 0) return false;
+        int n = std::snprintf(out, len, "%.*s/%s", static_cast<int>(dlen), dir, script);
+        return n > 0 && static_cast<std::size_t>(n) < len && access(out, X_OK) == 0;
+    };
+    if (const char* p = std::getenv("PATH")) {
+        for (const char* dir = p;; ) {
+            const char* end = std::strchr(dir, ':');
+            std::size_t dlen = end ? static_cast<std::size_t>(end - dir) : std::strlen(dir);
+            if (try_dir(dir, dlen)) return true;
+            if (!end) break;
+            dir = end + 1;
+        }
+    }
+    const char* fallbacks[] = { "/usr/local/bin", "/usr/bin", nullptr };
+    for (int i = 0; fallbacks[i]; ++i) {
+        if (try_dir(fallbacks[i], std::strlen(fallbacks[i]))) return true;
+    }
+    if (len) out[0] = '\0'; // not found
+    return false;
+}
+
+// ----- Script resolution cache, kept current by inotify -----
+//
+// Each script is resolved once and then re-resolved only when something changes in
+// one of the candidate directories (PATH, then the fallbacks) or in the resolved
+// file itself. A watcher thread blocks on the inotify fd; workers read the cached
+// path and sleep on a condition variable so installs, removals and updates wake
+// them immediately. Without inotify the cache simply never invalidates.
+class ScriptResolver {
+public:
+    ScriptResolver() = default;
+    ScriptResolver(const ScriptResolver&) = delete;
+    ScriptResolver& operator=(const ScriptResolver&) = delete;
+    ~ScriptResolver() { stop(); }
+
+    // Register a script (a bare name searched in PATH, or a path containing '/') and
+    // return its id. Registering the same script again returns the existing id, so
+    // probes sharing a script share one cache entry. Safe to call after start().
+    int add(const char* script) {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (std::size_t i = 0; i < entries_.size(); ++i) {
+            if (std::strcmp(entries_[i].name, script) == 0) return static_cast<int>(i);
+        }
+        entries_.emplace_back();
+        Entry& e = entries_.back();
+        std::snprintf(e.name, sizeof(e.name), "%s", script);
+        const char* slash = std::strrchr(e.name, '/');
+        e.base = slash ? slash + 1 : e.name;
+        resolve_path(e.name, e.path, sizeof(e.path));
+        if (inotify_fd_ >= 0) {
+            if (slash) watch_parent(e);
+            watch_file(e);
+        }
+        return static_cast<int>(entries_.size() - 1);
+    }
+
+    void start() {
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd_ < 0 || pipe2(stop_pipe_, O_CLOEXEC) != 0) {
+            std::perror("inotify");
+            return;
+        }
+        for_each_search_dir([&](const char* dir) {
+            int wd = inotify_add_watch(inotify_fd_, dir, kDirMask);
+            if (wd >= 0) dir_wds_.push_back(wd);   // missing directories are skipped
+        });
+        std::lock_guard<std::mutex> lk(mu_);
+        for (Entry& e : entries_) {
+            if (e.base != e.name) watch_parent(e);
+            watch_file(e);
+        }
+        thread_ = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        if (thread_.joinable()) {
+            char c = 0;
+            (void)!write(stop_pipe_[1], &c, 1);
+            thread_.join();
+        }
+        for (int& fd : stop_pipe_) if (fd >= 0) { close(fd); fd = -1; }
+        if (inotify_fd_ >= 0) { close(inotify_fd_); inotify_fd_ = -1; }
+        cv_.notify_all();
+    }
+
+    const char* name(int id) {
+        std::lock_guard<std::mutex> lk(mu_);
+        return entries_[id].name;   // entries never move, so the pointer stays valid
+    }
+
+    // Copy the current path ("" if not found) and return its generation.
+    unsigned lookup(int id, char* out, std::size_t len) {
+        std::lock_guard<std::mutex> lk(mu_);
+        const Entry& e = entries_[id];
+        std::snprintf(out, len, "%s", e.path);
+        return e.generation;
+    }
+
+    // Sleep up to ms milliseconds (forever if ms < 0). Returns early when the script's
+    // resolution moves past generation seen, or once running goes false and wake()
+    // is called.
+    void wait_change(int id, unsigned seen, int ms, const std::atomic<bool>& running) {
+        std::unique_lock<std::mutex> lk(mu_);
+        auto done = [&] { return !running.load() || entries_[id].generation != seen; };
+        if (ms < 0) cv_.wait(lk, done);
+        else        cv_.wait_for(lk, std::chrono::milliseconds(ms), done);
+    }
+
+    // Wake the waiters so they look at their running flag again.
+    void wake() {
+        { std::lock_guard<std::mutex> lk(mu_); }
+        cv_.notify_all();
+    }
+
+private:
+    struct Entry {
+        char name[PATH_MAX] = {};
+        const char* base = nullptr; // file name part of name, matched against dir events
+        char path[PATH_MAX] = {};
+        int file_wd = -1;           // watch on the resolved file (follows symlinks)
+        unsigned generation = 0;
+    };
+
+    std::deque<Entry> entries_;     // stable addresses; only ever grows
+    std::vector<int> dir_wds_;
+    int inotify_fd_ = -1;
+    int stop_pipe_[2] = {-1, -1};
+    std::thread thread_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+
+    template <class F>
+    static void for_each_search_dir(F&& f) {
+        char dir[PATH_MAX];
+        if (const char* p = std::getenv("PATH")) {
+            for (const char* d = p;; ) {
+                const char* end = std::strchr(d, ':');
+                int dlen = end ? static_cast<int>(end - d) : static_cast<int>(std::strlen(d));
+                if (dlen > 0 && dlen < PATH_MAX) {
+                    std::snprintf(dir, sizeof(dir), "%.*s", dlen, d);
+                    f(dir);
+                }
+                if (!end) break;
+                d = end + 1;
+            }
+        }
+        f("/usr/local/bin");
+        f("/usr/bin");
+    }
+
+    static constexpr uint32_t kDirMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                         IN_ATTRIB | IN_CLOSE_WRITE | IN_ONLYDIR;
+
+    // Scripts given with a directory are not covered by the PATH watches.
+    void watch_parent(Entry& e) {
+        char dir[PATH_MAX];
+        std::snprintf(dir, sizeof(dir), "%.*s", static_cast<int>(e.base - e.name), e.name);
+        int wd = inotify_add_watch(inotify_fd_, dir[0] ? dir : "/", kDirMask);
+        if (wd >= 0) dir_wds_.push_back(wd);
+    }
+
+    void watch_file(Entry& e) {
+        if (e.file_wd >= 0) inotify_rm_watch(inotify_fd_, e.file_wd);
+        e.file_wd = e.path[0]
+            ? inotify_add_watch(inotify_fd_, e.path, IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+            : -1;
+    }
+
+    // Called with mu_ held. Any event touching the script counts as a change, even if
+    // the resolved path stays the same (the file was rewritten or chmod'ed).
+    void refresh(Entry& e) {
+        resolve_path(e.name, e.path, sizeof(e.path));
+        watch_file(e);
+        ++e.generation;
+    }
+
+    void run() {
+        alignas(inotify_event) char buf[4096];
+        pollfd fds[2] = { {inotify_fd_, POLLIN, 0}, {stop_pipe_[0], POLLIN, 0} };
+        for (;;) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents) break;
+            bool changed = false;
+            ssize_t n;
+            while ((n = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+                std::lock_guard<std::mutex> lk(mu_);
+                for (char* p = buf; p < buf + n; ) {
+                    auto* ev = reinterpret_cast<inotify_event*>(p);
+                    for (Entry& e : entries_) {
+                        const bool hit = (ev->wd == e.file_wd) ||
+                                         (ev->len && std::strcmp(ev->name, e.base) == 0);
+                        if (hit) { refresh(e); changed = true; }
+                    }
+                    p += sizeof(inotify_event) + ev->len;
+                }
+            }
+            if (changed) cv_.notify_all();
+        }
+    }
+};
+
+// ----- Reactor: one poll() loop on its own thread for engine file descriptors -----
+//
+// Handlers are plain function pointers plus a data pointer (as with Fl::add_fd) and
+// run on the reactor thread with the registration lock held, so once remove()
+// returns the handler is not running and will not run again. A handler returns
+// false to unregister itself (e.g. on EOF), and may change the events it waits
+// for through *events. Registration never allocates once the
+// tables have grown to the steady-state number of descriptors.
+class Reactor {
+public:
+    using Handler = bool (*)(int fd, short revents, short* events, void* data);
+
+    Reactor() = default;
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+    ~Reactor() { stop(); }
+
+    bool start() {
+        if (pipe2(wake_pipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+            std::perror("reactor");
+            return false;
+        }
+        entries_.reserve(64);
+        pfds_.reserve(64);
+        thread_ = std::thread([this] { run(); });
+        return true;
+    }
+
+    void stop() {
+        if (thread_.joinable()) {
+            stopping_.store(true);
+            wake();
+            thread_.join();
+        }
+        for (int& fd : wake_pipe_) if (fd >= 0) { close(fd); fd = -1; }
+    }
+
+    bool running() const { return thread_.joinable(); }
+
+    // poll() returns so far (self-metrics)
+    unsigned long long wakeups() const { return wakeups_.load(std::memory_order_relaxed); }
+
+    // Watchdog check: true if the loop has come round since the previous call,
+    // which wakes it so that an idle loop comes round too. A handler that never
+    // returns, or a loop that has died, reads false from the next call on.
+    bool responsive() {
+        const bool ok = running() && answered_.load() == pings_.load();
+        pings_.fetch_add(1);
+        wake();
+        return ok;
+    }
+
+    void add(int fd, short events, Handler h, void* data) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            entries_.push_back(Entry{fd, events, h, data});
+        }
+        wake();
+    }
+
+    void remove(int fd) {
+        std::lock_guard<std::mutex> lk(mu_);
+        erase(fd);
+    }
+
+private:
+    struct Entry {
+        int fd;
+        short events;
+        Handler handler;
+        void* data;
+    };
+
+    std::thread thread_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<unsigned long long> wakeups_{0};
+    std::atomic<unsigned long long> pings_{0}, answered_{0};   // responsive()
+    int wake_pipe_[2] = {-1, -1};
+    std::mutex mu_;
+    std::vector<Entry> entries_;        // guarded by mu_
+    std::vector<pollfd> pfds_;          // reactor thread only
+
+    void wake() {
+        char c = 0;
+        (void)!write(wake_pipe_[1], &c, 1);
+    }
+
+    void erase(int fd) {
+        for (std::size_t i = 0; i < entries_.size(); ++i) {
+            if (entries_[i].fd != fd) continue;
+            entries_[i] = entries_.back();
+            entries_.pop_back();
+            return;
+        }
+    }
+
+    void run() {
+        while (!stopping_.load()) {
+            pfds_.clear();
+            pfds_.push_back(pollfd{wake_pipe_[0], POLLIN, 0});
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                for (const Entry& e : entries_) pfds_.push_back(pollfd{e.fd, e.events, 0});
+            }
+            if (poll(pfds_.data(), pfds_.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                std::perror("reactor: poll");
+                break;
+            }
+            wakeups_.fetch_add(1, std::memory_order_relaxed);
+            const unsigned long long pinged = pings_.load();
+            if (pfds_[0].revents) {
+                char buf[64];
+                while (read(wake_pipe_[0], buf, sizeof(buf)) > 0) {}
+            }
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                for (std::size_t i = 1; i < pfds_.size(); ++i) {
+                    if (!pfds_[i].revents) continue;
+                    // The set may have changed while polling; dispatch only to live entries.
+                    for (Entry& e : entries_) {
+                        if (e.fd != pfds_[i].fd) continue;
+                        if (!e.handler(e.fd, pfds_[i].revents, &e.events, e.data)) erase(e.fd);
+                        break;
+                    }
+                }
+            }
+            answered_.store(pinged);
+        }
+    }
+};
+
+// ----- Captured probe output -----
+// The last kRuns runs of one probe, keeping the last kRunBytes of each run's combined
+// stdout/stderr. Storage is fixed at construction; appending never allocates and
+// drops the oldest bytes of the run once it is full.
+class OutputRing {
+public:
+    static constexpr int kRuns = 4;
+    static constexpr std::size_t kRunBytes = 4096;
+
+    void begin_run() {
+        std::lock_guard<std::mutex> lk(mu_);
+        cur_ = (cur_ + 1) % kRuns;
+        Run& r = runs_[cur_];
+        r.used = true;
+        r.finished = false;
+        r.started = std::time(nullptr);
+        r.total = 0;
+    }
+
+    void append(const char* data, std::size_t n) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (cur_ < 0) return;
+        Run& r = runs_[cur_];
+        if (n > kRunBytes) {            // only the tail can survive anyway
+            r.total += n - kRunBytes;
+            data += n - kRunBytes;
+            n = kRunBytes;
+        }
+        for (std::size_t i = 0; i < n; ++i) r.data[(r.total + i) % kRunBytes] = data[i];
+        r.total += n;
+    }
+
+    // what: short outcome text such as "exit 1", "timeout" or "spawn failed: ...".
+    void end_run(bool failed, const char* what) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (cur_ < 0) return;
+        Run& r = runs_[cur_];
+        r.finished = true;
+        r.failed = failed;
+        std::snprintf(r.outcome, sizeof(r.outcome), "%s", what);
+    }
+
+    // Text of the most recent failed run, with a header line. Called from the UI on demand.
+    bool last_failure(std::string& out) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (int k = 0; k < kRuns && cur_ >= 0; ++k) {
+            const Run& r = runs_[(cur_ - k + kRuns) % kRuns];
+            if (!r.used || !r.finished || !r.failed) continue;
+            char head[160], when[32];
+            std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", std::localtime(&r.started));
+            std::snprintf(head, sizeof(head), "[%s] %s%s\n", when, r.outcome,
+                          r.total > kRunBytes ? " (output truncated)" : "");
+            out = head;
+            if (r.total <= kRunBytes) {
+                out.append(r.data, r.total);
+            } else {
+                const std::size_t start = r.total % kRunBytes;
+                out.append(r.data + start, kRunBytes - start);
+                out.append(r.data, start);
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct Run {
+        bool used = false;
+        bool finished = false;
+        bool failed = false;
+        std::time_t started = 0;
+        std::size_t total = 0;          // bytes produced by the run (may exceed kRunBytes)
+        char outcome[96] = {};
+        char data[kRunBytes];
+    };
+
+    mutable std::mutex mu_;
+    int cur_ = -1;
+    Run runs_[kRuns];
+};
+
+// ----- Nagios plugins: exit codes and performance data -----
+//
+// A probe with "type = nagios" runs a standard Nagios plugin. Exit codes 0/1/2/3
+// mean OK/WARNING/CRITICAL/UNKNOWN, and the text after '|' is performance data:
+//
+//   PING OK - Packet loss = 0%, RTA = 0.80 ms|rta=0.800000ms;100;500;0 pl=0%;20;60;0
+//
+// Perfdata is taken from the first line and, as plugins may spread it over the long
+// output, from everything after the first '|' on a later line.
+static ProbeState nagios_state(int exit_code) {
+    switch (exit_code) {
+        case 0:  return ProbeState::Ok;
+        case 1:  return ProbeState::Degraded;
+        case 2:  return ProbeState::Fail;
+        default: return ProbeState::Unknown;
+    }
+}
+
+static const char* nagios_code_name(int exit_code) {
+    static const char* const names[] = { "OK", "WARNING", "CRITICAL", "UNKNOWN" };
+    return exit_code >= 0 && exit_code <= 3 ? names[exit_code] : "UNKNOWN";
+}
+
+// Collects the perfdata text of one run as output streams in (bounded; the rest of
+// the output is not kept here).
+struct PerfCollector {
+    char text[1024];
+    std::size_t len = 0;
+    int line = 0;
+    bool in_perf = false, long_perf = false;
+
+    void reset() { len = 0; line = 0; in_perf = long_perf = false; }
+
+    void feed(const char* data, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            const char c = data[i];
+            if (c == '\n') {
+                if (line++ == 0) in_perf = false;
+                if (in_perf) put(' ');
+            } else if (c == '|' && !in_perf && (line == 0 || !long_perf)) {
+                in_perf = true;
+                long_perf = line > 0;
+                put(' ');
+            } else if (in_perf) {
+                put(c);
+            }
+        }
+    }
+
+    // Parse "label=value[uom][;warn;crit;min;max] ..." into out; returns the count.
+    int parse(PerfMetric* out, int max) const {
+        int count = 0;
+        std::size_t i = 0;
+        auto at = [&](std::size_t k) { return k < len ? text[k] : '\0'; };
+        while (count < max) {
+            while (at(i) == ' ' || at(i) == '\t' || at(i) == '\r') ++i;
+            if (i >= len) break;
+            PerfMetric& m = out[count];
+            std::size_t l = 0;
+            if (at(i) == '\'') {            // quoted label, '' is a literal quote
+                for (++i; i < len && !(at(i) == '\'' && at(i + 1) != '\''); ++i) {
+                    if (at(i) == '\'') ++i;
+                    if (l + 1 < sizeof(m.label)) m.label[l++] = at(i);
+                }
+                ++i;
+            } else {
+                for (; i < len && at(i) != '=' && at(i) != ' '; ++i)
+                    if (l + 1 < sizeof(m.label)) m.label[l++] = at(i);
+            }
+            m.label[l] = '\0';
+            if (at(i) != '=') { while (i < len && at(i) != ' ') ++i; continue; }
+
+            // Copy the value and unit out of the unterminated buffer for strtod.
+            char field[48];
+            std::size_t f = 0;
+            for (++i; i < len && at(i) != ';' && at(i) != ' ' && f + 1 < sizeof(field); ++i) field[f++] = at(i);
+            field[f] = '\0';
+            while (i < len && at(i) != ' ') ++i;          // warn;crit;min;max are not used
+            char* end = nullptr;
+            m.value = std::strtod(field, &end);
+            if (end == field || l == 0) continue;           // "U" (no value) or no label
+            std::snprintf(m.uom, sizeof(m.uom), "%s", end);
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    void put(char c) { if (len < sizeof(text)) text[len++] = c; }
+};
+
+// ----- Batch scripts: one run reports many probes -----
+//
+// A [batch NAME] section runs one script whose output has one line per device:
+//
+//   name status [metric]       e.g. "switch-3 ok 0.42" or "ups fail"
+//
+// status is ok/up/0, warning/degraded/1, fail/down/critical/2 or unknown/3
+// (any case). Probes with "batch = NAME" take their state from the line carrying
+// their name; lines for other names are ignored. Lines are parsed as they stream
+// in, into per-member slots allocated when the batch starts.
+struct Probe;
+
+// ok/up/0, warning/warn/degraded/1, fail/down/critical/2, unknown/3 (any case)
+static bool parse_status(const char* s, ProbeState& st) {
+    static const struct { const char* word; ProbeState st; } words[] = {
+        {"ok", ProbeState::Ok}, {"up", ProbeState::Ok}, {"0", ProbeState::Ok},
+        {"warning", ProbeState::Degraded}, {"warn", ProbeState::Degraded},
+        {"degraded", ProbeState::Degraded}, {"1", ProbeState::Degraded},
+        {"fail", ProbeState::Fail}, {"down", ProbeState::Fail}, {"critical", ProbeState::Fail},
+        {"2", ProbeState::Fail}, {"unknown", ProbeState::Unknown}, {"3", ProbeState::Unknown},
+    };
+    for (const auto& w : words)
+        if (strcasecmp(s, w.word) == 0) { st = w.st; return true; }
+    return false;
+}
+
+struct BatchSlot {
+    Probe* member = nullptr;
+    const char* name = nullptr;     // member's name (owned by its config)
+    bool seen = false;              // reported in the current run
+    ProbeState state = ProbeState::Unknown;
+    double metric = NAN;
+    char line[258];                 // the reporting line and '\n', for the failure view
+    int failures = 0;               // consecutive, for the member's fail_threshold
+};
+
+struct BatchCollector {
+    std::vector<BatchSlot> slots;   // sized once; never reallocated while running
+    char line[256];
+    std::size_t len = 0;
+
+    void reset() {
+        len = 0;
+        for (auto& sl : slots) sl.seen = false;
+    }
+
+    void feed(const char* data, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            if (data[i] == '\n') { finish(); continue; }
+            if (len < sizeof(line) - 1) line[len++] = data[i];
+        }
+    }
+
+    // End of a line, or of the output (a last line without '\n').
+    void finish() {
+        if (len == 0) return;
+        line[len] = '\0';
+        if (line[len - 1] == '\r') line[len - 1] = '\0';
+        len = 0;
+
+        char name[64], status[16];
+        double metric = NAN;
+        const int fields = std::sscanf(line, "%63s %15s %lf", name, status, &metric);
+        if (fields < 2) return;
+        ProbeState st;
+        if (!parse_status(status, st)) return;
+        for (auto& sl : slots) {
+            if (std::strcmp(sl.name, name) != 0) continue;
+            sl.seen = true;
+            sl.state = st;
+            sl.metric = fields == 3 ? metric : NAN;
+            std::snprintf(sl.line, sizeof(sl.line), "%s\n", line);
+            return;
+        }
+    }
+};
+
+// ----- Probe process: spawn, capture output, wait with timeout -----
+//
+// The script runs as "/bin/sh -c 'exec <script> <args>'" in its own process group,
+// with stdin on /dev/null and stdout+stderr on one pipe. The reactor drains the pipe
+// into the probe's OutputRing while the worker waits for the exit (on a pidfd where
+// available), so a chatty script never blocks on a full pipe and nothing is
+// buffered beyond the ring.
+static void build_command(char* cmd, std::size_t len, const char* script, const char* args) {
+    std::snprintf(cmd, len, "exec '%s' %s", script, args);
+}
+
+struct RunCapture {
+    OutputRing* ring = nullptr;
+    const OutputMatchers* matchers = nullptr;   // null when the probe has none
+    MatchState match;               // fed by the reactor; read by the worker after the run
+    PerfCollector* perf = nullptr;  // nagios probes only, same access pattern as match
+    BatchCollector* batch = nullptr;    // batch runners only, likewise
+    std::mutex mu;
+    std::condition_variable cv;
+    bool eof = false;               // guarded by mu
+};
+
+// The run's output is complete: match and parse its last, unterminated line.
+static void finish_capture(RunCapture& cap) {
+    if (cap.matchers) cap.match.finish(*cap.matchers);
+    if (cap.batch) cap.batch->finish();
+}
+
+static bool drain_probe_output(int fd, short, short*, void* data) {
+    auto* cap = static_cast<RunCapture*>(data);
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            cap->ring->append(buf, static_cast<std::size_t>(n));
+            if (cap->matchers) cap->match.feed(*cap->matchers, buf, static_cast<std::size_t>(n));
+            if (cap->perf) cap->perf->feed(buf, static_cast<std::size_t>(n));
+            if (cap->batch) cap->batch->feed(buf, static_cast<std::size_t>(n));
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+        break;      // EOF or error: the run's output is complete
+    }
+    finish_capture(*cap);
+    {
+        std::lock_guard<std::mutex> lk(cap->mu);
+        cap->eof = true;
+    }
+    cap->cv.notify_all();
+    return false;
+}
+
+static int pidfd_open_compat(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Returns the wait status, or -1 with errno set if the process could not be spawned.
+// timed_out is set when the process group had to be killed.
+// stdin_fd, if given, becomes the process's stdin instead of /dev/null.
+static int run_probe_process(Reactor& reactor, RunCapture& cap, const char* cmd, int timeout_ms,
+                             const std::atomic<bool>& active, bool& timed_out, int stdin_fd = -1) {
+    timed_out = false;
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0) return -1;
+
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&fa);
+    if (stdin_fd >= 0) posix_spawn_file_actions_adddup2(&fa, stdin_fd, 0);
+    else posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&fa, pipefd[1], 1);
+    posix_spawn_file_actions_adddup2(&fa, pipefd[1], 2);
+    posix_spawnattr_init(&attr);
+    // Scripts start with no signals blocked, whatever the embedding program blocks
+    // (the headless front end takes SIGTERM with sigwait()).
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    char sh[] = "/bin/sh", dash_c[] = "-c";
+    char* argv[] = { sh, dash_c, const_cast<char*>(cmd), nullptr };
+    pid_t pid = -1;
+    const int rc = posix_spawn(&pid, sh, &fa, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    close(pipefd[1]);
+    if (rc != 0) {
+        close(pipefd[0]);
+        errno = rc;
+        return -1;
+    }
+
+    cap.eof = false;
+    if (cap.matchers) cap.match.reset(*cap.matchers);
+    if (cap.perf) cap.perf->reset();
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+    reactor.add(pipefd[0], POLLIN, drain_probe_output, &cap);
+
+    // Wait for the exit in short slices so a stop request or the timeout is noticed.
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    const int pidfd = pidfd_open_compat(pid);
+    int status = 0;
+    for (;;) {
+        if (waitpid(pid, &status, WNOHANG) == pid) break;
+        const bool expired = timeout_ms > 0 && std::chrono::steady_clock::now() >= deadline;
+        if (expired || !active.load()) {
+            timed_out = expired;
+            kill(-pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            break;
+        }
+        if (pidfd >= 0) {
+            pollfd p{pidfd, POLLIN, 0};
+            poll(&p, 1, 100);
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    if (pidfd >= 0) close(pidfd);
+
+    // Let the reactor see EOF. A background grandchild may keep the pipe open; give
+    // it a moment, then stop capturing rather than hang the worker.
+    {
+        std::unique_lock<std::mutex> lk(cap.mu);
+        cap.cv.wait_for(lk, std::chrono::milliseconds(500), [&] { return cap.eof; });
+    }
+    reactor.remove(pipefd[0]);  // the handler is not running once this returns
+    bool eof;
+    {
+        std::lock_guard<std::mutex> lk(cap.mu);
+        eof = cap.eof;
+    }
+    if (!eof) finish_capture(cap);  // what arrived so far is all the worker gets
+    close(pipefd[0]);
+    return status;
+}
+
+// ----- Fault injection (stress testing only; inactive unless NSM_FAULTS is set) -----
+//
+// Sits between probe execution and result publishing. Spec syntax, one entry per probe:
+//   NSM_FAULTS="network:drop=0.2,latency=300;serial:eagain=0.1,schedule=pass/timeout/freeze"
+// Keys:
+//   latency=MS  jitter=MS    extra delay before publishing a result
+//   drop=P                   discard the result (state keeps its previous value)
+//   timeout=P                skip the script, wait timeout_ms, publish Fail
+//   eagain=P  enomem=P       fail the spawn with that errno (as if fork() failed)
+//   freeze=P                 stall the worker for freeze_ms without publishing
+//   timeout_ms=MS freeze_ms=MS
+//   schedule=A/B/...         scripted actions applied cycle by cycle, then repeated;
+//                            A is one of pass, drop, timeout, eagain, enomem, freeze
+// A scripted action takes precedence over the probabilities for that cycle.
+// NSM_FAULT_SEED makes the random draws reproducible.
+enum class FaultAction : int { Pass, Drop, Timeout, SpawnEagain, SpawnEnomem, Freeze };
+
+struct FaultStats {
+    std::atomic<unsigned> cycles{0};
+    std::atomic<unsigned> published{0};
+    std::atomic<unsigned> dropped{0};
+    std::atomic<unsigned> timeouts{0};
+    std::atomic<unsigned> spawn_failures{0};
+    std::atomic<unsigned> freezes{0};
+    std::atomic<unsigned long long> busy_us{0};   // time spent per cycle, excluding the idle sleep
+    std::atomic<unsigned long long> max_us{0};
+};
+
+class FaultInjector {
+public:
+    bool enabled = false;
+    int latency_ms = 0, jitter_ms = 0;
+    int timeout_ms = 1000, freeze_ms = 10000;
+    double p_drop = 0, p_timeout = 0, p_eagain = 0, p_enomem = 0, p_freeze = 0;
+    std::vector<FaultAction> schedule;
+    FaultStats stats;
+
+    void seed(unsigned v) { rng_.seed(v); }
+
+    // Parse the "key=value,key=value" part of one probe entry and apply it. On an
+    // unknown key or action nothing is applied and false is returned, with a message.
+    bool configure(const std::string& name, const std::string& spec) {
+        int latency = 0, jitter = 0, timeout = 1000, freeze = 10000;
+        double drop = 0, p_to = 0, eagain = 0, enomem = 0, p_fr = 0;
+        std::vector<FaultAction> actions;
+        std::stringstream ss(spec);
+        std::string kv;
+        while (std::getline(ss, kv, ',')) {
+            if (kv.empty()) continue;
+            auto eq = kv.find('=');
+            std::string key = kv.substr(0, eq);
+            std::string val = (eq == std::string::npos) ? std::string() : kv.substr(eq + 1);
+            bool good = true;
+            if      (key == "latency")    good = parse_ms(val, latency);
+            else if (key == "jitter")     good = parse_ms(val, jitter);
+            else if (key == "timeout_ms") good = parse_ms(val, timeout);
+            else if (key == "freeze_ms")  good = parse_ms(val, freeze);
+            else if (key == "drop")       good = parse_probability(val, drop);
+            else if (key == "timeout")    good = parse_probability(val, p_to);
+            else if (key == "eagain")     good = parse_probability(val, eagain);
+            else if (key == "enomem")     good = parse_probability(val, enomem);
+            else if (key == "freeze")     good = parse_probability(val, p_fr);
+            else if (key == "schedule") {
+                std::stringstream as(val);
+                std::string a;
+                while (std::getline(as, a, '/')) {
+                    if      (a == "pass")    actions.push_back(FaultAction::Pass);
+                    else if (a == "drop")    actions.push_back(FaultAction::Drop);
+                    else if (a == "timeout") actions.push_back(FaultAction::Timeout);
+                    else if (a == "eagain")  actions.push_back(FaultAction::SpawnEagain);
+                    else if (a == "enomem")  actions.push_back(FaultAction::SpawnEnomem);
+                    else if (a == "freeze")  actions.push_back(FaultAction::Freeze);
+                    else {
+                        std::fprintf(stderr, "NSM_FAULTS: %s: unknown action '%s'\n", name.c_str(), a.c_str());
+                        return false;
+                    }
+                }
+            } else {
+                std::fprintf(stderr, "NSM_FAULTS: %s: unknown key '%s'\n", name.c_str(), key.c_str());
+                return false;
+            }
+            if (!good) {
+                const bool ms = key == "latency" || key == "jitter" || key == "timeout_ms" || key == "freeze_ms";
+                std::fprintf(stderr, "NSM_FAULTS: %s: bad value '%s' for %s (want %s)\n", name.c_str(),
+                             val.c_str(), key.c_str(), ms ? "milliseconds, 0 or more" : "a probability from 0 to 1");
+                return false;
+            }
+        }
+        latency_ms = latency;
+        jitter_ms = jitter;
+        timeout_ms = timeout;
+        freeze_ms = freeze;
+        p_drop = drop;
+        p_timeout = p_to;
+        p_eagain = eagain;
+        p_enomem = enomem;
+        p_freeze = p_fr;
+        schedule.swap(actions);
+        step_ = 0;
+        enabled = true;
+        return true;
+    }
+
+    // Decide what happens to this cycle. Called once per cycle from the owning worker only.
+    FaultAction next() {
+        stats.cycles.fetch_add(1, std::memory_order_relaxed);
+        if (!enabled) return FaultAction::Pass;
+        if (!schedule.empty()) {
+            FaultAction a = schedule[step_++ % schedule.size()];
+            if (a != FaultAction::Pass) return a;
+        }
+        if (roll(p_eagain))  return FaultAction::SpawnEagain;
+        if (roll(p_enomem))  return FaultAction::SpawnEnomem;
+        if (roll(p_timeout)) return FaultAction::Timeout;
+        if (roll(p_freeze))  return FaultAction::Freeze;
+        if (roll(p_drop))    return FaultAction::Drop;
+        return FaultAction::Pass;
+    }
+
+    int delay_ms() {
+        if (!enabled) return 0;
+        int d = latency_ms;
+        if (jitter_ms > 0) d += std::uniform_int_distribution<int>(0, jitter_ms)(rng_);
+        return d;
+    }
+
+    void report(const char* name) const {
+        unsigned long long cycles = stats.cycles.load();
+        std::fprintf(stderr,
+                     "faults %s: cycles=%llu published=%u dropped=%u timeouts=%u spawn_failures=%u "
+                     "freezes=%u busy_avg_ms=%.1f busy_max_ms=%.1f\n",
+                     name, cycles, stats.published.load(), stats.dropped.load(), stats.timeouts.load(),
+                     stats.spawn_failures.load(), stats.freezes.load(),
+                     cycles ? stats.busy_us.load() / 1000.0 / cycles : 0.0, stats.max_us.load() / 1000.0);
+    }
+
+private:
+    std::mt19937 rng_{std::random_device{}()};
+    std::size_t step_ = 0;
+
+    // Whole-string numbers only: "", "1s" or "abc" are errors rather than 0.
+    static bool parse_ms(const std::string& val, int& out) {
+        char* end = nullptr;
+        errno = 0;
+        const long v = std::strtol(val.c_str(), &end, 10);
+        if (val.empty() || *end || errno || v < 0 || v > INT_MAX) return false;
+        out = static_cast<int>(v);
+        return true;
+    }
+
+    static bool parse_probability(const std::string& val, double& out) {
+        char* end = nullptr;
+        const double v = std::strtod(val.c_str(), &end);
+        if (val.empty() || *end || !(v >= 0 && v <= 1)) return false;
+        out = v;
+        return true;
+    }
+
+    bool roll(double p) {
+        return p > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < p;
+    }
+};
+
+// Check every NSM_FAULTS entry once, before any probe starts: a stress run with
+// a mistyped entry would otherwise pass while testing less than it claims.
+// False, with a summary on stderr, if an entry names no probe, has an unknown
+// key or action, or repeats a probe.
+static bool check_fault_spec() {
+    const char* spec = std::getenv("NSM_FAULTS");
+    if (!spec || !*spec) return true;
+    std::vector<std::string> seen;
+    int bad = 0, entries = 0;
+    std::stringstream ss(spec);
+    std::string entry;
+    while (std::getline(ss, entry, ';')) {
+        if (entry.empty()) continue;
+        ++entries;
+        const auto colon = entry.find(':');
+        const std::string name = entry.substr(0, colon);
+        if (name.empty()) {
+            std::fprintf(stderr, "NSM_FAULTS: entry '%s' names no probe\n", entry.c_str());
+            ++bad;
+            continue;
+        }
+        if (std::find(seen.begin(), seen.end(), name) != seen.end()) {
+            std::fprintf(stderr, "NSM_FAULTS: %s: more than one entry\n", name.c_str());
+            ++bad;
+            continue;
+        }
+        seen.push_back(name);
+        FaultInjector scratch;
+        if (!scratch.configure(name, colon == std::string::npos ? std::string() : entry.substr(colon + 1))) ++bad;
+    }
+    if (bad) std::fprintf(stderr, "NSM_FAULTS: %d of %d entries invalid, not starting\n", bad, entries);
+    return bad == 0;
+}
+
+// Every NSM_FAULTS entry must name a probe of cfg: a misspelled name would
+// otherwise inject nothing. False, with a message per entry, if one does not.
+static bool check_fault_names(const Config& cfg) {
+    const char* spec = std::getenv("NSM_FAULTS");
+    if (!spec || !*spec) return true;
+    bool ok = true;
+    std::stringstream ss(spec);
+    std::string entry;
+    while (std::getline(ss, entry, ';')) {
+        if (entry.empty()) continue;
+        const std::string name = entry.substr(0, entry.find(':'));
+        auto named = [&](const ProbeConfig& pc) { return pc.name == name; };
+        if (std::any_of(cfg.probes.begin(), cfg.probes.end(), named) ||
+            std::any_of(cfg.batches.begin(), cfg.batches.end(), named))
+            continue;
+        std::fprintf(stderr, "NSM_FAULTS: %s: no such probe in the config\n", name.c_str());
+        ok = false;
+    }
+    return ok;
+}
+
+// Configure fi from the NSM_FAULTS entry for probe name, if there is one (the
+// spec has passed check_fault_spec()). Returns true if faults are active for
+// this probe.
+static bool configure_faults(const std::string& name, FaultInjector& fi) {
+    const char* spec = std::getenv("NSM_FAULTS");
+    if (!spec || !*spec) return false;
+    unsigned seed = std::random_device{}();
+    if (const char* s = std::getenv("NSM_FAULT_SEED")) seed = static_cast<unsigned>(std::strtoul(s, nullptr, 0));
+    fi.seed(seed ^ static_cast<unsigned>(std::hash<std::string>{}(name)));
+
+    std::stringstream ss(spec);
+    std::string entry;
+    while (std::getline(ss, entry, ';')) {
+        auto colon = entry.find(':');
+        if (entry.compare(0, colon, name) != 0) continue;
+        fi.configure(name, (colon == std::string::npos) ? std::string() : entry.substr(colon + 1));
+        break;
+    }
+    return fi.enabled;
+}
+
+// ----- Native probe plugins (interface in nsm_plugin.h) -----
+//
+// Every *.so in the plugin directory is loaded once at startup; the probe types it
+// exports can then be used as "type = NAME". Libraries are never unloaded, so a
+// config reload can drop and recreate instances freely.
+#ifndef NSM_PLUGIN_DIR
+#define NSM_PLUGIN_DIR "/usr/local/lib/net-serial-monitor/plugins"
+#endif
+
+class PluginRegistry {
+public:
+    // Problems with individual plugins are reported and that plugin is skipped.
+    void load_dir(const std::string& dir) {
+        DIR* d = opendir(dir.c_str());
+        if (!d) return;             // no plugins installed
+        std::vector<std::string> files;
+        while (dirent* e = readdir(d)) {
+            const std::string name = e->d_name;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0) files.push_back(dir + "/" + name);
+        }
+        closedir(d);
+        std::sort(files.begin(), files.end());  // deterministic precedence for duplicate names
+        for (const auto& f : files) load(f);
+    }
+
+    const nsm_probe_type* find(const std::string& name) const {
+        for (const nsm_probe_type* t : types_)
+            if (name == t->name) return t;
+        return nullptr;
+    }
+
+private:
+    std::vector<const nsm_probe_type*> types_;
+
+    void load(const std::string& path) {
+        void* h = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!h) {
+            std::fprintf(stderr, "plugins: %s\n", dlerror());
+            return;
+        }
+        auto entry = reinterpret_cast<nsm_plugin_types_fn>(dlsym(h, "nsm_plugin_types"));
+        const nsm_probe_type* const* list = entry ? entry(NSM_PLUGIN_ABI_VERSION) : nullptr;
+        if (!list) {
+            std::fprintf(stderr, "plugins: %s: no probe types for ABI %u\n", path.c_str(), NSM_PLUGIN_ABI_VERSION);
+            dlclose(h);
+            return;
+        }
+        for (; *list; ++list) {
+            const nsm_probe_type* t = *list;
+            if (t->abi_version != NSM_PLUGIN_ABI_VERSION || !t->name || !t->init || !t->start ||
+                !t->poll_fd || !t->complete || !t->destroy) {
+                std::fprintf(stderr, "plugins: %s: skipping incompatible type '%s'\n", path.c_str(), t->name ? t->name : "?");
+                continue;
+            }
+            if (find(t->name) || std::strcmp(t->name, "script") == 0 || std::strcmp(t->name, "nagios") == 0) {
+                std::fprintf(stderr, "plugins: %s: duplicate type '%s'\n", path.c_str(), t->name);
+                continue;
+            }
+            types_.push_back(t);
+            std::fprintf(stderr, "plugins: type '%s' from %s\n", t->name, path.c_str());
+        }
+    }
+};
+
+static PluginRegistry g_plugins;
+
+void load_plugins(const std::string& dir) { g_plugins.load_dir(dir); }
+
+std::string default_plugin_dir() { return NSM_PLUGIN_DIR; }
+
+// ----- Configuration file -----
+//
+// INI-style text (syntax in netserialmon.h), re-read by the application whenever
+// the file changes on disk. Without a file the built-in network and serial probes
+// are used.
+Config default_config() {
+    Config cfg;
+    cfg.probes.resize(2);
+    cfg.probes[0].name = "network";
+    cfg.probes[0].script = "test_network.sh";
+    cfg.probes[1].name = "serial";
+    cfg.probes[1].script = "test_serial.sh";
+    return cfg;
+}
+
+std::string default_config_path() {
+    if (const char* x = std::getenv("XDG_CONFIG_HOME"); x && *x) return std::string(x) + "/net-serial-monitor.conf";
+    if (const char* h = std::getenv("HOME"); h && *h) return std::string(h) + "/.config/net-serial-monitor.conf";
+    return "net-serial-monitor.conf";
+}
+
+// "HOST:PORT", an IPv6 address in brackets ("[fd00::17]:7010")
+static bool parse_address(const std::string& val, std::string& host, int& port) {
+    const std::size_t colon = val.rfind(':');
+    if (colon == std::string::npos || colon == 0) return false;
+    host = val.substr(0, colon);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    port = std::atoi(val.c_str() + colon + 1);
+    return port >= 1 && port <= 65535;
+}
+
+bool load_config(const std::string& path, Config& cfg, bool* missing) {
+    std::ifstream in(path);
+    if (missing) *missing = !in;
+    if (!in) return false;
+
+    auto trim = [](std::string t) {
+        const char* ws = " \t\r\n";
+        t.erase(0, t.find_first_not_of(ws));
+        t.erase(t.find_last_not_of(ws) + 1);
+        return t;
+    };
+    auto fail = [&](int lineno, const std::string& what) {
+        if (lineno > 0) std::fprintf(stderr, "%s:%d: %s; keeping current configuration\n", path.c_str(), lineno, what.c_str());
+        else            std::fprintf(stderr, "%s: %s; keeping current configuration\n", path.c_str(), what.c_str());
+        return false;
+    };
+
+    Config out;
+    enum { None, Layout, ProbeSection, BatchSection, HookSection, ChildSection, ClusterSection } section = None;
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        ++lineno;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+
+        if (line.front() == '[') {
+            if (line.back() != ']') return fail(lineno, "unterminated section header");
+            std::string sec = trim(line.substr(1, line.size() - 2));
+            if (sec == "layout") {
+                section = Layout;
+            } else if (sec == "cluster") {
+                section = ClusterSection;
+            } else if (sec.compare(0, 6, "probe ") == 0) {
+                std::string name = trim(sec.substr(6));
+                if (name.empty()) return fail(lineno, "probe section without a name");
+                for (const auto& p : out.probes)
+                    if (p.name == name) return fail(lineno, "duplicate probe name");
+                out.probes.emplace_back();
+                out.probes.back().name = name;
+                section = ProbeSection;
+            } else if (sec.compare(0, 6, "batch ") == 0) {
+                std::string name = trim(sec.substr(6));
+                if (name.empty()) return fail(lineno, "batch section without a name");
+                for (const auto& b : out.batches)
+                    if (b.name == name) return fail(lineno, "duplicate batch name");
+                out.batches.emplace_back();
+                out.batches.back().name = name;
+                out.batches.back().type = ProbeType::Batch;
+                section = BatchSection;
+            } else if (sec.compare(0, 5, "hook ") == 0) {
+                std::string name = trim(sec.substr(5));
+                if (name.empty()) return fail(lineno, "hook section without a name");
+                for (const auto& h : out.hooks)
+                    if (h.name == name) return fail(lineno, "duplicate hook name");
+                out.hooks.emplace_back();
+                out.hooks.back().name = name;
+                section = HookSection;
+            } else if (sec.compare(0, 6, "child ") == 0) {
+                std::string name = trim(sec.substr(6));
+                if (name.empty() || name.find('/') != std::string::npos)
+                    return fail(lineno, "child section needs a name without '/'");
+                for (const auto& c : out.children)
+                    if (c.name == name) return fail(lineno, "duplicate child name");
+                out.children.emplace_back();
+                out.children.back().name = name;
+                section = ChildSection;
+            } else {
+                return fail(lineno, "unknown section");
+            }
+            continue;
+        }
+
+        auto eq = line.find('=');
+        if (eq == std::string::npos) return fail(lineno, "expected key = value");
+        const std::string key = trim(line.substr(0, eq));
+        const std::string val = trim(line.substr(eq + 1));
+        const int num = std::atoi(val.c_str());
+        if (section == ProbeSection) {
+            ProbeConfig& p = out.probes.back();
+            if      (key == "type" && val == "script") p.type = ProbeType::Script;
+            else if (key == "type" && val == "nagios") p.type = ProbeType::Nagios;
+            else if (key == "type" && val == "passive") p.type = ProbeType::Passive;
+            else if (key == "type" && g_plugins.find(val)) { p.type = ProbeType::Plugin; p.plugin = val; }
+            else if (key == "type")           return fail(lineno, "unknown probe type");
+            else if (key == "script")         p.script = val;
+            else if (key == "args")           p.args = val;
+            else if (key == "batch")          p.batch = val;
+            else if (key == "group")          p.group = val;
+            else if (key == "interval_ms")    p.interval_ms = std::max(num, 100);
+            else if (key == "timeout_ms")     p.timeout_ms = std::max(num, 0);
+            else if (key == "fail_threshold") p.fail_threshold = std::max(num, 1);
+            else if (key == "stale_after_ms") p.stale_after_ms = std::max(num, 0);
+            else if (key == "match_ok")       p.match_ok = val;
+            else if (key == "match_fail")     p.match_fail = val;
+            else if (key == "metric")         p.metric = val;
+            else if (key == "ignore_exit")    p.ignore_exit = num != 0;
+            else if (key == "shared")         p.shared = num != 0;
+            else return fail(lineno, "unknown probe key");
+        } else if (section == BatchSection) {
+            ProbeConfig& b = out.batches.back();
+            if      (key == "script")      b.script = val;
+            else if (key == "args")        b.args = val;
+            else if (key == "interval_ms") b.interval_ms = std::max(num, 100);
+            else if (key == "timeout_ms")  b.timeout_ms = std::max(num, 0);
+            else return fail(lineno, "unknown batch key");
+        } else if (section == HookSection) {
+            HookConfig& h = out.hooks.back();
+            std::istringstream words(val);
+            std::string w;
+            if      (key == "command")         h.command = val;
+            else if (key == "args")            h.args = val;
+            else if (key == "batch_ms")        h.batch_ms = std::max(num, 0);
+            else if (key == "min_interval_ms") h.min_interval_ms = std::max(num, 0);
+            else if (key == "timeout_ms")      h.timeout_ms = std::max(num, 0);
+            else if (key == "probes")          for (h.probes.clear(); words >> w;) h.probes.push_back(w);
+            else if (key == "on") {
+                h.on.clear();
+                for (ProbeState st; words >> w; h.on.push_back(st))
+                    if (!parse_status(w.c_str(), st)) return fail(lineno, "unknown state '" + w + "'");
+            }
+            else return fail(lineno, "unknown hook key");
+        } else if (section == ChildSection) {
+            ChildConfig& c = out.children.back();
+            if (key == "address") {
+                if (!parse_address(val, c.host, c.port)) return fail(lineno, "address must be HOST:PORT");
+            }
+            else return fail(lineno, "unknown child key");
+        } else if (section == ClusterSection) {
+            ClusterConfig& c = out.cluster;
+            std::istringstream words(val);
+            std::string w, host;
+            int port;
+            if      (key == "name")          c.name = val;
+            else if (key == "heartbeat_ms")  c.heartbeat_ms = std::max(num, 100);
+            else if (key == "dead_after_ms") c.dead_after_ms = std::max(num, 300);
+            else if (key == "listen") {
+                if (val.find(':') == std::string::npos) c.listen_port = num;
+                else if (!parse_address(val, c.listen_host, c.listen_port)) return fail(lineno, "listen must be [HOST:]PORT");
+                if (c.listen_port < 1 || c.listen_port > 65535) return fail(lineno, "bad port");
+            }
+            else if (key == "peers") {
+                for (c.peers.clear(); words >> w; c.peers.push_back(w))
+                    if (!parse_address(w, host, port)) return fail(lineno, "peer '" + w + "' is not HOST:PORT");
+            }
+            else return fail(lineno, "unknown cluster key");
+        } else if (section == Layout) {
+            if      (key == "slots")        out.layout.slots = std::max(num, 0);
+            else if (key == "max_diameter") out.layout.max_diameter = std::max(num, 20);
+            else return fail(lineno, "unknown layout key");
+        } else {
+            return fail(lineno, "key outside of a section");
+        }
+    }
+    // An empty file is most likely caught half-written; never blank the display for it.
+    if (out.probes.empty() && out.children.empty()) return fail(0, "no probes defined");
+    for (const auto& b : out.batches)
+        if (b.script.empty()) return fail(0, "batch '" + b.name + "' has no script");
+    for (const auto& h : out.hooks)
+        if (h.command.empty()) return fail(0, "hook '" + h.name + "' has no command");
+    for (const auto& c : out.children)
+        if (c.host.empty()) return fail(0, "child '" + c.name + "' has no address");
+    if (out.cluster.listen_port == 0 && !out.cluster.peers.empty()) return fail(0, "cluster has peers but no listen port");
+    for (const auto& p : out.probes)
+        if (p.shared && (!p.batch.empty() || p.type == ProbeType::Passive))
+            return fail(0, "probe '" + p.name + "': only probes that run themselves can be shared");
+    for (auto& p : out.probes) {
+        if (!p.batch.empty()) {
+            if (!p.script.empty()) return fail(0, "probe '" + p.name + "' has both a script and a batch");
+            if (std::none_of(out.batches.begin(), out.batches.end(), [&](const ProbeConfig& b) { return b.name == p.batch; }))
+                return fail(0, "probe '" + p.name + "' refers to unknown batch '" + p.batch + "'");
+            continue;
+        }
+        if (p.type == ProbeType::Passive) {
+            if (!p.script.empty()) return fail(0, "probe '" + p.name + "' is passive and takes no script");
+            if (!p.match_ok.empty() || !p.match_fail.empty() || !p.metric.empty())
+                return fail(0, "probe '" + p.name + "': output matchers need a script");
+            continue;
+        }
+        if (p.type == ProbeType::Plugin) {
+            if (!p.script.empty()) return fail(0, "probe '" + p.name + "' is a plugin and takes no script");
+            if (!p.match_ok.empty() || !p.match_fail.empty() || !p.metric.empty())
+                return fail(0, "probe '" + p.name + "': output matchers need a script");
+            continue;
+        }
+        if (p.script.empty()) return fail(0, "probe '" + p.name + "' has no script");
+        if (p.match_ok.empty() && p.match_fail.empty() && p.metric.empty()) continue;
+        auto m = std::make_shared<OutputMatchers>();
+        std::string err;
+        if (!p.match_ok.empty() && !m->ok.compile(p.match_ok, true, err))
+            return fail(0, "probe '" + p.name + "': match_ok: " + err);
+        if (!p.match_fail.empty() && !m->fail.compile(p.match_fail, true, err))
+            return fail(0, "probe '" + p.name + "': match_fail: " + err);
+        if (!p.metric.empty() && !m->compile_metric(p.metric, err))
+            return fail(0, "probe '" + p.name + "': metric: " + err);
+        p.matchers = std::move(m);
+    }
+
+    cfg = std::move(out);
+    return true;
+}
+
+// ----- Result statistics of one probe (the table view's columns) -----
+// Written only by the thread that publishes the probe's results (its own worker,
+// or its batch runner's); read through the atomics by snapshots.
+class ResultStats {
+public:
+    static constexpr int kWindow = 128;     // metric samples the p99 is taken over
+
+    void record(ProbeState st, double metric) {
+        if (st != ProbeState::Unknown) {
+            total_.fetch_add(1, std::memory_order_relaxed);
+            if (st != ProbeState::Fail) up_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (std::isnan(metric)) return;
+        // A shared probe's worker and the cluster thread can both record around an
+        // ownership change, so the ring is locked; it is never contended otherwise.
+        std::lock_guard<std::mutex> lk(mu_);
+        // A ring that wraps at kWindow and a fill count that stops there: a busy
+        // passive probe records far more than INT_MAX results in its lifetime.
+        samples_[next_] = metric;
+        next_ = (next_ + 1) % kWindow;
+        if (filled_ < kWindow) ++filled_;
+        const int n = static_cast<int>(filled_);
+        double sorted[kWindow];
+        std::copy(samples_, samples_ + n, sorted);
+        const int k = (n * 99 + 99) / 100 - 1;     // nearest rank
+        std::nth_element(sorted, sorted + k, sorted + n);
+        p99_.store(sorted[k]);
+    }
+    void changed() { last_change_.store(static_cast<long long>(std::time(nullptr))); }
+
+    // Share of results that were not failures; NAN before the first one.
+    double availability() const {
+        const unsigned long long total = total_.load(std::memory_order_relaxed);
+        return total ? static_cast<double>(up_.load(std::memory_order_relaxed)) / total : NAN;
+    }
+    double p99() const { return p99_.load(); }
+    long long last_change() const { return last_change_.load(); }
+
+private:
+    std::atomic<unsigned long long> total_{0}, up_{0};
+    std::atomic<double> p99_{NAN};
+    std::atomic<long long> last_change_{0};
+    std::mutex mu_;                     // guards the ring below
+    double samples_[kWindow];
+    unsigned next_ = 0;                 // ring slot the next metric goes to
+    unsigned filled_ = 0;               // samples in the ring, up to kWindow
+};
+
+// ----- One configured probe and its worker -----
+struct HistorySeries;
+
+struct Probe {
+    ProbeConfig cfg;                    // name/script/args never change for a live probe
+    int script_id = -1;
+    std::atomic<int> interval_ms{2000};
+    std::atomic<int> timeout_ms{0};
+    std::atomic<int> fail_threshold{1};
+    std::atomic<int> stale_after_ms{0};
+    std::atomic<ProbeState> state{ProbeState::Unknown};
+    std::atomic<bool> stale{false};     // state restored from the last run, not yet refreshed
+    std::atomic<bool> active{true};     // cleared to stop the worker
+    std::atomic<bool> owned{true};      // shared probes: this cluster member runs it
+    std::atomic<long long> first_result{0};   // boottime_us() of the first published result
+    std::atomic<double> metric{NAN};    // headline number: metric matcher, else first perfdata value
+    static constexpr int kMaxPerf = ProbeView::kMaxPerf;
+    mutable std::mutex perf_mu;         // perf/perf_count: written by the worker after each run
+    PerfMetric perf[kMaxPerf];
+    int perf_count = 0;
+    PerfCollector perf_text;            // nagios probes: perfdata of the run being drained
+    std::unique_ptr<BatchCollector> batch;    // batch runners: members and their results
+    const nsm_probe_type* plugin = nullptr;   // plugin probes: type and instance
+    void* plugin_inst = nullptr;
+    OutputRing output;                  // last runs' stdout/stderr, for the failure view
+    ResultStats stats;
+    RunCapture capture;                 // the run currently being drained by the reactor
+    std::atomic<long long> last_push_ms{0};     // passive probes: steady clock of the last result
+    int passive_failures = 0;           // passive probes: consecutive, for fail_threshold (reactor only)
+    FaultInjector faults;
+    std::shared_ptr<HistorySeries> history;     // null unless Options::history_dir is set
+    std::thread worker;
+
+    Probe() { capture.ring = &output; }
+    ~Probe() { if (plugin_inst) plugin->destroy(plugin_inst); }
+
+    // Called once, before the worker starts.
+    void configure(const ProbeConfig& c) {
+        cfg = c;
+        capture.matchers = cfg.matchers.get();
+        capture.perf = cfg.type == ProbeType::Nagios ? &perf_text : nullptr;
+        tune(c);
+        // A passive probe's freshness runs from its creation until the first push.
+        last_push_ms.store(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void tune(const ProbeConfig& c) {
+        cfg.interval_ms = c.interval_ms;
+        cfg.timeout_ms = c.timeout_ms;
+        cfg.fail_threshold = c.fail_threshold;
+        cfg.stale_after_ms = c.stale_after_ms;
+        interval_ms.store(c.interval_ms);
+        timeout_ms.store(c.timeout_ms);
+        fail_threshold.store(c.fail_threshold);
+        stale_after_ms.store(c.stale_after_ms);
+    }
+};
+
+// ----- Engine state shared by the workers and the Monitor accessors -----
+class HookRunner;
+class ChildLink;
+class Cluster;
+class HistoryWriter;
+
+struct AppState {
+    // Replaced by config reloads and read by snapshots. Workers only touch their own
+    // Probe and never take this lock.
+    std::mutex probes_mu;
+    std::vector<std::unique_ptr<Probe>> probes;     // display order
+    std::vector<std::unique_ptr<Probe>> batches;    // batch runners feeding some of the probes
+    std::atomic<int> layout_slots{3};
+    std::atomic<int> layout_max_diameter{100};
+
+    // Passive probes by name (views of their cfg.name), rebuilt with probes; the
+    // reactor takes passive_mu once per batch of pushed datagrams.
+    std::mutex passive_mu;
+    std::unordered_map<std::string_view, Probe*> passive;
+
+    // Transition hooks; publish_state() takes hooks_mu only when a state changes.
+    std::mutex hooks_mu;
+    std::vector<std::unique_ptr<HookRunner>> hooks;
+
+    // Child monitors, shown after the probes; taken after probes_mu by snapshots.
+    std::mutex children_mu;
+    std::vector<std::unique_ptr<ChildLink>> children;
+
+    // Cooperative probing, if configured; shared indexes the shared probes by name
+    // (views of their cfg.name) for results arriving from other members.
+    std::mutex cluster_mu;
+    std::unique_ptr<Cluster> cluster;
+    std::mutex shared_mu;
+    std::unordered_map<std::string_view, Probe*> shared;
+
+    // Result history, if Options::history_dir is set; lives as long as the Monitor.
+    HistoryWriter* history = nullptr;
+
+    // Bumped on every visible state change; waiters sleep on changed.
+    std::atomic<unsigned> generation{0};
+    std::mutex change_mu;
+    std::condition_variable changed;
+
+    // Change notification for library users (Monitor::subscribe / change_fd)
+    int event_fd = -1;
+    std::mutex subs_mu;
+    std::vector<std::pair<int, std::function<void(unsigned)>>> subs;
+    int next_sub = 1;
+
+    std::atomic<long long> first_spawn{0};
+
+    // Self-metrics, bumped with relaxed atomics on the hot paths
+    std::atomic<unsigned long long> results{0};     // published probe results
+    std::atomic<unsigned long long> spawns{0};      // script processes started
+    std::atomic<unsigned long long> cycles{0};      // worker loop iterations
+    std::atomic<unsigned long long> passive_results{0}, passive_ignored{0};
+    std::atomic<unsigned long long> child_updates{0}, child_bytes{0};
+    std::atomic<unsigned long long> peer_results{0}, peer_sent{0};
+};
+
+// ----- Transition hooks: rate-limited, batched runs of a command -----
+//
+// publish_state() hands every state change to each hook that wants the probe.
+// A hook keeps at most one pending entry per probe (the state last reported and
+// the current one), so an outage of 200 probes is one run with 200 lines, and a
+// probe that flaps back before the run drops out. Its thread waits batch_ms
+// after the first change to collect the rest, never runs more often than
+// min_interval_ms, and feeds the lines to the command's stdin through a memfd.
+class HookRunner {
+public:
+    HookRunner(AppState& s, Reactor& reactor, const HookConfig& c) : cfg(c), s_(s), reactor_(reactor) {
+        capture_.ring = &output_;
+        pending_.reserve(kMaxPending);      // queue() runs inside workers' allocation-free cycles
+    }
+    HookRunner(const HookRunner&) = delete;
+    HookRunner& operator=(const HookRunner&) = delete;
+    ~HookRunner() { stop(); }
+
+    const HookConfig cfg;
+
+    void start() { thread_ = std::thread([this] { run(); }); }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stopping_ = true;
+        }
+        active_.store(false);
+        cv_.notify_all();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    bool wants(const std::string& probe) const {
+        return cfg.probes.empty() || std::find(cfg.probes.begin(), cfg.probes.end(), probe) != cfg.probes.end();
+    }
+
+    // From publish_state(), on the thread that published.
+    void queue(const std::string& probe, ProbeState from, ProbeState to, double metric) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = std::find_if(pending_.begin(), pending_.end(),
+                               [&](const Pending& p) { return std::strcmp(p.name, probe.c_str()) == 0; });
+        if (it != pending_.end()) {
+            // A first result that changes again before the run: the first state is the baseline.
+            if (it->from == ProbeState::Unknown) it->from = it->to;
+            it->to = to;
+            it->metric = metric;
+        } else if (pending_.size() < kMaxPending) {
+            if (pending_.empty()) first_at_ = std::chrono::steady_clock::now();
+            pending_.emplace_back();
+            Pending& p = pending_.back();
+            std::snprintf(p.name, sizeof(p.name), "%s", probe.c_str());
+            p.from = from;
+            p.to = to;
+            p.metric = metric;
+        } else {
+            ++dropped_;
+            return;
+        }
+        cv_.notify_all();
+    }
+
+private:
+    static constexpr std::size_t kMaxPending = 512;     // probes with a change waiting; more are dropped
+
+    struct Pending {
+        char name[128];
+        ProbeState from, to;        // as of the first and the latest queued change
+        double metric;
+    };
+
+    AppState& s_;
+    Reactor& reactor_;
+    std::mutex mu_;                 // guards pending_, first_at_, dropped_, stopping_
+    std::condition_variable cv_;
+    std::vector<Pending> pending_;
+    std::chrono::steady_clock::time_point first_at_;
+    unsigned long long dropped_ = 0;
+    bool stopping_ = false;
+    std::atomic<bool> active_{true};    // cleared to kill a running command
+    std::map<std::string, ProbeState> reported_;    // hook thread only: last state each probe was reported in
+    OutputRing output_;
+    RunCapture capture_;
+    std::thread thread_;
+
+    void run() {
+        using clock = std::chrono::steady_clock;
+        clock::time_point last_run = clock::now() - std::chrono::milliseconds(cfg.min_interval_ms);
+        std::string text;
+        std::vector<Pending> batch;
+        batch.reserve(kMaxPending);
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;) {
+            cv_.wait(lk, [&] { return stopping_ || !pending_.empty(); });
+            if (stopping_) return;
+            const clock::time_point due = std::max(first_at_ + std::chrono::milliseconds(cfg.batch_ms),
+                                                   last_run + std::chrono::milliseconds(cfg.min_interval_ms));
+            if (cv_.wait_until(lk, due, [&] { return stopping_; })) return;
+            batch.swap(pending_);
+            pending_.clear();
+            const unsigned long long dropped = dropped_;
+            dropped_ = 0;
+            lk.unlock();
+
+            text.clear();
+            int lines = 0;
+            for (const Pending& p : batch) {
+                auto it = reported_.find(p.name);
+                if (it == reported_.end()) {
+                    // A probe's first known state is the baseline, not a change.
+                    if (p.from == ProbeState::Unknown) {
+                        reported_.emplace(p.name, p.to);
+                        continue;
+                    }
+                    it = reported_.emplace(p.name, p.from).first;
+                }
+                if (p.to == it->second) continue;       // flapped back
+                const ProbeState was = it->second;
+                it->second = p.to;
+                if (std::find(cfg.on.begin(), cfg.on.end(), p.to) == cfg.on.end()) continue;
+                char line[192];
+                const int n = std::isnan(p.metric)
+                    ? std::snprintf(line, sizeof(line), "%s %s %s\n", p.name, state_name(was), state_name(p.to))
+                    : std::snprintf(line, sizeof(line), "%s %s %s %g\n", p.name, state_name(was),
+                                    state_name(p.to), p.metric);
+                text.append(line, std::min<std::size_t>(static_cast<std::size_t>(std::max(n, 0)), sizeof(line) - 1));
+                ++lines;
+            }
+            if (dropped)
+                std::fprintf(stderr, "hook %s: queue full, %llu change(s) dropped\n", cfg.name.c_str(), dropped);
+            if (lines) {
+                last_run = clock::now();
+                execute(text, lines);
+            }
+            batch.clear();
+            lk.lock();
+        }
+    }
+
+    void execute(const std::string& text, int lines) {
+        const int in = memfd_create("nsm-hook", MFD_CLOEXEC);
+        if (in < 0 || write(in, text.data(), text.size()) != static_cast<ssize_t>(text.size()) ||
+            lseek(in, 0, SEEK_SET) != 0) {
+            std::fprintf(stderr, "hook %s: cannot pass changes: %s\n", cfg.name.c_str(), std::strerror(errno));
+            if (in >= 0) close(in);
+            return;
+        }
+        char cmd[PATH_MAX * 2];
+        build_command(cmd, sizeof(cmd), cfg.command.c_str(), cfg.args.c_str());
+        output_.begin_run();
+        s_.spawns.fetch_add(1, std::memory_order_relaxed);
+        bool timed_out = false;
+        const int status = run_probe_process(reactor_, capture_, cmd, cfg.timeout_ms, active_, timed_out, in);
+        const int err = errno;
+        close(in);
+        char what[96];
+        if (status < 0)               std::snprintf(what, sizeof(what), "spawn failed: %s", std::strerror(err));
+        else if (timed_out)           std::snprintf(what, sizeof(what), "timeout after %d ms", cfg.timeout_ms);
+        else if (WIFSIGNALED(status)) std::snprintf(what, sizeof(what), "killed by signal %d", WTERMSIG(status));
+        else                          std::snprintf(what, sizeof(what), "exit %d", WEXITSTATUS(status));
+        const bool failed = status < 0 || timed_out || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        output_.end_run(failed, what);
+        if (!failed) return;
+        // Nobody else sees a hook's output; a failed run goes to stderr with it.
+        std::string report;
+        output_.last_failure(report);
+        std::fprintf(stderr, "hook %s: %d change(s) not delivered: %s", cfg.name.c_str(), lines, report.c_str());
+    }
+};
+
+// Hand a state change to each hook that wants the probe.
+static void queue_hooks(AppState& s, const std::string& name, ProbeState from, ProbeState to, double metric) {
+    std::lock_guard<std::mutex> lk(s.hooks_mu);
+    for (auto& h : s.hooks)
+        if (h->wants(name)) h->queue(name, from, to, metric);
+}
+
+// Bump the generation and tell everyone: condvar waiters (the state saver), the
+// change fd and subscribers, on the calling thread.
+static void notify_change(AppState& s) {
+    unsigned gen;
+    {
+        // Bump under the lock so a waiter cannot miss it between its check and its wait.
+        std::lock_guard<std::mutex> lk(s.change_mu);
+        gen = s.generation.fetch_add(1) + 1;
+    }
+    s.changed.notify_all();
+    if (s.event_fd >= 0) {
+        const std::uint64_t one = 1;
+        (void)!write(s.event_fd, &one, sizeof(one));
+    }
+    std::lock_guard<std::mutex> lk(s.subs_mu);
+    for (auto& sub : s.subs) sub.second(gen);
+}
+
+// Store a probe result and wake anyone waiting for state changes.
+static void publish_state(AppState& s, Probe& p, ProbeState st) {
+    const bool was_stale = p.stale.exchange(false);
+    const ProbeState prev = p.state.exchange(st);
+    if (prev != st) {
+        p.stats.changed();
+        queue_hooks(s, p.cfg.name, prev, st, p.metric.load());
+    }
+    if (prev == st && !was_stale) return;
+    notify_change(s);
+}
+
+// ----- Last-known state, persisted across restarts -----
+//
+// A small text file ("name<TAB>state<TAB>script<TAB>args" per line) is rewritten
+// atomically (temp file + rename) shortly after any change. At startup it seeds
+// probes whose script and args still match, marked stale until their first real
+// result, so a restart shows the previous picture instead of a wall of gray.
+struct SavedProbe {
+    std::string name, script, args;
+    ProbeState state = ProbeState::Unknown;
+};
+
+std::string default_state_path() {
+    if (const char* x = std::getenv("XDG_STATE_HOME"); x && *x) return std::string(x) + "/net-serial-monitor.state";
+    if (const char* h = std::getenv("HOME"); h && *h) return std::string(h) + "/.local/state/net-serial-monitor.state";
+    return std::string();
+}
+
+static std::vector<SavedProbe> load_state(const std::string& path) {
+    std::vector<SavedProbe> out;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::stringstream ss(line);
+        SavedProbe sp;
+        std::string st;
+        if (!std::getline(ss, sp.name, '\t') || !std::getline(ss, st, '\t') ||
+            !std::getline(ss, sp.script, '\t')) continue;
+        std::getline(ss, sp.args);
+        sp.state = state_from_name(st);
+        if (sp.state != ProbeState::Unknown) out.push_back(std::move(sp));
+    }
+    return out;
+}
+
+bool write_file_atomic(const std::string& path, const std::string& data) {
+    const std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+    ok = (fsync(fd) == 0) && ok;
+    ok = (close(fd) == 0) && ok;
+    if (ok && std::rename(tmp.c_str(), path.c_str()) == 0) return true;
+    unlink(tmp.c_str());
+    return false;
+}
+
+class StateSaver {
+public:
+    StateSaver(AppState& s, std::string path) : s_(s), path_(std::move(path)) {}
+    StateSaver(const StateSaver&) = delete;
+    StateSaver& operator=(const StateSaver&) = delete;
+    ~StateSaver() { stop(); }
+
+    void start() {
+        if (path_.empty()) return;
+        // Create the parent directories (~/.local/state is often missing).
+        for (std::size_t pos = path_.find('/', 1); pos != std::string::npos; pos = path_.find('/', pos + 1))
+            mkdir(path_.substr(0, pos).c_str(), 0755);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    // Writes once more if anything changed since the last save.
+    void stop() {
+        if (!thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(s_.change_mu);
+            stopping_ = true;
+        }
+        s_.changed.notify_all();
+        thread_.join();
+    }
+
+private:
+    static constexpr auto kMinInterval = std::chrono::seconds(1);   // spare the SD card
+
+    AppState& s_;
+    std::string path_;
+    std::thread thread_;
+    bool stopping_ = false;         // guarded by s_.change_mu
+
+    void save() {
+        std::string data;
+        {
+            std::lock_guard<std::mutex> lk(s_.probes_mu);
+            for (const auto& p : s_.probes) {
+                const ProbeState st = p->state.load();
+                if (st == ProbeState::Unknown) continue;
+                data += p->cfg.name + '\t' + state_name(st) + '\t' +
+                        p->cfg.script + '\t' + p->cfg.args + '\n';
+            }
+        }
+        if (!write_file_atomic(path_, data))
+            std::fprintf(stderr, "state: cannot write %s: %s\n", path_.c_str(), std::strerror(errno));
+    }
+
+    void run() {
+        unsigned saved = s_.generation.load();
+        std::unique_lock<std::mutex> lk(s_.change_mu);
+        for (;;) {
+            s_.changed.wait(lk, [&] { return stopping_ || s_.generation.load() != saved; });
+            const bool last = stopping_;
+            if (s_.generation.load() != saved) {
+                saved = s_.generation.load();
+                lk.unlock();
+                save();
+                lk.lock();
+            }
+            if (last) break;
+            s_.changed.wait_for(lk, kMinInterval, [&] { return stopping_; });
+        }
+    }
+};
+
+// ----- Result history, compressed on disk (history.h) -----
+//
+// Each probe's results go into a block in memory on whichever thread publishes
+// them. A block is sealed when it is full or kHistoryBlockMs old and handed to
+// the history writer, which appends it to the probe's file. Handing over copies
+// into a buffer reserved up front, so publishing neither allocates nor waits for
+// the SD card; a power cut loses at most the blocks still in memory. If the
+// writer stalls until that buffer is full, the oldest block waiting is dropped
+// and counted (EngineCounters::history_dropped).
+constexpr unsigned kHistorySamples = 1024;
+constexpr std::size_t kHistoryBlockBytes = 4096;    // payload; about 1000 samples of a steady probe
+constexpr long long kHistoryBlockMs = 15 * 60 * 1000;
+constexpr std::size_t kHistoryMaxBlock = HistoryEncoder::kHeader + kHistoryBlockBytes + HistoryEncoder::kFooter;
+constexpr std::size_t kHistoryPending = 2 * kHistoryMaxBlock;     // bytes of sealed blocks per probe
+
+static long long wall_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+struct HistorySeries {
+    HistorySeries(HistoryWriter& w, std::string p)
+        : writer(w), path(std::move(p)), open(kHistorySamples, kHistoryBlockBytes) {
+        sealed.reserve(kHistoryPending);
+    }
+
+    HistoryWriter& writer;
+    const std::string path;
+    std::mutex io_mu;                   // held while the file is written or read
+    std::mutex mu;                      // guards the rest
+    HistoryEncoder open;
+    long long opened_ms = 0;            // wall_ms() of the open block's first sample
+    std::vector<unsigned char> sealed;  // whole blocks waiting for the writer, at most kHistoryPending bytes
+    unsigned dropped = 0;               // blocks dropped from sealed since the writer last looked
+
+    // Returns true if a block was sealed: the caller wakes the writer.
+    bool append(ProbeState st, double metric) {
+        const HistorySample sample{wall_ms(), st, metric};
+        std::lock_guard<std::mutex> lk(mu);
+        bool sealed_one = false;
+        if (open.count() && sample.t_ms - opened_ms >= kHistoryBlockMs) sealed_one = seal_locked();
+        if (!open.append(sample)) {
+            sealed_one = seal_locked();
+            open.append(sample);
+        }
+        if (open.count() == 1) opened_ms = sample.t_ms;
+        return sealed_one;
+    }
+
+    bool seal_locked() {
+        if (!open.count()) return false;
+        std::size_t len;
+        const unsigned char* block = open.seal(len);
+        while (!sealed.empty() && sealed.size() + len > kHistoryPending) {
+            const unsigned char* b = sealed.data();
+            const std::size_t payload = b[4] | b[5] << 8 | b[6] << 16 | static_cast<std::size_t>(b[7]) << 24;
+            sealed.erase(sealed.begin(), sealed.begin() + static_cast<std::ptrdiff_t>(
+                HistoryEncoder::kHeader + payload + HistoryEncoder::kFooter));
+            ++dropped;
+        }
+        sealed.insert(sealed.end(), block, block + len);
+        open.reset();
+        return true;
+    }
+};
+
+class HistoryWriter {
+public:
+    HistoryWriter(std::string dir, std::size_t keep_bytes) : dir_(std::move(dir)), keep_(keep_bytes) {
+        buf_.reserve(kHistoryPending);
+    }
+    HistoryWriter(const HistoryWriter&) = delete;
+    HistoryWriter& operator=(const HistoryWriter&) = delete;
+    ~HistoryWriter() { stop(); }
+
+    void start() {
+        if (thread_.joinable()) return;
+        for (std::size_t pos = dir_.find('/', 1); pos != std::string::npos; pos = dir_.find('/', pos + 1))
+            mkdir(dir_.substr(0, pos).c_str(), 0755);
+        mkdir(dir_.c_str(), 0755);
+        stopping_ = false;
+        thread_ = std::thread([this] { run(); });
+    }
+
+    // Seals and writes everything still in memory.
+    void stop() {
+        if (!thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    // The series of the probe called name; a probe replaced under the same name
+    // continues the same series.
+    std::shared_ptr<HistorySeries> series(const std::string& name) {
+        const std::string path = history_file(dir_, name);
+        std::lock_guard<std::mutex> lk(mu_);
+        for (const auto& h : series_)
+            if (h->path == path) return h;
+        series_.push_back(std::make_shared<HistorySeries>(*this, path));
+        return series_.back();
+    }
+
+    void wake() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            pending_ = true;
+        }
+        cv_.notify_one();
+    }
+
+    // Blocks lost because the writer fell behind.
+    unsigned long long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    bool read(const std::string& name, const HistoryQuery& q, std::vector<HistorySample>& out,
+              HistoryScanStats* stats) {
+        const std::string path = history_file(dir_, name);
+        std::shared_ptr<HistorySeries> h;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (const auto& c : series_)
+                if (c->path == path) h = c;
+        }
+        if (!h) return read_history(path, q, out, stats);
+        std::lock_guard<std::mutex> io(h->io_mu);
+        read_history(path, q, out, stats);
+        // Then what has not reached the file: sealed blocks, and the open one.
+        std::lock_guard<std::mutex> lk(h->mu);
+        constexpr std::size_t head = HistoryEncoder::kHeader, foot = HistoryEncoder::kFooter;
+        for (std::size_t off = 0; off + head + foot <= h->sealed.size();) {
+            const unsigned char* b = h->sealed.data() + off;
+            const std::size_t len = b[4] | b[5] << 8 | b[6] << 16 | static_cast<std::size_t>(b[7]) << 24;
+            const unsigned char* f = b + head + len;
+            decode_history(b + head, len, f[0] | f[1] << 8 | f[2] << 16 | static_cast<unsigned>(f[3]) << 24, q, out);
+            off += head + len + foot;
+        }
+        if (h->open.count()) {
+            std::size_t len;
+            const unsigned char* b = h->open.seal(len);
+            decode_history(b + head, len - head - foot, h->open.count(), q, out);
+        }
+        return true;
+    }
+
+private:
+    static constexpr auto kSweep = std::chrono::seconds(60);    // for blocks of probes gone quiet
+
+    std::string dir_;
+    std::size_t keep_;
+    std::thread thread_;
+    std::mutex mu_;                     // guards series_, pending_, stopping_
+    std::condition_variable cv_;
+    std::vector<std::shared_ptr<HistorySeries>> series_;
+    bool pending_ = false, stopping_ = false;
+    std::vector<unsigned char> buf_;    // writer thread only
+    std::atomic<unsigned long long> dropped_{0};
+
+    void flush(HistorySeries& h, bool all, long long now) {
+        std::lock_guard<std::mutex> io(h.io_mu);
+        unsigned dropped;
+        {
+            std::lock_guard<std::mutex> lk(h.mu);
+            if (all || (h.open.count() && now - h.opened_ms >= kHistoryBlockMs)) h.seal_locked();
+            buf_.swap(h.sealed);
+            dropped = h.dropped;
+            h.dropped = 0;
+        }
+        if (dropped) {
+            dropped_.fetch_add(dropped, std::memory_order_relaxed);
+            std::fprintf(stderr, "history: %s: %u block(s) dropped, writing fell behind\n", h.path.c_str(), dropped);
+        }
+        if (buf_.empty()) return;
+        if (!history_append_block(h.path, buf_.data(), buf_.size(), keep_))
+            std::fprintf(stderr, "history: cannot write %s: %s\n", h.path.c_str(), std::strerror(errno));
+        buf_.clear();
+    }
+
+    void run() {
+        std::vector<std::shared_ptr<HistorySeries>> work;
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;) {
+            cv_.wait_for(lk, kSweep, [&] { return pending_ || stopping_; });
+            const bool last = stopping_;
+            pending_ = false;
+            work = series_;
+            lk.unlock();
+            const long long now = wall_ms();
+            // Series no probe holds any more (only series_ and work) are written out in full.
+            for (auto& h : work) flush(*h, last || h.use_count() <= 2, now);
+            work.clear();
+            lk.lock();
+            series_.erase(std::remove_if(series_.begin(), series_.end(),
+                                         [](const std::shared_ptr<HistorySeries>& h) {
+                                             if (h.use_count() > 1) return false;
+                                             std::lock_guard<std::mutex> hl(h->mu);
+                                             return !h->open.count() && h->sealed.empty();
+                                         }),
+                          series_.end());
+            if (last) return;
+        }
+    }
+};
+
+// Every result of a probe, whoever publishes it: the table's statistics and the history.
+static void record_result(Probe& p, ProbeState st, double metric) {
+    p.stats.record(st, metric);
+    if (p.history && p.history->append(st, metric)) p.history->writer.wake();
+}
+
+// ----- Background worker loop -----
+// Sleep up to ms milliseconds in small steps so a stop request is honoured quickly.
+// Between runs the capture's cv is idle, so it also serves to wake a sleeping worker
+// (see signal_stop()).
+static void sleep_while_running(Probe& p, int ms) {
+    std::unique_lock<std::mutex> lk(p.capture.mu);
+    p.capture.cv.wait_for(lk, std::chrono::milliseconds(ms), [&] { return !p.active.load(); });
+}
+
+// Run the probe once and record the outcome with its output.
+static ProbeState run_once(Reactor& reactor, Probe& p, const char* cmd) {
+    p.output.begin_run();
+    bool timed_out = false;
+    const int status = run_probe_process(reactor, p.capture, cmd, p.timeout_ms.load(), p.active, timed_out);
+    const bool exited = status >= 0 && !timed_out && WIFEXITED(status);
+    const bool nagios = p.cfg.type == ProbeType::Nagios;
+    ProbeState result = ProbeState::Fail;
+    if (exited && nagios)                                               result = nagios_state(WEXITSTATUS(status));
+    else if (exited && (WEXITSTATUS(status) == 0 || p.cfg.ignore_exit)) result = ProbeState::Ok;
+    char what[96];
+    if (status < 0)               std::snprintf(what, sizeof(what), "spawn failed: %s", std::strerror(errno));
+    else if (timed_out)           std::snprintf(what, sizeof(what), "timeout after %d ms", p.timeout_ms.load());
+    else if (WIFSIGNALED(status)) std::snprintf(what, sizeof(what), "killed by signal %d", WTERMSIG(status));
+    else if (nagios)              std::snprintf(what, sizeof(what), "exit %d (%s)", WEXITSTATUS(status),
+                                                nagios_code_name(WEXITSTATUS(status)));
+    else                          std::snprintf(what, sizeof(what), "exit %d", WEXITSTATUS(status));
+
+    // Output matchers override the exit code of a completed run.
+    double headline = NAN;
+    if (const OutputMatchers* m = p.capture.matchers; m && exited) {
+        const MatchState& ms = p.capture.match;
+        const std::size_t used = std::strlen(what);
+        if (m->fail.valid() && ms.fail_hit) {
+            result = ProbeState::Fail;
+            std::snprintf(what + used, sizeof(what) - used, ", failure pattern matched");
+        } else if (result == ProbeState::Ok && m->ok.valid() && !ms.ok_hit) {
+            result = ProbeState::Fail;
+            std::snprintf(what + used, sizeof(what) - used, ", success pattern not found");
+        }
+        if (ms.has_metric) headline = ms.metric;
+    }
+    if (nagios && exited) {
+        std::lock_guard<std::mutex> lk(p.perf_mu);
+        p.perf_count = p.perf_text.parse(p.perf, Probe::kMaxPerf);
+        if (std::isnan(headline) && p.perf_count > 0 && !(p.capture.matchers && p.capture.matchers->has_metric()))
+            headline = p.perf[0].value;
+    }
+    if (exited) p.metric.store(headline);
+    p.output.end_run(result != ProbeState::Ok, what);
+    return result;
+}
+
+// Hand a batch run's results to its members. Members not named in the output
+// (or all of them, if the run failed before reporting) become Unknown.
+static void publish_batch(AppState& s, Probe& runner) {
+    char what[96];
+    for (BatchSlot& sl : runner.batch->slots) {
+        Probe& m = *sl.member;
+        const ProbeState st = sl.seen ? sl.state : ProbeState::Unknown;
+        m.output.begin_run();
+        if (sl.seen) m.output.append(sl.line, std::strlen(sl.line));
+        std::snprintf(what, sizeof(what), "%s by batch %s", sl.seen ? "reported" : "not reported",
+                      runner.cfg.name.c_str());
+        m.output.end_run(st != ProbeState::Ok, what);
+        m.metric.store(sl.seen ? sl.metric : NAN);
+        record_result(m, st, m.metric.load());
+        mark_once(m.first_result);
+        sl.failures = (st == ProbeState::Fail) ? sl.failures + 1 : 0;
+        if (st != ProbeState::Fail || sl.failures >= m.fail_threshold.load()) publish_state(s, m, st);
+    }
+}
+
+static bool plugin_fd_ready(int, short revents, short* events, void* data) {
+    auto* p = static_cast<Probe*>(data);
+    if (!p->plugin->poll_fd(p->plugin_inst, revents, events)) return true;
+    {
+        std::lock_guard<std::mutex> lk(p->capture.mu);
+        p->capture.eof = true;
+    }
+    p->capture.cv.notify_all();
+    return false;
+}
+
+// One sample of a plugin probe: the plugin's fd is waited on by the reactor, and
+// this thread only sleeps until the sample completes or times out.
+static ProbeState run_plugin_once(Reactor& reactor, Probe& p) {
+    p.output.begin_run();
+    short events = POLLIN;
+    const int fd = p.plugin->start(p.plugin_inst, &events);
+    bool timed_out = false;
+    if (fd >= 0) {
+        RunCapture& cap = p.capture;
+        cap.eof = false;
+        reactor.add(fd, events, plugin_fd_ready, &p);
+        const int timeout_ms = p.timeout_ms.load();
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        std::unique_lock<std::mutex> lk(cap.mu);
+        auto done = [&] { return cap.eof || !p.active.load(); };
+        if (timeout_ms > 0) cap.cv.wait_until(lk, deadline, done);
+        else                cap.cv.wait(lk, done);
+        timed_out = !cap.eof;
+        lk.unlock();
+        reactor.remove(fd);     // before complete(), which may close fd
+    }
+    nsm_result r{};
+    r.status = NSM_STATUS_UNKNOWN;
+    p.plugin->complete(p.plugin_inst, timed_out ? 1 : 0, &r);
+    r.message[sizeof(r.message) - 1] = '\0';
+
+    const ProbeState result = timed_out ? ProbeState::Fail : nagios_state(r.status);
+    char what[96];
+    if (timed_out) std::snprintf(what, sizeof(what), "timeout after %d ms", p.timeout_ms.load());
+    else           std::snprintf(what, sizeof(what), "%s %s", p.plugin->name, nagios_code_name(r.status));
+    p.output.append(r.message, std::strlen(r.message));
+    p.output.end_run(result != ProbeState::Ok, what);
+    p.metric.store(!timed_out && r.has_metric ? r.metric : NAN);
+    return result;
+}
+
+static void share_result(AppState& s, const Probe& p);
+
+static void probe_worker(AppState* s, ScriptResolver* resolver, Reactor* reactor, Probe* p) {
+    FaultInjector* fi = &p->faults;
+    const bool native = p->plugin != nullptr;   // plugin probes have no script
+    char script[PATH_MAX] = "";
+    char cmd[PATH_MAX * 2];
+    unsigned gen = native ? 0 : resolver->lookup(p->script_id, script, sizeof(script));
+    AllocSite allocs(p->cfg.name.c_str());
+    int failures = 0;   // consecutive, for fail_threshold
+    while (p->active.load()) {
+        // Another cluster member runs this one and sends its results.
+        if (p->cfg.shared && !p->owned.load()) {
+            sleep_while_running(*p, p->interval_ms.load());
+            continue;
+        }
+        // While the script is missing, stay Unknown until the resolver reports a change.
+        if (!native && !script[0]) {
+            publish_state(*s, *p, ProbeState::Unknown);
+            if (p->batch) { p->batch->reset(); publish_batch(*s, *p); }
+            resolver->wait_change(p->script_id, gen, -1, p->active);
+            gen = resolver->lookup(p->script_id, script, sizeof(script));
+            continue;
+        }
+        if (!native) build_command(cmd, sizeof(cmd), script, p->cfg.args.c_str());
+
+        alloc_cycle_begin(allocs);
+        s->cycles.fetch_add(1, std::memory_order_relaxed);
+        auto t0 = std::chrono::steady_clock::now();
+        ProbeState result = ProbeState::Fail;
+        bool publish = true;
+
+        if (p->batch) p->batch->reset();
+        const FaultAction action = fi->next();
+        switch (action) {
+            case FaultAction::Pass:
+            case FaultAction::Drop:
+                mark_once(s->first_spawn);
+                if (!native) s->spawns.fetch_add(1, std::memory_order_relaxed);
+                result = native ? run_plugin_once(*reactor, *p) : run_once(*reactor, *p, cmd);
+                publish = (action == FaultAction::Pass);
+                if (!publish) fi->stats.dropped.fetch_add(1, std::memory_order_relaxed);
+                break;
+            case FaultAction::Timeout:
+                // The script "hangs" until the probe timeout expires.
+                fi->stats.timeouts.fetch_add(1, std::memory_order_relaxed);
+                p->output.begin_run();
+                sleep_while_running(*p, fi->timeout_ms);
+                p->output.end_run(true, "timeout (injected)");
+                break;
+            case FaultAction::SpawnEagain:
+            case FaultAction::SpawnEnomem:
+                // Same outcome as posix_spawn() failing because fork() did.
+                fi->stats.spawn_failures.fetch_add(1, std::memory_order_relaxed);
+                p->output.begin_run();
+                p->output.end_run(true, action == FaultAction::SpawnEagain ? "spawn failed: EAGAIN (injected)"
+                                                                           : "spawn failed: ENOMEM (injected)");
+                break;
+            case FaultAction::Freeze:
+                fi->stats.freezes.fetch_add(1, std::memory_order_relaxed);
+                sleep_while_running(*p, fi->freeze_ms);
+                publish = false;
+                break;
+        }
+        if (publish) {
+            sleep_while_running(*p, fi->delay_ms());
+            mark_once(p->first_result);
+            record_result(*p, result, p->metric.load());
+            failures = (result == ProbeState::Fail) ? failures + 1 : 0;
+            if (result != ProbeState::Fail || failures >= p->fail_threshold.load()) publish_state(*s, *p, result);
+            if (p->batch) publish_batch(*s, *p);
+            s->results.fetch_add(p->batch ? p->batch->slots.size() : 1, std::memory_order_relaxed);
+            fi->stats.published.fetch_add(1, std::memory_order_relaxed);
+            if (p->cfg.shared) share_result(*s, *p);
+        }
+
+        auto us = static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - t0).count());
+        fi->stats.busy_us.fetch_add(us, std::memory_order_relaxed);
+        if (us > fi->stats.max_us.load(std::memory_order_relaxed)) fi->stats.max_us.store(us, std::memory_order_relaxed);
+        alloc_cycle_end(allocs);
+
+        // Idle until the next cycle; a changed script triggers an immediate re-run.
+        if (native) {
+            sleep_while_running(*p, p->interval_ms.load());
+            continue;
+        }
+        resolver->wait_change(p->script_id, gen, p->interval_ms.load(), p->active);
+        gen = resolver->lookup(p->script_id, script, sizeof(script));
+    }
+    alloc_report(allocs);
+}
+
+// ----- Passive probes: results pushed by other programs -----
+//
+// Datagrams of "name status [metric]" lines (see Monitor::Options) arrive on a Unix
+// datagram socket and/or a UDP port, both read on the reactor: up to kBatch
+// datagrams per recvmmsg(), resolved against the name index under one short
+// lock per call and stored with the same atomics the workers use, so a push
+// costs a hash lookup and a few stores. A timerfd on the same loop marks a
+// probe stale once nothing has arrived for its stale_after_ms.
+class PassiveReceiver {
+public:
+    explicit PassiveReceiver(AppState& s) : s_(s) {
+        for (int i = 0; i < kBatch; ++i) {
+            iov_[i] = iovec{bufs_[i], kDatagram};
+            msgs_[i] = mmsghdr{};
+            msgs_[i].msg_hdr.msg_iov = &iov_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+    PassiveReceiver(const PassiveReceiver&) = delete;
+    PassiveReceiver& operator=(const PassiveReceiver&) = delete;
+
+    // Bind what the options ask for; false (with a message) if any of it fails.
+    bool start(Reactor& reactor, const Monitor::Options& o) {
+        if (o.passive_socket.empty() && o.passive_udp_port <= 0) return true;
+        bool ok = true;
+        if (!o.passive_socket.empty()) ok = bind_unix(o.passive_socket) && ok;
+        if (o.passive_udp_port > 0) ok = bind_udp(o.passive_udp_host, o.passive_udp_port) && ok;
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd_ >= 0) {
+            const itimerspec every{{0, kCheckMs * 1000000L}, {0, kCheckMs * 1000000L}};
+            timerfd_settime(timer_fd_, 0, &every, nullptr);
+            reactor.add(timer_fd_, POLLIN, &PassiveReceiver::tick, this);
+        }
+        for (int fd : {unix_fd_, udp_fd_})
+            if (fd >= 0) reactor.add(fd, POLLIN, &PassiveReceiver::readable, this);
+        return ok;
+    }
+
+    void stop(Reactor& reactor) {
+        for (int* fd : {&unix_fd_, &udp_fd_, &timer_fd_}) {
+            if (*fd < 0) continue;
+            reactor.remove(*fd);
+            close(*fd);
+            *fd = -1;
+        }
+        if (!unix_path_.empty()) unlink(unix_path_.c_str());
+        unix_path_.clear();
+    }
+
+private:
+    static constexpr int kBatch = 64;
+    static constexpr std::size_t kDatagram = 2048;  // longer datagrams lose their tail
+    static constexpr int kRounds = 16;              // batches per wakeup before other fds get a turn
+    static constexpr long kCheckMs = 250;           // freshness check period
+
+    AppState& s_;
+    int unix_fd_ = -1, udp_fd_ = -1, timer_fd_ = -1;
+    std::string unix_path_;
+    char bufs_[kBatch][kDatagram + 1];      // + 1 for a terminating '\0'
+    iovec iov_[kBatch];
+    mmsghdr msgs_[kBatch];
+
+    bool bind_unix(const std::string& path) {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) {
+            std::fprintf(stderr, "passive: socket path too long: %s\n", path.c_str());
+            return false;
+        }
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        // A socket left behind by a crashed run would make bind() fail; anything else is kept.
+        struct stat st{};
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());
+        const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::fprintf(stderr, "passive: cannot bind %s: %s\n", path.c_str(), std::strerror(errno));
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        unix_fd_ = fd;
+        unix_path_ = path;
+        return true;
+    }
+
+    bool bind_udp(const std::string& host, int port) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+        addrinfo* res = nullptr;
+        char service[16];
+        std::snprintf(service, sizeof(service), "%d", port);
+        if (int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), service, &hints, &res); rc != 0) {
+            std::fprintf(stderr, "passive: %s: %s\n", host.c_str(), gai_strerror(rc));
+            return false;
+        }
+        int err = 0;
+        for (addrinfo* ai = res; ai && udp_fd_ < 0; ai = ai->ai_next) {
+            const int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd < 0) continue;
+            // Room for bursts while the loop is busy draining a probe's output.
+            const int rcvbuf = 1 << 20;
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                udp_fd_ = fd;
+            } else {
+                err = errno;
+                close(fd);
+            }
+        }
+        freeaddrinfo(res);
+        if (udp_fd_ < 0) {
+            std::fprintf(stderr, "passive: cannot bind %s port %d: %s\n", host.c_str(), port, std::strerror(err));
+            return false;
+        }
+        return true;
+    }
+
+    static long long now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static bool readable(int fd, short, short*, void* data) {
+        auto* r = static_cast<PassiveReceiver*>(data);
+        for (int round = 0; round < kRounds; ++round) {
+            const int n = recvmmsg(fd, r->msgs_, kBatch, MSG_DONTWAIT, nullptr);
+            if (n <= 0) break;
+            const long long now = now_ms();
+            {
+                std::lock_guard<std::mutex> lk(r->s_.passive_mu);
+                for (int i = 0; i < n; ++i) r->ingest(r->bufs_[i], std::min<std::size_t>(r->msgs_[i].msg_len, kDatagram), now);
+            }
+            if (n < kBatch) break;
+        }
+        return true;
+    }
+
+    // One datagram; passive_mu is held.
+    void ingest(char* data, std::size_t n, long long now) {
+        data[n] = '\0';
+        for (char* line = data; line < data + n;) {
+            char* end = static_cast<char*>(std::memchr(line, '\n', static_cast<std::size_t>(data + n - line)));
+            if (!end) end = data + n;
+            std::size_t len = static_cast<std::size_t>(end - line);
+            if (len && line[len - 1] == '\r') --len;
+            if (len) result(line, len, now);
+            line = end + 1;
+        }
+    }
+
+    void result(const char* line, std::size_t len, long long now) {
+        auto skip = [&](std::size_t i, bool space) {
+            while (i < len && (line[i] == ' ' || line[i] == '\t') == space) ++i;
+            return i;
+        };
+        const std::size_t name_end = skip(0, false);
+        const std::size_t status_at = skip(name_end, true), status_end = skip(status_at, false);
+        const std::size_t metric_at = skip(status_end, true);
+        char status[16];
+        ProbeState st;
+        const std::size_t status_len = status_end - status_at;
+        const auto it = s_.passive.find(std::string_view(line, name_end));
+        if (it == s_.passive.end() || status_len == 0 || status_len >= sizeof(status)) {
+            s_.passive_ignored.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::memcpy(status, line + status_at, status_len);
+        status[status_len] = '\0';
+        if (!parse_status(status, st)) {
+            s_.passive_ignored.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        double metric = NAN;
+        if (metric_at < len) {
+            char* num_end = nullptr;
+            metric = std::strtod(line + metric_at, &num_end);
+            if (num_end == line + metric_at) metric = NAN;
+        }
+
+        Probe& p = *it->second;
+        p.last_push_ms.store(now, std::memory_order_relaxed);
+        p.output.begin_run();
+        p.output.append(line, len);
+        p.output.append("\n", 1);
+        p.output.end_run(st != ProbeState::Ok, "pushed");
+        p.metric.store(metric);
+        record_result(p, st, metric);
+        mark_once(p.first_result);
+        p.passive_failures = (st == ProbeState::Fail) ? p.passive_failures + 1 : 0;
+        if (st != ProbeState::Fail || p.passive_failures >= p.fail_threshold.load()) publish_state(s_, p, st);
+        s_.results.fetch_add(1, std::memory_order_relaxed);
+        s_.passive_results.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static bool tick(int fd, short, short*, void* data) {
+        auto* r = static_cast<PassiveReceiver*>(data);
+        std::uint64_t expirations;
+        (void)!read(fd, &expirations, sizeof(expirations));
+        const long long now = now_ms();
+        bool changed = false;
+        {
+            std::lock_guard<std::mutex> lk(r->s_.passive_mu);
+            for (const auto& entry : r->s_.passive) {
+                Probe& p = *entry.second;
+                const int after = p.stale_after_ms.load(std::memory_order_relaxed);
+                if (after <= 0 || p.stale.load() || now - p.last_push_ms.load(std::memory_order_relaxed) < after)
+                    continue;
+                p.stale.store(true);
+                changed = true;
+            }
+        }
+        if (changed) notify_change(r->s_);
+        return true;
+    }
+};
+
+// ----- Child monitors: probes of other instances, fed over TCP -----
+//
+// One thread per [child NAME] connects to the child's FeedServer, takes the
+// snapshot it sends and then applies its deltas (see feed_proto.h), so an
+// update costs a few bytes and a short lock. Changes go through the same hooks
+// and change notification as local ones. A lost link is retried with backoff
+// (1 s doubling to 30 s); meanwhile the child's probes are shown stale and its
+// link probe fails, and a child that sends nothing, not even keepalives, for
+// 45 s counts as lost.
+class ChildLink {
+public:
+    ChildLink(AppState& s, const ChildConfig& c) : cfg(c), s_(s) {
+        stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        link_.name = cfg.name;
+        link_.group = cfg.name;
+    }
+    ChildLink(const ChildLink&) = delete;
+    ChildLink& operator=(const ChildLink&) = delete;
+    ~ChildLink() {
+        stop();
+        if (stop_fd_ >= 0) close(stop_fd_);
+    }
+
+    const ChildConfig cfg;
+
+    void start() { thread_ = std::thread([this] { run(); }); }
+
+    void stop() {
+        if (!thread_.joinable()) return;
+        const std::uint64_t one = 1;
+        (void)!write(stop_fd_, &one, sizeof(one));
+        thread_.join();
+    }
+
+    // Append the link probe and the child's probes to out; snapshot() holds children_mu.
+    void append_to(std::vector<ProbeView>& out) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::size_t i = out.size();
+        out.resize(i + 1 + probes_.size());
+        copy(link_, out[i++]);
+        for (const Remote& r : probes_) copy(r, out[i++]);
+    }
+
+private:
+    static constexpr int kConnectMs = 5000;
+    static constexpr int kIdleMs = 45000;       // three missed keepalives
+    static constexpr int kRetryMs = 1000, kMaxRetryMs = 30000;
+
+    struct Remote {
+        std::string name, group;
+        ProbeState state = ProbeState::Unknown;
+        bool stale = false;
+        double metric = NAN;
+        long long first_result = 0, last_change = 0;
+    };
+
+    AppState& s_;
+    int stop_fd_ = -1;
+    std::thread thread_;
+    mutable std::mutex mu_;         // guards link_, probes_
+    Remote link_;                   // the link itself: ok while connected
+    std::vector<Remote> probes_;    // in the child's display order
+    std::vector<Remote> incoming_;  // link thread only: snapshot being decoded
+    std::string in_;                // link thread only: bytes not yet decoded
+
+    static void copy(const Remote& r, ProbeView& v) {
+        v.name = r.name;
+        v.group = r.group;
+        v.state = r.state;
+        v.stale = r.stale;
+        v.metric = r.metric;
+        v.first_result = r.first_result;
+        v.p99 = NAN;                // statistics stay with the child
+        v.availability = NAN;
+        v.last_change = r.last_change;
+        v.perf_count = 0;
+    }
+
+    // Set a value; a state change (not the first known state) goes to the hooks.
+    // mu_ is held. True if the change is visible.
+    bool update(Remote& r, ProbeState st, bool stale, double metric) {
+        const bool visible = r.state != st || r.stale != stale;
+        if (r.state != st) {
+            if (r.state != ProbeState::Unknown && st != ProbeState::Unknown) queue_hooks(s_, r.name, r.state, st, metric);
+            r.last_change = std::time(nullptr);
+            if (!r.first_result && st != ProbeState::Unknown) r.first_result = boottime_us();
+        }
+        r.state = st;
+        r.stale = stale;
+        r.metric = metric;
+        return visible;
+    }
+
+    // Wait ms or until stop(); true if stopped.
+    bool wait(int ms) {
+        pollfd pfd{stop_fd_, POLLIN, 0};
+        return poll(&pfd, 1, ms) > 0;
+    }
+
+    void run() {
+        int retry_ms = kRetryMs;
+        bool reported = false;      // the current outage was already printed
+        char why[128];
+        for (;;) {
+            const int fd = connect_child(why, sizeof(why));
+            if (fd == -2) return;   // stopped while connecting
+            if (fd >= 0) {
+                std::fprintf(stderr, "child %s: connected to %s port %d\n", cfg.name.c_str(), cfg.host.c_str(), cfg.port);
+                retry_ms = kRetryMs;
+                reported = false;
+                const bool stopped = serve(fd, why, sizeof(why));
+                close(fd);
+                if (stopped) return;
+            }
+            link_down();
+            if (!reported) {
+                std::fprintf(stderr, "child %s: %s; retrying\n", cfg.name.c_str(), why);
+                reported = true;
+            }
+            if (wait(retry_ms)) return;
+            retry_ms = std::min(retry_ms * 2, kMaxRetryMs);
+        }
+    }
+
+    // A connected socket, -1 with the reason in why, or -2 if stopped meanwhile.
+    int connect_child(char* why, std::size_t len) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        char port[16];
+        std::snprintf(port, sizeof(port), "%d", cfg.port);
+        if (int rc = getaddrinfo(cfg.host.c_str(), port, &hints, &res); rc != 0) {
+            std::snprintf(why, len, "%s: %s", cfg.host.c_str(), gai_strerror(rc));
+            return -1;
+        }
+        int fd = -1, err = ETIMEDOUT;
+        for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd < 0) continue;
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0 && errno != EINPROGRESS) {
+                err = errno;
+            } else {
+                pollfd pfds[2] = {{fd, POLLOUT, 0}, {stop_fd_, POLLIN, 0}};
+                if (poll(pfds, 2, kConnectMs) > 0 && pfds[1].revents) {
+                    close(fd);
+                    freeaddrinfo(res);
+                    return -2;
+                }
+                socklen_t err_len = sizeof(err);
+                if (!pfds[0].revents) err = ETIMEDOUT;
+                else if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0) err = errno;
+                if (pfds[0].revents && err == 0) break;
+            }
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        if (fd < 0) std::snprintf(why, len, "cannot connect to port %d: %s", cfg.port, std::strerror(err));
+        return fd;
+    }
+
+    // Read and apply frames until the link fails (why says how) or stop(); true if stopped.
+    bool serve(int fd, char* why, std::size_t len) {
+        in_.clear();
+        bool hello = false;
+        char buf[16384];
+        for (;;) {
+            pollfd pfds[2] = {{fd, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+            const int n = poll(pfds, 2, kIdleMs);
+            if (n < 0 && errno == EINTR) continue;
+            if (pfds[1].revents) return true;
+            if (n <= 0) {
+                std::snprintf(why, len, "silent for %d s", kIdleMs / 1000);
+                return false;
+            }
+            const ssize_t got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (got < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            if (got <= 0) {
+                std::snprintf(why, len, "%s", got == 0 ? "connection closed" : std::strerror(errno));
+                return false;
+            }
+            s_.child_bytes.fetch_add(static_cast<unsigned long long>(got), std::memory_order_relaxed);
+            in_.append(buf, static_cast<std::size_t>(got));
+            if (!hello) {
+                if (in_.size() < feed::kHelloLen) continue;
+                if (in_.compare(0, feed::kHelloLen, feed::kHello, feed::kHelloLen) != 0) {
+                    std::snprintf(why, len, "not a monitor feed");
+                    return false;
+                }
+                in_.erase(0, feed::kHelloLen);
+                hello = true;
+            }
+            if (!decode(why, len)) return false;
+        }
+    }
+
+    // Apply every complete frame in in_; false on a protocol error.
+    bool decode(char* why, std::size_t len) {
+        const auto* begin = reinterpret_cast<const unsigned char*>(in_.data());
+        const unsigned char* p = begin;
+        const unsigned char* const end = begin + in_.size();
+        bool ok = true;
+        while (ok) {
+            const unsigned char* q = p;
+            std::uint64_t size;
+            if (!feed::get_varint(q, end, size)) break;
+            if (size == 0 || size > feed::kMaxFrame) {
+                ok = false;
+                break;
+            }
+            if (size > static_cast<std::uint64_t>(end - q)) break;
+            ok = frame(q, q + size);
+            p = q + size;
+        }
+        in_.erase(0, static_cast<std::size_t>(p - begin));
+        if (ok && in_.size() > feed::kMaxFrame + 16) ok = false;
+        if (!ok) std::snprintf(why, len, "protocol error");
+        return ok;
+    }
+
+    bool frame(const unsigned char* p, const unsigned char* end) {
+        const unsigned char type = *p++;
+        if (type == feed::kKeepalive) return true;
+        std::uint64_t count;
+        if (!feed::get_varint(p, end, count)) return false;
+        if (type == feed::kSnapshot) return snapshot(p, end, count);
+        if (type != feed::kDelta) return true;     // newer frame types are skipped
+
+        bool visible = false;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (std::uint64_t i = 0; i < count; ++i) {
+                std::uint64_t index;
+                ProbeState st;
+                bool stale;
+                double metric;
+                if (!feed::get_varint(p, end, index) || index >= probes_.size() ||
+                    !feed::get_value(p, end, st, stale, metric))
+                    return false;
+                visible = update(probes_[index], st, stale, metric) || visible;
+            }
+        }
+        s_.child_updates.fetch_add(count, std::memory_order_relaxed);
+        if (visible) notify_change(s_);
+        return true;
+    }
+
+    // A full picture: on connect, and whenever the child's probes change.
+    bool snapshot(const unsigned char* p, const unsigned char* end, std::uint64_t count) {
+        if (count > static_cast<std::uint64_t>(end - p)) return false;     // at least a byte each
+        incoming_.resize(static_cast<std::size_t>(count));
+        std::string name, group;
+        for (Remote& r : incoming_) {
+            ProbeState st;
+            bool stale;
+            double metric;
+            if (!feed::get_string(p, end, name) || !feed::get_string(p, end, group) ||
+                !feed::get_value(p, end, st, stale, metric))
+                return false;
+            r.name = cfg.name + "/" + name;
+            r.group = group.empty() ? cfg.name : cfg.name + "/" + group;
+            r.state = st;
+            r.stale = stale;
+            r.metric = metric;
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            update(link_, ProbeState::Ok, false, NAN);
+            // Probes the parent already knew keep their history, and report what
+            // changed while the link was down.
+            for (Remote& r : incoming_) {
+                auto it = std::find_if(probes_.begin(), probes_.end(), [&](const Remote& o) { return o.name == r.name; });
+                if (it == probes_.end()) {
+                    r.first_result = r.state != ProbeState::Unknown ? boottime_us() : 0;
+                    r.last_change = 0;
+                    continue;
+                }
+                Remote fresh = r;
+                r = std::move(*it);
+                r.group = fresh.group;
+                update(r, fresh.state, fresh.stale, fresh.metric);
+            }
+            probes_.swap(incoming_);
+        }
+        s_.child_updates.fetch_add(count, std::memory_order_relaxed);
+        notify_change(s_);
+        return true;
+    }
+
+    void link_down() {
+        bool visible;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            visible = update(link_, ProbeState::Fail, false, NAN);
+            for (Remote& r : probes_) {
+                visible = visible || !r.stale;
+                r.stale = true;
+            }
+        }
+        if (visible) notify_change(s_);
+    }
+};
+
+// ----- Cooperative probing: shared probes sharded across cluster members -----
+//
+// Members send "NSMC1 hb NAME" to every configured peer each heartbeat_ms over
+// UDP, and whoever was heard within dead_after_ms is a member. The members'
+// names, each hashed to kVnodes points, form a consistent-hash ring; a shared
+// probe belongs to the member owning the first point at or after its name's
+// hash, so all members agree on an owner without talking about it, and a member
+// joining or leaving moves only the probes next to its points. The owner's
+// worker runs the probe and sends each result as "NSMC1 res NAME" plus a batch
+// line ("probe status [metric]") to the peers; elsewhere the worker idles and
+// the result is applied as it arrives. Datagrams from hosts that are not
+// configured peers are dropped, and no more members are admitted than there are
+// peers, so a stray host can neither take probes nor inject results. Until the
+// first heartbeats have had time
+// to arrive nobody owns anything, so a site booting at once does not probe
+// every device from every member first.
+class Cluster {
+public:
+    Cluster(AppState& s, const ClusterConfig& c) : cfg(c), s_(s) {
+        stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (cfg.name.empty()) {
+            char host[256] = "";
+            gethostname(host, sizeof(host) - 1);
+            self_ = host;
+        } else {
+            self_ = cfg.name;
+        }
+    }
+    Cluster(const Cluster&) = delete;
+    Cluster& operator=(const Cluster&) = delete;
+    ~Cluster() {
+        stop();
+        if (fd_ >= 0) close(fd_);
+        if (stop_fd_ >= 0) close(stop_fd_);
+    }
+
+    const ClusterConfig cfg;
+
+    // Bind and resolve the peers, then start heartbeating; false (with a message)
+    // if the port cannot be bound.
+    bool start() {
+        if (!bind_socket()) return false;
+        for (const std::string& spec : cfg.peers) {
+            std::string host;
+            int port = 0;
+            parse_address(spec, host, port);
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_DGRAM;
+            addrinfo* res = nullptr;
+            char service[16];
+            std::snprintf(service, sizeof(service), "%d", port);
+            if (int rc = getaddrinfo(host.c_str(), service, &hints, &res); rc != 0) {
+                std::fprintf(stderr, "cluster: peer %s: %s\n", spec.c_str(), gai_strerror(rc));
+                continue;
+            }
+            Peer p;
+            std::memcpy(&p.addr, res->ai_addr, res->ai_addrlen);
+            p.len = res->ai_addrlen;
+            peers_.push_back(p);
+            freeaddrinfo(res);
+        }
+        thread_ = std::thread([this] { run(); });
+        std::fprintf(stderr, "cluster: %s on port %d, %zu peer(s)\n", self_.c_str(), cfg.listen_port, peers_.size());
+        return true;
+    }
+
+    void stop() {
+        if (!thread_.joinable()) return;
+        const std::uint64_t one = 1;
+        (void)!write(stop_fd_, &one, sizeof(one));
+        thread_.join();
+    }
+
+    // Whether this member runs the shared probe name.
+    bool owns(const std::string& name) const {
+        std::lock_guard<std::mutex> lk(ring_mu_);
+        if (ring_.empty()) return false;
+        const std::uint64_t h = hash(name.data(), name.size());
+        auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(h, 0));
+        if (it == ring_.end()) it = ring_.begin();
+        return it->second == self_index_;
+    }
+
+    // Send a result of a probe this member owns to the peers. From the probe's
+    // worker; the peer table does not change once started, so no lock.
+    void share(const Probe& p) {
+        char msg[320];
+        const ProbeState st = p.state.load();
+        const double metric = p.metric.load();
+        int n = std::snprintf(msg, sizeof(msg), "NSMC1 res %s\n%s %s", self_.c_str(), p.cfg.name.c_str(),
+                              state_name(st));
+        if (!std::isnan(metric) && n > 0 && n < static_cast<int>(sizeof(msg)))
+            n += std::snprintf(msg + n, sizeof(msg) - n, " %.9g", metric);
+        if (n <= 0 || n >= static_cast<int>(sizeof(msg))) return;
+        for (const Peer& peer : peers_)
+            if (sendto(fd_, msg, static_cast<std::size_t>(n), MSG_DONTWAIT,
+                       reinterpret_cast<const sockaddr*>(&peer.addr), peer.len) == n)
+                s_.peer_sent.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Set which shared probes run here; probes_mu is held.
+    void assign(const std::vector<std::unique_ptr<Probe>>& probes) {
+        for (const auto& p : probes)
+            if (p->cfg.shared) p->owned.store(owns(p->cfg.name));
+    }
+
+private:
+    static constexpr int kVnodes = 64;      // ring points per member: evens out the shares
+    static constexpr std::size_t kDatagram = 2048;
+
+    struct Peer {
+        sockaddr_storage addr;
+        socklen_t len;
+    };
+
+    AppState& s_;
+    std::string self_;
+    int fd_ = -1, stop_fd_ = -1;
+    std::vector<Peer> peers_;
+    std::thread thread_;
+    std::map<std::string, long long> heard_;    // cluster thread only: member -> last heartbeat (ms)
+    bool warned_stranger_ = false;              // cluster thread only: reported a datagram from elsewhere
+    mutable std::mutex ring_mu_;                // guards ring_, self_index_
+    std::vector<std::pair<std::uint64_t, int>> ring_;   // (point, member index), sorted
+    int self_index_ = -1;
+
+    // FNV-1a, finished with a 64-bit mixer so that similar names spread over the ring.
+    static std::uint64_t hash(const char* p, std::size_t n) {
+        std::uint64_t h = 1469598103934665603ULL;
+        for (std::size_t i = 0; i < n; ++i) h = (h ^ static_cast<unsigned char>(p[i])) * 1099511628211ULL;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        return h ^ (h >> 33);
+    }
+
+    static long long now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool bind_socket() {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+        addrinfo* res = nullptr;
+        char service[16];
+        std::snprintf(service, sizeof(service), "%d", cfg.listen_port);
+        const char* host = cfg.listen_host.empty() ? nullptr : cfg.listen_host.c_str();
+        if (int rc = getaddrinfo(host, service, &hints, &res); rc != 0) {
+            std::fprintf(stderr, "cluster: %s: %s\n", cfg.listen_host.c_str(), gai_strerror(rc));
+            return false;
+        }
+        int err = 0;
+        for (addrinfo* ai = res; ai && fd_ < 0; ai = ai->ai_next) {
+            const int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd < 0) continue;
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                fd_ = fd;
+            } else {
+                err = errno;
+                close(fd);
+            }
+        }
+        freeaddrinfo(res);
+        if (fd_ < 0) {
+            std::fprintf(stderr, "cluster: cannot bind %s port %d: %s\n", cfg.listen_host.c_str(), cfg.listen_port,
+                         std::strerror(err));
+            return false;
+        }
+        return true;
+    }
+
+    void heartbeat() {
+        char msg[300];
+        const int n = std::snprintf(msg, sizeof(msg), "NSMC1 hb %s", self_.c_str());
+        if (n <= 0 || n >= static_cast<int>(sizeof(msg))) return;
+        for (const Peer& peer : peers_)
+            (void)!sendto(fd_, msg, static_cast<std::size_t>(n), MSG_DONTWAIT,
+                          reinterpret_cast<const sockaddr*>(&peer.addr), peer.len);
+    }
+
+    // Rebuild the ring from the live members and move probes accordingly.
+    void rebalance() {
+        std::vector<std::string> members{self_};
+        for (const auto& m : heard_) members.push_back(m.first);
+        std::sort(members.begin(), members.end());
+        {
+            std::lock_guard<std::mutex> lk(ring_mu_);
+            ring_.clear();
+            for (int m = 0; m < static_cast<int>(members.size()); ++m) {
+                char point[300];
+                for (int v = 0; v < kVnodes; ++v) {
+                    const int n = std::snprintf(point, sizeof(point), "%s#%d", members[m].c_str(), v);
+                    ring_.emplace_back(hash(point, static_cast<std::size_t>(std::max(n, 0))), m);
+                }
+                if (members[m] == self_) self_index_ = m;
+            }
+            std::sort(ring_.begin(), ring_.end());
+        }
+        std::size_t shared = 0, here = 0;
+        {
+            std::lock_guard<std::mutex> lk(s_.probes_mu);
+            assign(s_.probes);
+            for (const auto& p : s_.probes) {
+                if (!p->cfg.shared) continue;
+                ++shared;
+                if (p->owned.load()) ++here;
+            }
+        }
+        std::string names;
+        for (const std::string& m : members) names += (names.empty() ? "" : " ") + m;
+        std::fprintf(stderr, "cluster: %zu member(s) (%s); %zu of %zu shared probe(s) run here\n", members.size(),
+                     names.c_str(), here, shared);
+    }
+
+    // The IP address of a (v4, v6 or v4-mapped v6) socket address, for comparing
+    // hosts regardless of port; false for other families.
+    static bool host_of(const sockaddr_storage& a, in6_addr& out) {
+        if (a.ss_family == AF_INET6) {
+            out = reinterpret_cast<const sockaddr_in6&>(a).sin6_addr;
+            return true;
+        }
+        if (a.ss_family != AF_INET) return false;
+        std::memset(&out, 0, sizeof(out));
+        out.s6_addr[10] = out.s6_addr[11] = 0xff;
+        std::memcpy(&out.s6_addr[12], &reinterpret_cast<const sockaddr_in&>(a).sin_addr, 4);
+        return true;
+    }
+
+    bool from_peer(const sockaddr_storage& src) const {
+        in6_addr host, peer;
+        if (!host_of(src, host)) return false;
+        for (const Peer& p : peers_)
+            if (host_of(p.addr, peer) && std::memcmp(&host, &peer, sizeof(host)) == 0) return true;
+        return false;
+    }
+
+    void receive(char* buf, std::size_t n, const sockaddr_storage& src, long long now, bool& changed) {
+        if (!from_peer(src)) {
+            if (!warned_stranger_) {
+                char host[INET6_ADDRSTRLEN] = "?";
+                getnameinfo(reinterpret_cast<const sockaddr*>(&src), sizeof(src), host, sizeof(host), nullptr, 0,
+                            NI_NUMERICHOST);
+                std::fprintf(stderr, "cluster: ignoring datagrams from %s, not a configured peer\n", host);
+                warned_stranger_ = true;
+            }
+            return;
+        }
+        buf[n] = '\0';
+        char* nl = std::strchr(buf, '\n');
+        if (nl) *nl = '\0';
+        char kind[8], from[256];
+        if (std::sscanf(buf, "NSMC1 %7s %255s", kind, from) != 2 || self_ == from) return;
+        if (heard_.find(from) == heard_.end()) {
+            if (heard_.size() >= peers_.size()) return;     // a peer under more names than there are peers
+            changed = true;
+        }
+        heard_[from] = now;     // any message shows the sender is alive
+        if (std::strcmp(kind, "res") == 0 && nl) result(nl + 1, from);
+    }
+
+    // "probe status [metric]" from member from, for a probe it owns.
+    void result(const char* line, const char* from) {
+        char name[256], status[16];
+        double metric = NAN;
+        ProbeState st;
+        if (std::sscanf(line, "%255s %15s %lf", name, status, &metric) < 2 || !parse_status(status, st)) return;
+        std::lock_guard<std::mutex> lk(s_.shared_mu);
+        const auto it = s_.shared.find(std::string_view(name));
+        if (it == s_.shared.end() || it->second->owned.load()) return;     // ours now: a late result
+        Probe& p = *it->second;
+        p.output.begin_run();
+        p.output.append("from ", 5);
+        p.output.append(from, std::strlen(from));
+        p.output.append(": ", 2);
+        p.output.append(line, std::strlen(line));
+        p.output.append("\n", 1);
+        p.output.end_run(st != ProbeState::Ok, "shared");
+        p.metric.store(metric);
+        record_result(p, st, metric);
+        mark_once(p.first_result);
+        publish_state(s_, p, st);
+        s_.results.fetch_add(1, std::memory_order_relaxed);
+        s_.peer_results.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void run() {
+        char buf[kDatagram + 1];
+        const long long started = now_ms();
+        long long next_beat = started;
+        bool settled = false;       // first heartbeats had their chance
+        for (;;) {
+            const long long now = now_ms();
+            if (now >= next_beat) {
+                heartbeat();
+                next_beat = now + cfg.heartbeat_ms;
+            }
+            bool changed = false;
+            for (auto it = heard_.begin(); it != heard_.end();) {
+                if (now - it->second < cfg.dead_after_ms) {
+                    ++it;
+                    continue;
+                }
+                std::fprintf(stderr, "cluster: %s silent for %d ms, its probes move\n", it->first.c_str(),
+                             cfg.dead_after_ms);
+                it = heard_.erase(it);
+                changed = true;
+            }
+            if (!settled && now - started >= cfg.heartbeat_ms * 3 / 2) {
+                settled = true;
+                changed = true;
+            }
+            if (changed && settled) rebalance();
+
+            pollfd pfds[2] = {{fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+            const int timeout = static_cast<int>(std::max(0LL, next_beat - now_ms()));
+            if (poll(pfds, 2, timeout) < 0 && errno != EINTR) {
+                std::perror("cluster: poll");
+                return;
+            }
+            if (pfds[1].revents) return;
+            if (!pfds[0].revents) continue;
+            ssize_t n;
+            sockaddr_storage src;
+            socklen_t src_len = sizeof(src);
+            changed = false;
+            while ((n = recvfrom(fd_, buf, kDatagram, MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&src), &src_len)) > 0) {
+                receive(buf, static_cast<std::size_t>(n), src, now_ms(), changed);
+                src_len = sizeof(src);
+            }
+            if (changed && settled) rebalance();
+        }
+    }
+};
+
+// After a worker published a result of a shared probe it owns.
+static void share_result(AppState& s, const Probe& p) {
+    std::lock_guard<std::mutex> lk(s.cluster_mu);
+    if (s.cluster) s.cluster->share(p);
+}
+
+// ----- Apply a configuration as a diff against the running probes -----
+// A probe whose name, script and args are unchanged keeps its worker and state;
+// interval, timeout and threshold changes are applied to it in place. Only added
+// or retargeted probes get a new worker, and only removed or retargeted ones are
+// stopped, so a reload neither blanks the display nor re-runs every probe.
+// Clear active and wake the worker from whichever wait it is in.
+static void signal_stop(Probe& p, ScriptResolver& resolver) {
+    p.active.store(false);
+    { std::lock_guard<std::mutex> lk(p.capture.mu); }
+    p.capture.cv.notify_all();
+    resolver.wake();
+}
+
+static void stop_probe(Probe& p, ScriptResolver& resolver) {
+    signal_stop(p, resolver);
+    if (p.worker.joinable()) p.worker.join();
+    if (p.faults.enabled) p.faults.report(p.cfg.name.c_str());
+}
+
+static void apply_config(AppState& s, ScriptResolver& resolver, Reactor& reactor, const Config& cfg,
+                         const std::vector<SavedProbe>& restored = {}) {
+    // A changed cluster setup restarts the cluster (its port, peers or name moved).
+    {
+        std::unique_ptr<Cluster> retired_cluster, cluster;
+        bool same;
+        {
+            std::lock_guard<std::mutex> lk(s.cluster_mu);
+            same = s.cluster ? s.cluster->cfg == cfg.cluster : cfg.cluster.listen_port == 0;
+            if (!same) retired_cluster = std::move(s.cluster);
+        }
+        retired_cluster.reset();
+        if (!same && cfg.cluster.listen_port > 0) {
+            cluster = std::make_unique<Cluster>(s, cfg.cluster);
+            if (!cluster->start()) cluster.reset();     // shared probes then run here
+            std::lock_guard<std::mutex> lk(s.cluster_mu);
+            s.cluster = std::move(cluster);
+        }
+    }
+
+    std::vector<std::unique_ptr<Probe>> retired, retired_batches;
+    std::vector<Probe*> started;
+    int kept = 0, tuned = 0;
+    {
+        std::lock_guard<std::mutex> lk(s.probes_mu);
+        std::vector<std::unique_ptr<Probe>> next;
+        for (const ProbeConfig& pc : cfg.probes) {
+            auto it = std::find_if(s.probes.begin(), s.probes.end(), [&](const std::unique_ptr<Probe>& p) {
+                return p && p->cfg.name == pc.name && p->cfg.same_target(pc);
+            });
+            if (it != s.probes.end()) {
+                if (!(*it)->cfg.same_tuning(pc)) { (*it)->tune(pc); ++tuned; }
+                (*it)->cfg.group = pc.group;    // display only; read under probes_mu
+                ++kept;
+                next.push_back(std::move(*it));
+                continue;
+            }
+            auto p = std::make_unique<Probe>();
+            p->configure(pc);
+            if (s.history) p->history = s.history->series(pc.name);
+            for (const SavedProbe& sp : restored) {
+                if (sp.name == pc.name && sp.script == pc.script && sp.args == pc.args) {
+                    p->state.store(sp.state);
+                    p->stale.store(true);
+                }
+            }
+            if (pc.type == ProbeType::Plugin) {
+                char err[256] = "";
+                p->plugin = g_plugins.find(pc.plugin);
+                p->plugin_inst = p->plugin ? p->plugin->init(pc.args.c_str(), err, sizeof(err)) : nullptr;
+                if (p->plugin_inst) {
+                    configure_faults(pc.name, p->faults);
+                    started.push_back(p.get());
+                } else {
+                    std::fprintf(stderr, "probe %s: %s: %s\n", pc.name.c_str(), pc.plugin.c_str(), err);
+                }
+            } else if (pc.batch.empty() && pc.type != ProbeType::Passive) {
+                // batch members and passive probes have no worker of their own
+                p->script_id = resolver.add(pc.script.c_str());
+                configure_faults(pc.name, p->faults);
+                started.push_back(p.get());
+            }
+            next.push_back(std::move(p));
+        }
+
+        // A batch runner is kept only if its script and its exact member probes are;
+        // it holds pointers to the members, so any change there restarts it.
+        std::vector<std::unique_ptr<Probe>> next_batches;
+        for (const ProbeConfig& bc : cfg.batches) {
+            std::vector<Probe*> members;
+            for (auto& p : next)
+                if (p->cfg.batch == bc.name) members.push_back(p.get());
+            auto it = std::find_if(s.batches.begin(), s.batches.end(), [&](const std::unique_ptr<Probe>& b) {
+                if (!b || b->cfg.name != bc.name || !b->cfg.same_target(bc) || b->batch->slots.size() != members.size())
+                    return false;
+                for (std::size_t i = 0; i < members.size(); ++i)
+                    if (b->batch->slots[i].member != members[i]) return false;
+                return true;
+            });
+            if (it != s.batches.end()) {
+                if (!(*it)->cfg.same_tuning(bc)) { (*it)->tune(bc); ++tuned; }
+                next_batches.push_back(std::move(*it));
+                continue;
+            }
+            auto b = std::make_unique<Probe>();
+            b->configure(bc);
+            b->batch = std::make_unique<BatchCollector>();
+            b->batch->slots.resize(members.size());
+            for (std::size_t i = 0; i < members.size(); ++i) {
+                b->batch->slots[i].member = members[i];
+                b->batch->slots[i].name = members[i]->cfg.name.c_str();
+            }
+            b->capture.batch = b->batch.get();
+            b->script_id = resolver.add(bc.script.c_str());
+            configure_faults(bc.name, b->faults);
+            started.push_back(b.get());
+            next_batches.push_back(std::move(b));
+        }
+        for (auto& b : s.batches)
+            if (b) retired_batches.push_back(std::move(b));
+        s.batches.swap(next_batches);
+
+        for (auto& p : s.probes)
+            if (p) retired.push_back(std::move(p));
+        s.probes.swap(next);
+        {
+            std::lock_guard<std::mutex> plk(s.passive_mu);
+            s.passive.clear();
+            for (auto& p : s.probes)
+                if (p->cfg.type == ProbeType::Passive) s.passive.emplace(p->cfg.name, p.get());
+        }
+        {
+            std::lock_guard<std::mutex> clk(s.cluster_mu);
+            if (s.cluster) s.cluster->assign(s.probes);
+            else for (auto& p : s.probes) p->owned.store(true);
+        }
+        {
+            std::lock_guard<std::mutex> slk(s.shared_mu);
+            s.shared.clear();
+            for (auto& p : s.probes)
+                if (p->cfg.shared) s.shared.emplace(p->cfg.name, p.get());
+        }
+        s.layout_slots.store(cfg.layout.slots);
+        s.layout_max_diameter.store(cfg.layout.max_diameter);
+    }
+    for (Probe* p : started) p->worker = std::thread(probe_worker, &s, &resolver, &reactor, p);
+    // Retired runners go first: they may still point at retired members.
+    for (auto& b : retired_batches) stop_probe(*b, resolver);
+    for (auto& p : retired) stop_probe(*p, resolver);
+
+    // Unchanged hooks keep their queue and what they last reported; others restart.
+    std::vector<std::unique_ptr<HookRunner>> retired_hooks;
+    {
+        std::lock_guard<std::mutex> lk(s.hooks_mu);
+        std::vector<std::unique_ptr<HookRunner>> next;
+        for (const HookConfig& hc : cfg.hooks) {
+            auto it = std::find_if(s.hooks.begin(), s.hooks.end(),
+                                   [&](const std::unique_ptr<HookRunner>& h) { return h && h->cfg == hc; });
+            if (it != s.hooks.end()) {
+                next.push_back(std::move(*it));
+                continue;
+            }
+            next.push_back(std::make_unique<HookRunner>(s, reactor, hc));
+            next.back()->start();
+        }
+        for (auto& h : s.hooks)
+            if (h) retired_hooks.push_back(std::move(h));
+        s.hooks.swap(next);
+    }
+    retired_hooks.clear();      // stops them, outside the lock publishers take
+
+    // Links to unchanged children stay connected and keep their probes.
+    std::vector<std::unique_ptr<ChildLink>> retired_children;
+    {
+        std::lock_guard<std::mutex> lk(s.children_mu);
+        std::vector<std::unique_ptr<ChildLink>> next;
+        for (const ChildConfig& cc : cfg.children) {
+            auto it = std::find_if(s.children.begin(), s.children.end(),
+                                   [&](const std::unique_ptr<ChildLink>& c) { return c && c->cfg == cc; });
+            if (it != s.children.end()) {
+                next.push_back(std::move(*it));
+                continue;
+            }
+            next.push_back(std::make_unique<ChildLink>(s, cc));
+            next.back()->start();
+        }
+        for (auto& c : s.children)
+            if (c) retired_children.push_back(std::move(c));
+        s.children.swap(next);
+    }
+    retired_children.clear();
+    notify_change(s);
+    std::fprintf(stderr, "config: %d probe(s) kept (%d retuned), %zu started, %zu stopped\n",
+                 kept, tuned, started.size(), retired.size() + retired_batches.size());
+}
+
+// ----- Watch the config file -----
+void ConfigWatcher::start() {
+    auto slash = path_.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : path_.substr(0, slash ? slash : 1);
+    base_ = (slash == std::string::npos) ? path_ : path_.substr(slash + 1);
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0 || pipe2(stop_pipe_, O_CLOEXEC) != 0 ||
+        inotify_add_watch(inotify_fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+        std::fprintf(stderr, "config: cannot watch %s: %s\n", dir.c_str(), std::strerror(errno));
+        return;
+    }
+    thread_ = std::thread([this] { run(); });
+}
+
+void ConfigWatcher::stop() {
+    if (thread_.joinable()) {
+        char c = 0;
+        (void)!write(stop_pipe_[1], &c, 1);
+        thread_.join();
+    }
+    for (int& fd : stop_pipe_) if (fd >= 0) { close(fd); fd = -1; }
+    if (inotify_fd_ >= 0) { close(inotify_fd_); inotify_fd_ = -1; }
+}
+
+void ConfigWatcher::run() {
+    alignas(inotify_event) char buf[4096];
+    pollfd fds[2] = { {inotify_fd_, POLLIN, 0}, {stop_pipe_[0], POLLIN, 0} };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+        bool changed = false;
+        ssize_t n;
+        while ((n = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + n; ) {
+                auto* ev = reinterpret_cast<inotify_event*>(p);
+                if (ev->len && base_ == ev->name) changed = true;
+                p += sizeof(inotify_event) + ev->len;
+            }
+        }
+        if (changed) on_change_();
+    }
+}
+
+// ----- Monitor: the public face of the engine -----
+struct Monitor::Impl {
+    Options opts;
+    AppState state;
+    ScriptResolver resolver;
+    Reactor reactor;
+    StateSaver saver;
+    std::unique_ptr<HistoryWriter> history;
+    PassiveReceiver passive;
+    std::vector<SavedProbe> restored;   // seeds the first apply(), then dropped
+    bool started = false;
+    const long long process_start = process_start_us();
+    std::atomic<long long> startup_marks[4] = {};   // by StartupStep
+
+    explicit Impl(Options o) : opts(std::move(o)), saver(state, opts.state_path), passive(state) {}
+};
+
+Monitor::Monitor() : Monitor(Options()) {}
+
+Monitor::Monitor(Options opts) : impl_(std::make_unique<Impl>(std::move(opts))) {
+    impl_->state.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+Monitor::~Monitor() {
+    stop();
+    if (impl_->state.event_fd >= 0) close(impl_->state.event_fd);
+}
+
+bool Monitor::start() {
+    Impl& m = *impl_;
+    if (m.started) return true;
+    if (!check_fault_spec()) return false;
+    m.resolver.start();
+    if (!m.reactor.start()) return false;
+    m.restored = load_state(m.opts.state_path);
+    m.saver.start();
+    if (!m.opts.history_dir.empty()) {
+        if (!m.history) m.history = std::make_unique<HistoryWriter>(m.opts.history_dir, m.opts.history_keep_bytes);
+        m.history->start();
+        m.state.history = m.history.get();
+    }
+    m.passive.start(m.reactor, m.opts);     // without its sockets the other probes still run
+    m.started = true;
+    return true;
+}
+
+bool Monitor::apply(const Config& cfg) {
+    Impl& m = *impl_;
+    if (!check_fault_names(cfg)) {
+        std::fprintf(stderr, "config: not applied\n");
+        return false;
+    }
+    apply_config(m.state, m.resolver, m.reactor, cfg, m.restored);
+    m.restored.clear();
+    return true;
+}
+
+void Monitor::stop() {
+    Impl& m = *impl_;
+    if (!m.started) return;
+    AppState& s = m.state;
+    m.passive.stop(m.reactor);
+    std::unique_ptr<Cluster> cluster;
+    {
+        std::lock_guard<std::mutex> lk(s.cluster_mu);
+        cluster.swap(s.cluster);
+    }
+    cluster.reset();
+    // Batch runners first: they feed some of the probes.
+    for (auto& p : s.batches) signal_stop(*p, m.resolver);
+    for (auto& p : s.probes) signal_stop(*p, m.resolver);
+    for (auto& p : s.batches) stop_probe(*p, m.resolver);
+    for (auto& p : s.probes) stop_probe(*p, m.resolver);
+    std::vector<std::unique_ptr<ChildLink>> children;
+    {
+        std::lock_guard<std::mutex> lk(s.children_mu);
+        children.swap(s.children);
+    }
+    children.clear();           // they feed the hooks
+    std::vector<std::unique_ptr<HookRunner>> hooks;
+    {
+        std::lock_guard<std::mutex> lk(s.hooks_mu);
+        hooks.swap(s.hooks);
+    }
+    hooks.clear();              // pending changes are not run at exit
+    m.saver.stop();
+    if (m.history) m.history->stop();
+    m.reactor.stop();
+    m.resolver.stop();
+    m.started = false;
+}
+
+unsigned Monitor::generation() const { return impl_->state.generation.load(); }
+
+int Monitor::subscribe(std::function<void(unsigned)> fn) {
+    AppState& s = impl_->state;
+    std::lock_guard<std::mutex> lk(s.subs_mu);
+    s.subs.emplace_back(s.next_sub, std::move(fn));
+    return s.next_sub++;
+}
+
+void Monitor::unsubscribe(int id) {
+    AppState& s = impl_->state;
+    std::lock_guard<std::mutex> lk(s.subs_mu);
+    s.subs.erase(std::remove_if(s.subs.begin(), s.subs.end(), [&](const auto& sub) { return sub.first == id; }),
+                 s.subs.end());
+}
+
+int Monitor::change_fd() const { return impl_->state.event_fd; }
+
+unsigned Monitor::consume_changes() {
+    std::uint64_t n;
+    while (read(impl_->state.event_fd, &n, sizeof(n)) > 0) {}
+    return generation();
+}
+
+unsigned Monitor::snapshot(std::vector<ProbeView>& out, LayoutConfig* layout) const {
+    AppState& s = impl_->state;
+    std::lock_guard<std::mutex> lk(s.probes_mu);
+    out.resize(s.probes.size());
+    for (std::size_t i = 0; i < out.size(); ++i) {
+        const Probe& p = *s.probes[i];
+        ProbeView& v = out[i];
+        v.name = p.cfg.name;
+        v.group = p.cfg.group;
+        v.state = p.state.load();
+        v.stale = p.stale.load();
+        v.metric = p.metric.load();
+        v.first_result = p.first_result.load();
+        v.p99 = p.stats.p99();
+        v.availability = p.stats.availability();
+        v.last_change = p.stats.last_change();
+        std::lock_guard<std::mutex> plk(p.perf_mu);
+        v.perf_count = p.perf_count;
+        std::copy(p.perf, p.perf + p.perf_count, v.perf);
+    }
+    {
+        std::lock_guard<std::mutex> clk(s.children_mu);
+        for (const auto& c : s.children) c->append_to(out);
+    }
+    if (layout) {
+        layout->slots = s.layout_slots.load();
+        layout->max_diameter = s.layout_max_diameter.load();
+    }
+    return s.generation.load();
+}
+
+bool Monitor::last_failure(const std::string& name, std::string& text) const {
+    AppState& s = impl_->state;
+    std::lock_guard<std::mutex> lk(s.probes_mu);
+    for (const auto& p : s.probes)
+        if (p->cfg.name == name) return p->output.last_failure(text);
+    return false;
+}
+
+long long Monitor::first_spawn() const { return impl_->state.first_spawn.load(); }
+
+void Monitor::mark_startup(StartupStep step, long long us) {
+    long long expected = 0;
+    impl_->startup_marks[static_cast<int>(step)].compare_exchange_strong(expected, us);
+}
+
+StartupTimeline Monitor::startup() const {
+    const Impl& m = *impl_;
+    StartupTimeline t;
+    t.process_start = m.process_start;
+    t.main_entry = m.startup_marks[static_cast<int>(StartupStep::MainEntry)].load();
+    t.ui_init = m.startup_marks[static_cast<int>(StartupStep::UiInit)].load();
+    t.window_shown = m.startup_marks[static_cast<int>(StartupStep::WindowShown)].load();
+    t.first_paint = m.startup_marks[static_cast<int>(StartupStep::FirstPaint)].load();
+    t.first_spawn = m.state.first_spawn.load();
+    return t;
+}
+
+EngineCounters Monitor::counters() const {
+    const Impl& m = *impl_;
+    EngineCounters c;
+    c.results = m.state.results.load(std::memory_order_relaxed);
+    c.spawns = m.state.spawns.load(std::memory_order_relaxed);
+    c.wakeups = m.state.cycles.load(std::memory_order_relaxed) + m.reactor.wakeups();
+    c.passive = m.state.passive_results.load(std::memory_order_relaxed);
+    c.passive_ignored = m.state.passive_ignored.load(std::memory_order_relaxed);
+    c.child_updates = m.state.child_updates.load(std::memory_order_relaxed);
+    c.child_bytes = m.state.child_bytes.load(std::memory_order_relaxed);
+    c.peer_results = m.state.peer_results.load(std::memory_order_relaxed);
+    c.peer_sent = m.state.peer_sent.load(std::memory_order_relaxed);
+    c.history_dropped = m.history ? m.history->dropped() : 0;
+    return c;
+}
+
+bool Monitor::history(const std::string& name, const HistoryQuery& q, std::vector<HistorySample>& out,
+                      HistoryScanStats* stats) const {
+    const Impl& m = *impl_;
+    if (m.opts.history_dir.empty()) return false;
+    if (m.history) return m.history->read(name, q, out, stats);
+    return read_history(history_file(m.opts.history_dir, name), q, out, stats);
+}
+
+bool Monitor::responsive() { return impl_->reactor.responsive(); }
+
+// ----- One-line status text -----
+
+void format_status_line(const std::vector<ProbeView>& probes, char* buf, std::size_t len) {
+    auto to_str = [](ProbeState st) -> const char* {
+        switch (st) {
+            case ProbeState::Ok:       return "OK";
+            case ProbeState::Degraded: return "degraded";
+            case ProbeState::Fail:     return "down";
+            case ProbeState::Unknown:
+            default:                   return "unknown";
+        }
+    };
+
+    std::size_t used = 0;
+    buf[0] = '\0';
+    for (const auto& p : probes) {
+        if (used >= len) break;
+        int n = std::snprintf(buf + used, len - used, "%s%s=%s%s", used ? ", " : "",
+                              p.name.c_str(), to_str(p.state), p.stale ? "?" : "");
+        if (n < 0) break;
+        if (const double v = p.metric; !std::isnan(v) && used + n < len)
+            n += std::snprintf(buf + used + n, len - used - n, " (%g)", v);
+        used += static_cast<std::size_t>(n);
+    }
+}
+
+// ----- Startup report -----
+
+void format_startup_report(const StartupTimeline& t, const std::vector<ProbeView>& probes, char* buf,
+                           std::size_t len) {
+    const long long t0 = t.process_start ? t.process_start : t.main_entry;
+    std::size_t used = 0;
+    buf[0] = '\0';
+    auto add = [&](const char* key, const char* sub, long long mark) {
+        if (used >= len) return;
+        int n = mark ? std::snprintf(buf + used, len - used, "%s%s%s%s=%.1f", used ? " " : "", key,
+                                     sub ? "." : "", sub ? sub : "", (mark - t0) / 1000.0)
+                     : std::snprintf(buf + used, len - used, "%s%s%s%s=-", used ? " " : "", key,
+                                     sub ? "." : "", sub ? sub : "");
+        if (n > 0) used += static_cast<std::size_t>(n);
+    };
+    add("main", nullptr, t.main_entry);
+    add("ui_init", nullptr, t.ui_init);
+    add("window_shown", nullptr, t.window_shown);
+    add("first_paint", nullptr, t.first_paint);
+    add("first_spawn", nullptr, t.first_spawn);
+    for (const auto& p : probes) add("first_result", p.name.c_str(), p.first_result);
+}
+
+}  // namespace nsm
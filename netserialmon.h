@@ -0,0 +1,389 @@
+/*
+ * netserialmon - the probe engine of Net & Serial Monitor as a library
+ *
+ * A Monitor runs probes (scripts, Nagios plugins, batch scripts and native
+ * plugins) on its own background threads and keeps their latest state. The
+ * threads are one worker per probe and per batch script plus the poll loop, the
+ * script watcher and the state saver, and, when configured, one per hook and per
+ * child monitor, the cluster thread and the history writer; subscriber
+ * callbacks run on them, so embedding the engine adds no threads of its own.
+ * The front ends in dashboard.h, exporter.h, feed.h and service_notify.h each
+ * run one more thread while started. The FLTK window in main.cpp is one consumer.
+ *
+ *     nsm::Monitor mon({state_path});
+ *     mon.start();
+ *     nsm::Config cfg;
+ *     if (nsm::load_config(path, cfg)) mon.apply(cfg);
+ *     mon.subscribe([](unsigned) { ... });     // or poll mon.change_fd()
+ *     std::vector<nsm::ProbeView> view;
+ *     mon.snapshot(view);
+ */
+#ifndef NETSERIALMON_H
+#define NETSERIALMON_H
+
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nsm {
+
+// ----- Probe state: unknown / ok / degraded / fail -----
+enum class ProbeState : int { Unknown = -1, Fail = 0, Ok = 1, Degraded = 2 };
+
+const char* state_name(ProbeState st);             // "ok", "degraded", "fail", "unknown"
+ProbeState state_from_name(const std::string& name);
+
+// ----- Configuration -----
+//
+// Usually read from an INI-style file with load_config():
+//
+//   [layout]
+//   slots = 3              # minimum number of circles (unused ones stay gray)
+//   max_diameter = 100
+//
+//   [probe network]        # one section per probe, shown in this order
+//   group = uplinks        # optional heading to show the probe under
+//   type = script          # or "nagios" (exit codes 0-3 and perfdata)
+//                          # or a plugin type, which gets args and needs no script
+//   script = test_network.sh
+//   args = 192.168.0.1     # appended to the command line as shell words
+//   interval_ms = 2000     # pause between runs
+//   timeout_ms = 0         # kill the script after this long (0 = no limit)
+//   fail_threshold = 1     # consecutive failures before the circle turns red
+//   match_ok = 0% packet loss      # optional output matchers
+//   match_fail = Destination Host Unreachable
+//   metric = time=([0-9.]+) ms
+//   ignore_exit = 0        # 1: let match_ok alone decide success
+//   shared = 0             # 1: probed by one [cluster] member, results shared
+//
+//   [batch sitecheck]      # one script reporting many probes
+//   script = check_site.sh
+//   args, interval_ms, timeout_ms as for probes
+//
+//   [probe switch-3]
+//   batch = sitecheck      # state comes from the "switch-3 ..." line; no script
+//
+//   [probe door-sensor]
+//   type = passive         # results are pushed by other programs, see Monitor::Options
+//   stale_after_ms = 30000 # shown stale when nothing arrives for this long (0 = never)
+//
+//   [hook sms]             # command run when probes change state
+//   command = send-sms.sh  # gets "name old new [metric]" lines on stdin, one per probe
+//   args = +491701234567
+//   on = fail ok           # states whose arrival is reported (default: fail ok)
+//   probes = ups door      # only these probes (default: all)
+//   batch_ms = 2000        # collect changes this long into one run
+//   min_interval_ms = 60000    # at most one run per this long
+//   timeout_ms = 30000
+//
+//   [child pi-17]          # another instance whose probes are shown here as
+//   address = 10.0.0.17:7010   # "pi-17/<probe>"; it serves them with FeedServer
+//
+//   [cluster]              # peers that split the shared probes between them
+//   name = pi-1            # this instance (default: the host name)
+//   listen = 0.0.0.0:7020  # UDP, for heartbeats and results
+//   peers = 10.0.0.2:7020 10.0.0.3:7020
+//   heartbeat_ms = 1000
+//   dead_after_ms = 3500   # a peer silent this long is out
+//
+struct OutputMatchers;              // compiled patterns (internal)
+
+enum class ProbeType { Script, Nagios, Batch, Plugin, Passive };
+
+struct ProbeConfig {
+    std::string name;
+    ProbeType type = ProbeType::Script;
+    std::string script;
+    std::string args;
+    std::string batch;              // set: fed by that batch instead of running a script
+    std::string plugin;             // type Plugin: the plugin's probe type name
+    std::string group;              // display heading; empty: none
+    int interval_ms = 2000;
+    int timeout_ms = 0;
+    int fail_threshold = 1;
+    int stale_after_ms = 0;         // type Passive: freshness timeout, 0 = none
+    std::string match_ok, match_fail, metric;
+    bool ignore_exit = false;
+    bool shared = false;            // probed by one cluster member, the others take its results
+    std::shared_ptr<const OutputMatchers> matchers;     // compiled from the three patterns
+
+    // Type, script, arguments and output matchers define what is probed; changing them rebuilds the probe.
+    bool same_target(const ProbeConfig& o) const {
+        return type == o.type && plugin == o.plugin && script == o.script && args == o.args &&
+               batch == o.batch && match_ok == o.match_ok && match_fail == o.match_fail &&
+               metric == o.metric && ignore_exit == o.ignore_exit && shared == o.shared;
+    }
+    bool same_tuning(const ProbeConfig& o) const {
+        return interval_ms == o.interval_ms && timeout_ms == o.timeout_ms && fail_threshold == o.fail_threshold &&
+               stale_after_ms == o.stale_after_ms;
+    }
+};
+
+struct LayoutConfig {
+    int slots = 3;
+    int max_diameter = 100;
+};
+
+// Transition hook. Changes are queued per probe, so a probe that flaps back to its
+// last reported state before the hook runs is not reported at all, and a probe's
+// first result only sets the state later changes are reported against.
+struct HookConfig {
+    std::string name;
+    std::string command;
+    std::string args;
+    std::vector<ProbeState> on{ProbeState::Fail, ProbeState::Ok};
+    std::vector<std::string> probes;    // empty: all
+    int batch_ms = 2000;
+    int min_interval_ms = 10000;
+    int timeout_ms = 30000;
+
+    bool operator==(const HookConfig& o) const {
+        return name == o.name && command == o.command && args == o.args && on == o.on && probes == o.probes &&
+               batch_ms == o.batch_ms && min_interval_ms == o.min_interval_ms && timeout_ms == o.timeout_ms;
+    }
+};
+
+// Child monitor (see feed.h). Its probes follow the local ones, under a heading
+// with the child's name, after a probe of that name that is ok while the link is
+// up and fails while it is down. While down, the child's probes are shown stale.
+struct ChildConfig {
+    std::string name;
+    std::string host;
+    int port = 7010;
+
+    bool operator==(const ChildConfig& o) const { return name == o.name && host == o.host && port == o.port; }
+};
+
+// Cooperative probing. Members that hear each other's heartbeats place themselves
+// on a consistent-hash ring, and each shared probe runs only on the member that
+// owns its name; that member sends every result to the others. When a member
+// falls silent the ring is rebuilt without it, and only its probes move. All
+// members need the same shared probes in their configs.
+struct ClusterConfig {
+    std::string name;               // empty: the host name
+    std::string listen_host = "0.0.0.0";
+    int listen_port = 0;            // 0: no cluster
+    std::vector<std::string> peers; // HOST:PORT of the other members
+    int heartbeat_ms = 1000;
+    int dead_after_ms = 3500;
+
+    bool operator==(const ClusterConfig& o) const {
+        return name == o.name && listen_host == o.listen_host && listen_port == o.listen_port && peers == o.peers &&
+               heartbeat_ms == o.heartbeat_ms && dead_after_ms == o.dead_after_ms;
+    }
+};
+
+struct Config {
+    std::vector<ProbeConfig> probes;
+    std::vector<ProbeConfig> batches;   // type Batch; not displayed themselves
+    std::vector<HookConfig> hooks;
+    std::vector<ChildConfig> children;
+    ClusterConfig cluster;
+    LayoutConfig layout;
+};
+
+// Built-in probes used when there is no config file: network and serial.
+Config default_config();
+
+// $XDG_CONFIG_HOME (or ~/.config)/net-serial-monitor.conf
+std::string default_config_path();
+
+// $XDG_STATE_HOME (or ~/.local/state)/net-serial-monitor.state
+std::string default_state_path();
+
+// Parse path into cfg. On any error a message is printed and cfg is left untouched.
+// A missing file is reported through *missing instead of a message.
+bool load_config(const std::string& path, Config& cfg, bool* missing = nullptr);
+
+// Make the probe types of every *.so in dir (see nsm_plugin.h) usable as
+// "type = NAME" in later load_config() calls. Call before loading the config.
+void load_plugins(const std::string& dir);
+std::string default_plugin_dir();
+
+// Microseconds on CLOCK_BOOTTIME; the unit of ProbeView::first_result.
+long long boottime_us();
+
+// Replace path with data through a temp file and rename: readers see either the
+// old or the new contents, never a torn file.
+bool write_file_atomic(const std::string& path, const std::string& data);
+
+// ----- Watch a config file and call back on change -----
+// Watches the containing directory so editors that save by rename are caught too.
+// on_change runs on the watcher's own thread.
+class ConfigWatcher {
+public:
+    ConfigWatcher(std::string path, std::function<void()> on_change)
+        : path_(std::move(path)), on_change_(std::move(on_change)) {}
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+    ~ConfigWatcher() { stop(); }
+
+    void start();
+    void stop();
+
+private:
+    std::string path_, base_;
+    std::function<void()> on_change_;
+    int inotify_fd_ = -1;
+    int stop_pipe_[2] = {-1, -1};
+    std::thread thread_;
+
+    void run();
+};
+
+// ----- The engine -----
+// One value of a nagios plugin's performance data ("rta=0.8ms;100;500;0").
+struct PerfMetric {
+    char label[32];
+    char uom[8];                    // unit of measurement: "ms", "%", "B", ...
+    double value;
+};
+
+// One probe as seen from outside, copied out by Monitor::snapshot().
+struct ProbeView {
+    static constexpr int kMaxPerf = 8;
+
+    std::string name;
+    std::string group;
+    ProbeState state = ProbeState::Unknown;
+    bool stale = false;             // restored from the state file, not yet refreshed
+    double metric = NAN;            // headline number, NAN if the probe has none
+    long long first_result = 0;     // boottime_us() of the first result, 0 until then
+    double p99 = NAN;               // of the metric over the last 128 results that had one
+    double availability = NAN;      // share of results that were not failures, NAN until one
+    long long last_change = 0;      // time() of the last state change, 0 if none seen yet
+    PerfMetric perf[kMaxPerf];      // nagios probes: perfdata of the last run
+    int perf_count = 0;
+};
+
+// Running totals of engine activity; rates come from the difference of two reads.
+struct EngineCounters {
+    unsigned long long results = 0;     // probe results published (batch members each count)
+    unsigned long long spawns = 0;      // script processes started
+    unsigned long long wakeups = 0;     // worker cycles plus poll loop returns
+    unsigned long long passive = 0;     // results pushed to passive probes (also in results)
+    unsigned long long passive_ignored = 0;     // pushed lines that matched no passive probe or did not parse
+    unsigned long long child_updates = 0;   // probe values received from child monitors
+    unsigned long long child_bytes = 0;     // read from child monitors, framing included
+    unsigned long long peer_results = 0;    // shared probe results received from cluster members
+    unsigned long long peer_sent = 0;       // shared probe results sent to them (once per member)
+    unsigned long long history_dropped = 0; // history blocks lost because writing them fell behind
+};
+
+// Startup timeline: microseconds on CLOCK_BOOTTIME (boottime_us()), 0 for a step
+// not reached yet or not taken (a headless front end shows no window).
+struct StartupTimeline {
+    long long process_start = 0;    // when the kernel started the process, so exec and linking count
+    long long main_entry = 0;       // this and the next three are marked by the front end
+    long long ui_init = 0;          // widgets constructed
+    long long window_shown = 0;
+    long long first_paint = 0;
+    long long first_spawn = 0;      // the first probe process
+};
+
+enum class StartupStep { MainEntry, UiInit, WindowShown, FirstPaint };
+
+struct HistoryQuery;                // history.h
+struct HistorySample;
+struct HistoryScanStats;
+
+class Monitor {
+public:
+    // Passive probes get their results from datagrams sent to passive_socket (a Unix
+    // datagram socket) or passive_udp_port, one result per line in the batch format:
+    //
+    //   name status [metric]       e.g. "door-sensor ok" or "ups-load degraded 81.5"
+    //
+    // Lines for unknown or non-passive probes are ignored. Results go straight into
+    // the probe's state from the engine's poll loop; nothing is spawned.
+    struct Options {
+        std::string state_path;     // last-known state, saved and restored; empty: off
+        std::string passive_socket; // path to bind; empty: none
+        std::string passive_udp_host = "127.0.0.1";
+        int passive_udp_port = 0;   // 0: no UDP listener
+        std::string history_dir;    // every result, compressed, one file per probe (history.h); empty: off
+        std::size_t history_keep_bytes = 4 << 20;  // per probe; the oldest blocks go first
+    };
+
+    Monitor();
+    explicit Monitor(Options opts);
+    ~Monitor();                     // stops everything
+    Monitor(const Monitor&) = delete;
+    Monitor& operator=(const Monitor&) = delete;
+
+    // Start the engine threads. Probes start with the first apply(). False, with a
+    // message on stderr, if the poll loop cannot start or NSM_FAULTS is invalid.
+    bool start();
+    // Register, retune and remove probes as a diff against the running ones; probes
+    // whose target is unchanged keep their worker and state. False, applying
+    // nothing, if NSM_FAULTS names a probe that cfg does not have.
+    bool apply(const Config& cfg);
+    // Stop all probes and engine threads. Also done by the destructor.
+    void stop();
+
+    // Changes: generation() grows on every state change of a probe (not on metric
+    // updates alone) and on apply(). Subscribers are called with the new generation
+    // on the engine thread that made the change, so they must be quick and must not
+    // call back into the Monitor. Once unsubscribe() returns, fn is not running.
+    unsigned generation() const;
+    int subscribe(std::function<void(unsigned generation)> fn);
+    void unsubscribe(int id);
+
+    // An eventfd that is readable after a change; consume_changes() re-arms it and
+    // returns the current generation. Suits poll()/epoll or a GUI loop's fd watch.
+    int change_fd() const;
+    unsigned consume_changes();
+
+    // Copy the current state of all probes into out, in display order: the local
+    // probes, then each child monitor's link probe and probes. The storage
+    // of out is reused, so calling this repeatedly does not allocate in steady state.
+    // Returns the generation the copy reflects.
+    unsigned snapshot(std::vector<ProbeView>& out, LayoutConfig* layout = nullptr) const;
+
+    // Output of the probe's most recent failed run, with a header line.
+    bool last_failure(const std::string& name, std::string& text) const;
+
+    // boottime_us() when the first probe process was spawned, 0 until then.
+    long long first_spawn() const;
+
+    // The startup timeline. The engine fills in process_start and first_spawn; the
+    // front end marks its own steps, each once (later marks of a step are ignored).
+    // Safe from any thread.
+    void mark_startup(StartupStep step, long long us);
+    StartupTimeline startup() const;
+
+    // Cheap to call; counted with relaxed atomics on the engine's hot paths.
+    EngineCounters counters() const;
+
+    // Results of the probe called name recorded under Options::history_dir that
+    // match q, oldest first, including those not yet written out. False if history
+    // is off or there is none for name.
+    bool history(const std::string& name, const HistoryQuery& q, std::vector<HistorySample>& out,
+                 HistoryScanStats* stats = nullptr) const;
+
+    // For watchdogs: true if the engine's poll loop has come round since the
+    // previous call. Each call wakes the loop, so call it at most as often as a
+    // stall should be noticed; a loop stuck in a handler reads false.
+    bool responsive();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// "name=STATE (metric), ..." for all probes, into buf, truncated to len; STATE is
+// OK, degraded, down or unknown, with a '?' while stale. Does not allocate.
+void format_status_line(const std::vector<ProbeView>& probes, char* buf, std::size_t len);
+
+// "main=5.8 ui_init=9.1 ... first_result.NAME=1011.4": each mark in milliseconds
+// since the process started, "-" for a step not reached and a probe that has not
+// reported yet. Does not allocate.
+void format_startup_report(const StartupTimeline& t, const std::vector<ProbeView>& probes, char* buf,
+                           std::size_t len);
+
+}  // namespace nsm
+
+#endif  // NETSERIALMON_H
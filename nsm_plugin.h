@@ -0,0 +1,80 @@
+/*
+ * Net & Serial Monitor - native probe plugin interface
+ *
+ * A plugin is a shared object in the plugin directory that exports
+ *
+ *     const nsm_probe_type* const* nsm_plugin_types(uint32_t host_abi);
+ *
+ * returning a NULL-terminated list of probe types (or NULL if it cannot work
+ * with host_abi). A probe section selects a type with "type = NAME" and its
+ * "args" string is handed to init().
+ *
+ * One sample runs as:
+ *
+ *     start()   -> fd to wait on, or -1 if the result is already known
+ *     poll_fd() -> called from the monitor's poll loop each time fd is ready,
+ *                  until it returns 1
+ *     complete() fills in the result (also after a timeout, with timed_out=1)
+ *
+ * so a plugin never blocks and never needs a thread of its own. Calls for one
+ * instance never overlap, but instances of the same type may be called from
+ * different threads. Only C types cross this boundary; the version is bumped
+ * on any incompatible change.
+ */
+#ifndef NSM_PLUGIN_H
+#define NSM_PLUGIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NSM_PLUGIN_ABI_VERSION 1u
+
+/* Result status, same meaning as Nagios plugin exit codes */
+enum {
+    NSM_STATUS_OK       = 0,
+    NSM_STATUS_DEGRADED = 1,
+    NSM_STATUS_FAIL     = 2,
+    NSM_STATUS_UNKNOWN  = 3
+};
+
+typedef struct nsm_result {
+    int    status;          /* NSM_STATUS_* */
+    int    has_metric;      /* non-zero: metric is valid */
+    double metric;          /* shown under the probe's circle */
+    char   message[256];    /* shown when the probe's circle is clicked */
+} nsm_result;
+
+typedef struct nsm_probe_type {
+    uint32_t    abi_version;    /* NSM_PLUGIN_ABI_VERSION the plugin was built with */
+    const char* name;           /* "type = NAME" in the config file */
+
+    /* Create an instance for one probe. On failure return NULL and describe the
+     * problem in err. */
+    void* (*init)(const char* args, char* err, size_t err_len);
+
+    /* Begin a sample. Return an fd and set *events (POLLIN/POLLOUT) to wait for,
+     * or return -1 when the result is known at once. */
+    int (*start)(void* inst, short* events);
+
+    /* fd became ready with revents. Return 1 when the sample is done, or 0 to
+     * keep waiting for *events (which may be changed). */
+    int (*poll_fd)(void* inst, short revents, short* events);
+
+    /* Finish the sample and release its fd. timed_out is non-zero if the
+     * monitor gave up waiting. */
+    void (*complete)(void* inst, int timed_out, nsm_result* result);
+
+    void (*destroy)(void* inst);
+} nsm_probe_type;
+
+typedef const nsm_probe_type* const* (*nsm_plugin_types_fn)(uint32_t host_abi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NSM_PLUGIN_H */
@@ -0,0 +1,380 @@
+/*
+ * Streaming output matchers: the small regex dialect of match_ok, match_fail and
+ * metric (see netserialmon.h), compiled to DFAs; internal to the library.
+ */
+#ifndef NSM_OUTPUT_MATCH_H
+#define NSM_OUTPUT_MATCH_H
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nsm {
+
+// ----- Streaming output matchers (precompiled DFAs) -----
+//
+// Patterns use a small regex dialect: literals, '.', classes such as [0-9a-f] or
+// [^ ], \d \w \s (and backslash-escaped metacharacters), the quantifiers * + ?,
+// alternation | and grouping ( ). Each pattern is compiled once, when the config is
+// loaded, into a byte-indexed DFA, so matching costs one table lookup per output
+// byte as it arrives from the pipe and the output itself is never buffered.
+class Dfa {
+public:
+    static constexpr int kDead = -1;
+    static constexpr int kMaxStates = 1024;
+
+    // search: the match may start anywhere; otherwise it must start at the first byte fed.
+    bool compile(const std::string& re, bool search, std::string& err) {
+        Nfa nfa;
+        std::size_t pos = 0;
+        Frag f;
+        if (!nfa.parse_alt(re, pos, f, err)) return false;
+        if (pos != re.size()) { err = "unbalanced ')'"; return false; }
+        nfa.patch(f, nfa.add(Nfa::Match));
+        return build(nfa, f.start, search, err);
+    }
+
+    bool valid() const { return !accept_.empty(); }
+    int start() const { return 0; }
+    int step(int s, unsigned char c) const { return trans_[static_cast<std::size_t>(s) * 256 + c]; }
+    bool accepting(int s) const { return accept_[static_cast<std::size_t>(s)] != 0; }
+
+private:
+    std::vector<int> trans_;            // state * 256 + byte -> state or kDead
+    std::vector<char> accept_;
+
+    struct Frag {
+        int start = -1;
+        std::vector<std::pair<int, int>> outs;  // dangling exits: (state, 0 = out / 1 = out2)
+    };
+
+    struct Nfa {
+        enum Kind { Char, Split, Match };
+        struct State {
+            Kind kind;
+            std::bitset<256> set;
+            int out = -1, out2 = -1;
+        };
+        std::vector<State> st;
+
+        int add(Kind k) { st.push_back(State{k, {}, -1, -1}); return static_cast<int>(st.size() - 1); }
+
+        void patch(const Frag& f, int to) {
+            for (auto [s, which] : f.outs) (which ? st[s].out2 : st[s].out) = to;
+        }
+
+        static bool escape_set(char c, std::bitset<256>& set) {
+            switch (c) {
+                case 'd': for (int b = '0'; b <= '9'; ++b) set.set(b); return true;
+                case 'w': for (int b = 0; b < 256; ++b) if (std::isalnum(b) || b == '_') set.set(b); return true;
+                case 's': for (char b : {' ', '\t', '\r', '\n', '\f', '\v'}) set.set(static_cast<unsigned char>(b)); return true;
+                case 't': set.set('\t'); return true;
+                case 'n': set.set('\n'); return true;
+                case 'r': set.set('\r'); return true;
+                default:  set.set(static_cast<unsigned char>(c)); return true;
+            }
+        }
+
+        bool parse_class(const std::string& re, std::size_t& pos, std::bitset<256>& set, std::string& err) {
+            bool negate = false;
+            if (pos < re.size() && re[pos] == '^') { negate = true; ++pos; }
+            bool first = true;
+            while (pos < re.size() && (re[pos] != ']' || first)) {
+                first = false;
+                unsigned char lo = static_cast<unsigned char>(re[pos++]);
+                if (lo == '\\' && pos < re.size()) {
+                    char e = re[pos++];
+                    if (e == 'd' || e == 'w' || e == 's') { escape_set(e, set); continue; }
+                    std::bitset<256> one;
+                    escape_set(e, one);
+                    for (int b = 0; b < 256; ++b) if (one[b]) lo = static_cast<unsigned char>(b);
+                }
+                if (pos + 1 < re.size() && re[pos] == '-' && re[pos + 1] != ']') {
+                    unsigned char hi = static_cast<unsigned char>(re[pos + 1]);
+                    pos += 2;
+                    for (int b = lo; b <= hi; ++b) set.set(b);
+                } else {
+                    set.set(lo);
+                }
+            }
+            if (pos >= re.size()) { err = "unterminated '['"; return false; }
+            ++pos;  // ']'
+            if (negate) set.flip();
+            return true;
+        }
+
+        bool parse_atom(const std::string& re, std::size_t& pos, Frag& f, std::string& err) {
+            const char c = re[pos++];
+            if (c == '(') {
+                if (!parse_alt(re, pos, f, err)) return false;
+                if (pos >= re.size() || re[pos] != ')') { err = "missing ')'"; return false; }
+                ++pos;
+                return true;
+            }
+            if (c == '^' || c == '$') { err = "anchors are not supported"; return false; }
+            if (c == '*' || c == '+' || c == '?') { err = "quantifier without operand"; return false; }
+            const int s = add(Char);
+            if (c == '.')                              st[s].set.set().reset('\n');
+            else if (c == '[')                         { if (!parse_class(re, pos, st[s].set, err)) return false; }
+            else if (c == '\\' && pos < re.size())     escape_set(re[pos++], st[s].set);
+            else                                       st[s].set.set(static_cast<unsigned char>(c));
+            f.start = s;
+            f.outs = {{s, 0}};
+            return true;
+        }
+
+        bool parse_repeat(const std::string& re, std::size_t& pos, Frag& f, std::string& err) {
+            if (!parse_atom(re, pos, f, err)) return false;
+            while (pos < re.size() && (re[pos] == '*' || re[pos] == '+' || re[pos] == '?')) {
+                const char q = re[pos++];
+                const int s = add(Split);
+                st[s].out = f.start;
+                if (q == '?') {
+                    f.outs.push_back({s, 1});
+                    f.start = s;
+                } else {
+                    patch(f, s);                    // loop back after each repetition
+                    if (q == '*') f.start = s;
+                    f.outs = {{s, 1}};
+                }
+            }
+            return true;
+        }
+
+        bool parse_concat(const std::string& re, std::size_t& pos, Frag& f, std::string& err) {
+            f = Frag{};
+            while (pos < re.size() && re[pos] != '|' && re[pos] != ')') {
+                Frag next;
+                if (!parse_repeat(re, pos, next, err)) return false;
+                if (f.start < 0) { f = std::move(next); continue; }
+                patch(f, next.start);
+                f.outs = std::move(next.outs);
+            }
+            if (f.start < 0) {                      // empty branch: a pure epsilon
+                const int s = add(Split);
+                f.start = s;
+                f.outs = {{s, 0}};
+            }
+            return true;
+        }
+
+        bool parse_alt(const std::string& re, std::size_t& pos, Frag& f, std::string& err) {
+            if (!parse_concat(re, pos, f, err)) return false;
+            while (pos < re.size() && re[pos] == '|') {
+                ++pos;
+                Frag rhs;
+                if (!parse_concat(re, pos, rhs, err)) return false;
+                const int s = add(Split);
+                st[s].out = f.start;
+                st[s].out2 = rhs.start;
+                f.start = s;
+                f.outs.insert(f.outs.end(), rhs.outs.begin(), rhs.outs.end());
+            }
+            return true;
+        }
+
+        // Char and Match states reachable from the given states through Splits.
+        std::vector<int> closure(std::vector<int> todo) const {
+            std::vector<char> seen(st.size(), 0);
+            std::vector<int> out;
+            while (!todo.empty()) {
+                const int s = todo.back();
+                todo.pop_back();
+                if (s < 0 || seen[static_cast<std::size_t>(s)]) continue;
+                seen[static_cast<std::size_t>(s)] = 1;
+                if (st[s].kind == Split) { todo.push_back(st[s].out); todo.push_back(st[s].out2); }
+                else out.push_back(s);
+            }
+            std::sort(out.begin(), out.end());
+            return out;
+        }
+    };
+
+    // Subset construction. In search mode the start closure is merged into every
+    // state, which is what lets a match begin at any byte.
+    bool build(const Nfa& nfa, int nfa_start, bool search, std::string& err) {
+        const std::vector<int> start = nfa.closure({nfa_start});
+        std::map<std::vector<int>, int> index;
+        std::vector<std::vector<int>> sets;
+        auto intern = [&](const std::vector<int>& set) {
+            auto it = index.find(set);
+            if (it != index.end()) return it->second;
+            const int id = static_cast<int>(sets.size());
+            index.emplace(set, id);
+            sets.push_back(set);
+            return id;
+        };
+        intern(start);
+        for (std::size_t d = 0; d < sets.size(); ++d) {
+            if (sets.size() > static_cast<std::size_t>(kMaxStates)) { err = "pattern too complex"; return false; }
+            const std::vector<int> cur = sets[d];
+            char acc = 0;
+            for (int s : cur) if (nfa.st[s].kind == Nfa::Match) acc = 1;
+            accept_.push_back(acc);
+            for (int c = 0; c < 256; ++c) {
+                std::vector<int> next;
+                for (int s : cur)
+                    if (nfa.st[s].kind == Nfa::Char && nfa.st[s].set[c]) next.push_back(nfa.st[s].out);
+                if (search) next.push_back(nfa_start);
+                std::vector<int> cl = nfa.closure(next);
+                trans_.push_back(cl.empty() ? kDead : intern(cl));
+            }
+        }
+        return true;
+    }
+};
+
+// Compiled matchers of one probe (shared, immutable once loaded).
+//   match_ok:   the run only succeeds if this pattern occurs in the output
+//   match_fail: the run fails if this pattern occurs, whatever the exit code
+//   metric:     pattern with one ( ) group holding a number, e.g. time=([0-9.]+) ms
+//               (the last occurrence in a run wins)
+struct OutputMatchers {
+    Dfa ok, fail;
+    Dfa metric_prefix, metric_group, metric_suffix;     // metric split around its group
+
+    bool has_metric() const { return metric_group.valid(); }
+
+    // Split "pre(group)post" at its first top-level group.
+    static bool split_group(const std::string& re, std::string& pre, std::string& group,
+                            std::string& post, std::string& err) {
+        int depth = 0;
+        std::size_t open = std::string::npos;
+        bool in_class = false;
+        for (std::size_t i = 0; i < re.size(); ++i) {
+            const char c = re[i];
+            if (c == '\\') { ++i; continue; }
+            if (in_class) { if (c == ']') in_class = false; continue; }
+            if (c == '[') { in_class = true; continue; }
+            if (c == '(' && depth++ == 0 && open == std::string::npos) open = i;
+            if (c == ')' && --depth == 0 && open != std::string::npos) {
+                pre = re.substr(0, open);
+                group = re.substr(open + 1, i - open - 1);
+                post = re.substr(i + 1);
+                return true;
+            }
+        }
+        err = "metric pattern needs one ( ) group around the number";
+        return false;
+    }
+
+    bool compile_metric(const std::string& re, std::string& err) {
+        std::string pre, group, post;
+        return split_group(re, pre, group, post, err) &&
+               metric_prefix.compile(pre, true, err) &&
+               metric_group.compile(group, false, err) &&
+               metric_suffix.compile(post, false, err);
+    }
+};
+
+// Per-run matching state, fed from the reactor thread as output arrives.
+struct MatchState {
+    int ok_s = 0, fail_s = 0;
+    bool ok_hit = false, fail_hit = false;
+    enum Phase { Prefix, Group, Suffix } phase = Prefix;
+    int ms = 0;                     // state in the DFA of the current phase
+    char cap[32];                   // group text seen so far
+    int cap_len = 0, cap_accept = -1;
+    char pending[32];               // accepted group text waiting for the suffix
+    bool has_metric = false;
+    double metric = 0;
+
+    void reset(const OutputMatchers& m) {
+        ok_s = fail_s = 0;
+        ok_hit = fail_hit = has_metric = false;
+        enter_prefix(m);
+    }
+
+    void feed(const OutputMatchers& m, const char* data, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            const unsigned char c = static_cast<unsigned char>(data[i]);
+            if (m.ok.valid() && !ok_hit) ok_hit = m.ok.accepting(ok_s = m.ok.step(ok_s, c));
+            if (m.fail.valid() && !fail_hit) fail_hit = m.fail.accepting(fail_s = m.fail.step(fail_s, c));
+            if (m.has_metric()) feed_metric(m, c);
+        }
+    }
+
+    // End of output: a number running up to the last byte still counts if nothing
+    // has to follow it.
+    void finish(const OutputMatchers& m) {
+        if (!m.has_metric() || phase != Group || cap_accept <= 0) return;
+        if (!m.metric_suffix.accepting(m.metric_suffix.start())) return;
+        std::memcpy(pending, cap, static_cast<std::size_t>(cap_accept));
+        pending[cap_accept] = '\0';
+        commit();
+    }
+
+private:
+    void enter_prefix(const OutputMatchers& m) {
+        phase = Prefix;
+        ms = m.metric_prefix.valid() ? m.metric_prefix.start() : 0;
+        if (m.has_metric() && m.metric_prefix.accepting(ms)) enter_group(m);
+    }
+
+    void enter_group(const OutputMatchers& m) {
+        phase = Group;
+        ms = m.metric_group.start();
+        cap_len = 0;
+        cap_accept = m.metric_group.accepting(ms) ? 0 : -1;
+    }
+
+    void commit() {
+        char* end = nullptr;
+        const double v = std::strtod(pending, &end);
+        if (end != pending) { metric = v; has_metric = true; }
+    }
+
+    void feed_metric(const OutputMatchers& m, unsigned char c) {
+        switch (phase) {
+            case Prefix:
+                ms = m.metric_prefix.step(ms, c);
+                if (m.metric_prefix.accepting(ms)) enter_group(m);
+                return;
+            case Group: {
+                const int next = m.metric_group.step(ms, c);
+                if (next != Dfa::kDead && cap_len < static_cast<int>(sizeof(cap)) - 1) {
+                    ms = next;
+                    cap[cap_len++] = static_cast<char>(c);
+                    if (m.metric_group.accepting(ms)) cap_accept = cap_len;
+                    return;
+                }
+                if (cap_accept <= 0) {              // no number here; look for the next prefix
+                    // A group that rejected c as its first byte gets c again straight
+                    // away when the prefix matches the empty string: drop c instead of
+                    // going round in circles.
+                    const bool fresh = cap_len == 0;
+                    enter_prefix(m);
+                    if (!fresh || phase != Group) feed_metric(m, c);
+                    return;
+                }
+                // Longest group match found; bytes after it belong to the suffix.
+                std::memcpy(pending, cap, static_cast<std::size_t>(cap_accept));
+                pending[cap_accept] = '\0';
+                const int rest = cap_len - cap_accept;
+                char tail[sizeof(cap)];
+                std::memcpy(tail, cap + cap_accept, static_cast<std::size_t>(rest));
+                phase = Suffix;
+                ms = m.metric_suffix.start();
+                if (m.metric_suffix.accepting(ms)) { commit(); enter_prefix(m); }
+                for (int i = 0; i < rest; ++i) feed_metric(m, static_cast<unsigned char>(tail[i]));
+                feed_metric(m, c);
+                return;
+            }
+            case Suffix:
+                ms = m.metric_suffix.step(ms, c);
+                if (ms == Dfa::kDead) { enter_prefix(m); feed_metric(m, c); return; }
+                if (m.metric_suffix.accepting(ms)) { commit(); enter_prefix(m); }
+                return;
+        }
+    }
+};
+
+}  // namespace nsm
+
+#endif  // NSM_OUTPUT_MATCH_H
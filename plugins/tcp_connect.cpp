@@ -0,0 +1,127 @@
+// tcp_connect: example native probe plugin for Net & Serial Monitor.
+//
+//   [probe router-ssh]
+//   type = tcp_connect
+//   args = 192.168.0.1 22
+//   timeout_ms = 1000
+//
+// Each sample is one non-blocking connect(); the metric is the connect time in ms.
+// The address is resolved once, when the probe is created.
+#include "nsm_plugin.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+struct Instance {
+    sockaddr_storage addr{};
+    socklen_t addr_len = 0;
+    char target[128] = {};
+    int fd = -1;
+    int error = 0;              // errno of the current sample, 0 if connected
+    bool connected = false;
+    timespec t0{};
+};
+
+double elapsed_ms(const timespec& t0) {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t0.tv_sec) * 1e3 + (now.tv_nsec - t0.tv_nsec) / 1e6;
+}
+
+void* tcp_init(const char* args, char* err, size_t err_len) {
+    char host[96], port[16];
+    if (std::sscanf(args, "%95s %15s", host, port) != 2) {
+        std::snprintf(err, err_len, "args must be \"HOST PORT\"");
+        return nullptr;
+    }
+    addrinfo hints{};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (int rc = getaddrinfo(host, port, &hints, &res); rc != 0) {
+        std::snprintf(err, err_len, "%s: %s", host, gai_strerror(rc));
+        return nullptr;
+    }
+    auto* in = new (std::nothrow) Instance;
+    if (in) {
+        std::memcpy(&in->addr, res->ai_addr, res->ai_addrlen);
+        in->addr_len = res->ai_addrlen;
+        std::snprintf(in->target, sizeof(in->target), "%s port %s", host, port);
+    }
+    freeaddrinfo(res);
+    return in;
+}
+
+int tcp_start(void* inst, short* events) {
+    auto* in = static_cast<Instance*>(inst);
+    clock_gettime(CLOCK_MONOTONIC, &in->t0);
+    in->connected = false;
+    in->error = 0;
+    in->fd = socket(in->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (in->fd < 0) {
+        in->error = errno;
+        return -1;
+    }
+    if (connect(in->fd, reinterpret_cast<sockaddr*>(&in->addr), in->addr_len) == 0) {
+        in->connected = true;
+        return -1;
+    }
+    if (errno != EINPROGRESS) {
+        in->error = errno;
+        return -1;
+    }
+    *events = POLLOUT;
+    return in->fd;
+}
+
+int tcp_poll_fd(void* inst, short, short*) {
+    auto* in = static_cast<Instance*>(inst);
+    socklen_t len = sizeof(in->error);
+    getsockopt(in->fd, SOL_SOCKET, SO_ERROR, &in->error, &len);
+    in->connected = in->error == 0;
+    return 1;
+}
+
+void tcp_complete(void* inst, int timed_out, nsm_result* r) {
+    auto* in = static_cast<Instance*>(inst);
+    if (in->connected && !timed_out) {
+        r->status = NSM_STATUS_OK;
+        r->has_metric = 1;
+        r->metric = elapsed_ms(in->t0);
+        std::snprintf(r->message, sizeof(r->message), "connected to %s in %.1f ms\n", in->target, r->metric);
+    } else {
+        r->status = NSM_STATUS_FAIL;
+        std::snprintf(r->message, sizeof(r->message), "%s: %s\n", in->target,
+                      timed_out ? "no answer" : std::strerror(in->error));
+    }
+    if (in->fd >= 0) close(in->fd);
+    in->fd = -1;
+}
+
+void tcp_destroy(void* inst) {
+    auto* in = static_cast<Instance*>(inst);
+    if (in->fd >= 0) close(in->fd);
+    delete in;
+}
+
+const nsm_probe_type tcp_connect_type = {
+    NSM_PLUGIN_ABI_VERSION, "tcp_connect",
+    tcp_init, tcp_start, tcp_poll_fd, tcp_complete, tcp_destroy,
+};
+
+const nsm_probe_type* const types[] = { &tcp_connect_type, nullptr };
+
+}  // namespace
+
+extern "C" const nsm_probe_type* const* nsm_plugin_types(uint32_t host_abi) {
+    return host_abi == NSM_PLUGIN_ABI_VERSION ? types : nullptr;
+}
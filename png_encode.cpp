@@ -0,0 +1,197 @@
+/*
+ * Minimal PNG encoder: Sub filter, fixed-Huffman deflate (see png_encode.h)
+ */
+
+#include "png_encode.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace nsm {
+
+namespace {
+
+struct Crc32Table {
+    std::uint32_t t[256];
+    Crc32Table() {
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+    }
+};
+
+std::uint32_t crc32(const unsigned char* p, std::size_t n, std::uint32_t crc = 0) {
+    static const Crc32Table table;
+    crc = ~crc;
+    for (std::size_t i = 0; i < n; ++i) crc = table.t[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+std::uint32_t adler32(const unsigned char* p, std::size_t n) {
+    std::uint32_t a = 1, b = 0;
+    while (n) {
+        const std::size_t chunk = std::min<std::size_t>(n, 5552);   // no overflow before the modulo
+        for (std::size_t i = 0; i < chunk; ++i) {
+            a += p[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        p += chunk;
+        n -= chunk;
+    }
+    return (b << 16) | a;
+}
+
+void put_be32(std::string& out, std::uint32_t v) {
+    const char b[4] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16), static_cast<char>(v >> 8),
+                       static_cast<char>(v)};
+    out.append(b, 4);
+}
+
+// Append a chunk; data is type (4 bytes) followed by the payload, as the CRC covers both.
+void put_chunk(std::string& out, const std::string& data) {
+    put_be32(out, static_cast<std::uint32_t>(data.size() - 4));
+    out += data;
+    put_be32(out, crc32(reinterpret_cast<const unsigned char*>(data.data()), data.size()));
+}
+
+// Deflate bit stream, least significant bit first.
+class BitWriter {
+public:
+    explicit BitWriter(std::string& out) : out_(out) {}
+    void bits(std::uint32_t v, int n) {
+        acc_ |= static_cast<std::uint64_t>(v) << used_;
+        used_ += n;
+        while (used_ >= 8) {
+            out_ += static_cast<char>(acc_ & 0xFF);
+            acc_ >>= 8;
+            used_ -= 8;
+        }
+    }
+    // Huffman codes are defined most significant bit first.
+    void code(std::uint32_t c, int n) {
+        std::uint32_t r = 0;
+        for (int i = 0; i < n; ++i) r |= ((c >> i) & 1) << (n - 1 - i);
+        bits(r, n);
+    }
+    void flush() {
+        if (used_) out_ += static_cast<char>(acc_ & 0xFF);
+        acc_ = 0;
+        used_ = 0;
+    }
+
+private:
+    std::string& out_;
+    std::uint64_t acc_ = 0;
+    int used_ = 0;
+};
+
+// Fixed literal/length code (RFC 1951, 3.2.6)
+void put_symbol(BitWriter& bw, int sym) {
+    if (sym < 144) bw.code(0x30 + sym, 8);
+    else if (sym < 256) bw.code(0x190 + sym - 144, 9);
+    else if (sym < 280) bw.code(sym - 256, 7);
+    else bw.code(0xC0 + sym - 280, 8);
+}
+
+const int kLenBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                          31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int kLenExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int kDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                           1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const int kDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+                            9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+void put_match(BitWriter& bw, int len, int dist) {
+    const int lc = static_cast<int>(std::upper_bound(kLenBase, kLenBase + 29, len) - kLenBase) - 1;
+    put_symbol(bw, 257 + lc);
+    bw.bits(static_cast<std::uint32_t>(len - kLenBase[lc]), kLenExtra[lc]);
+    const int dc = static_cast<int>(std::upper_bound(kDistBase, kDistBase + 30, dist) - kDistBase) - 1;
+    bw.code(static_cast<std::uint32_t>(dc), 5);
+    bw.bits(static_cast<std::uint32_t>(dist - kDistBase[dc]), kDistExtra[dc]);
+}
+
+std::size_t match_length(const unsigned char* p, std::size_t pos, std::size_t end, std::size_t dist) {
+    if (pos < dist) return 0;
+    const std::size_t limit = std::min<std::size_t>(end - pos, 258);
+    std::size_t n = 0;
+    while (n < limit && p[pos + n] == p[pos + n - dist]) ++n;
+    return n;
+}
+
+// One fixed-Huffman block. Candidates are the previous pixel's bytes and the
+// same bytes one row up, which covers flat fills and repeated rows.
+void deflate_fixed(const unsigned char* p, std::size_t n, std::size_t pixel, std::size_t row, std::string& out) {
+    BitWriter bw(out);
+    bw.bits(1, 1);          // final block
+    bw.bits(1, 2);          // fixed Huffman
+    const std::size_t dists[3] = {1, pixel, row};
+    for (std::size_t i = 0; i < n;) {
+        std::size_t best = 0, best_dist = 0;
+        for (std::size_t d : dists) {
+            if (d > 32768) continue;
+            const std::size_t len = match_length(p, i, n, d);
+            if (len > best) {
+                best = len;
+                best_dist = d;
+            }
+        }
+        if (best >= 3) {
+            put_match(bw, static_cast<int>(best), static_cast<int>(best_dist));
+            i += best;
+        } else {
+            put_symbol(bw, p[i++]);
+        }
+    }
+    put_symbol(bw, 256);    // end of block
+    bw.flush();
+}
+
+}  // namespace
+
+bool encode_png(const unsigned char* pixels, int w, int h, int depth, int line_bytes, std::string& out) {
+    int color_type;
+    switch (depth) {
+        case 1: color_type = 0; break;
+        case 3: color_type = 2; break;
+        case 4: color_type = 6; break;
+        default: return false;
+    }
+    if (!pixels || w <= 0 || h <= 0) return false;
+    const std::size_t pitch = static_cast<std::size_t>(w) * depth;
+    const std::size_t stride = line_bytes > 0 ? static_cast<std::size_t>(line_bytes) : pitch;
+
+    // Filtered scanlines: a filter byte (1 = Sub), then each byte minus the one a pixel to its left.
+    std::vector<unsigned char> raw((pitch + 1) * static_cast<std::size_t>(h));
+    for (int y = 0; y < h; ++y) {
+        const unsigned char* src = pixels + stride * static_cast<std::size_t>(y);
+        unsigned char* dst = &raw[(pitch + 1) * static_cast<std::size_t>(y)];
+        dst[0] = 1;
+        for (std::size_t i = 0; i < pitch; ++i)
+            dst[1 + i] = static_cast<unsigned char>(src[i] - (i >= static_cast<std::size_t>(depth) ? src[i - depth] : 0));
+    }
+
+    out.assign("\x89PNG\r\n\x1a\n", 8);
+    std::string chunk("IHDR");
+    put_be32(chunk, static_cast<std::uint32_t>(w));
+    put_be32(chunk, static_cast<std::uint32_t>(h));
+    const char ihdr[5] = {8, static_cast<char>(color_type), 0, 0, 0};    // bit depth, color, deflate, filters, no interlace
+    chunk.append(ihdr, 5);
+    put_chunk(out, chunk);
+
+    chunk.assign("IDAT\x78\x01", 6);     // zlib header: deflate, 32K window, fastest
+    deflate_fixed(raw.data(), raw.size(), static_cast<std::size_t>(depth), pitch + 1, chunk);
+    put_be32(chunk, adler32(raw.data(), raw.size()));
+    put_chunk(out, chunk);
+
+    put_chunk(out, "IEND");
+    return true;
+}
+
+}  // namespace nsm
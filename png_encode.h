@@ -0,0 +1,24 @@
+/*
+ * Minimal PNG encoder, so the library and front ends can publish status images
+ * without linking libpng or zlib.
+ *
+ * Rows are Sub-filtered and deflated with the fixed Huffman code, matching only
+ * runs of the same pixel and repeats of the row above. That is all the flat
+ * colors of a status grid need: an 800x600 grid encodes to some tens of
+ * kilobytes in a few milliseconds.
+ */
+#ifndef NSM_PNG_ENCODE_H
+#define NSM_PNG_ENCODE_H
+
+#include <string>
+
+namespace nsm {
+
+// Encode a w x h image with depth bytes per pixel (1 gray, 3 RGB, 4 RGBA) and
+// line_bytes between row starts (0: w * depth) into out, replacing its contents.
+// False for an unsupported depth or an empty image.
+bool encode_png(const unsigned char* pixels, int w, int h, int depth, int line_bytes, std::string& out);
+
+}  // namespace nsm
+
+#endif  // NSM_PNG_ENCODE_H
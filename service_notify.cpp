@@ -0,0 +1,205 @@
+/*
+ * sd_notify protocol client for running as a service (see service_notify.h)
+ */
+
+#include "service_notify.h"
+#include "alloc_count.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace nsm {
+
+namespace {
+
+constexpr std::size_t kMaxStatus = 1024;    // of the status text; the datagram adds the keys
+
+// WATCHDOG_USEC applies only if WATCHDOG_PID is unset or names this process
+// (a manager that supervises a wrapper script sets it to the script's pid).
+long long watchdog_from_env() {
+    const char* usec = std::getenv("WATCHDOG_USEC");
+    if (!usec || !*usec) return 0;
+    if (const char* pid = std::getenv("WATCHDOG_PID"); pid && *pid && std::atoll(pid) != getpid()) return 0;
+    const long long us = std::atoll(usec);
+    return us > 0 ? us : 0;
+}
+
+}  // namespace
+
+struct ServiceNotifier::Impl {
+    Monitor& monitor;
+    Options opts;
+    int fd = -1;
+    sockaddr_un addr{};
+    socklen_t addr_len = 0;
+    long long watchdog = 0;         // us, 0: none
+    std::thread thread;
+    std::mutex mu;                  // guards stopping, for the tick wait
+    std::condition_variable cv;
+    bool stopping = false;
+
+    // Only touched by the notifier thread
+    std::vector<ProbeView> probes;
+    char status[kMaxStatus];
+    char sent_status[kMaxStatus];
+    char msg[kMaxStatus + 32];
+    bool ready = false;
+    bool stalled = false;
+    AllocSite allocs{"notify"};
+
+    std::atomic<unsigned long long> datagrams{0}, pings{0}, withheld{0};
+
+    Impl(Monitor& m, Options o) : monitor(m), opts(o) {}
+
+    // NOTIFY_SOCKET: an absolute path, or '@' for a name in the abstract namespace.
+    bool open_socket(const char* path) {
+        const std::size_t len = std::strlen(path);
+        if ((path[0] != '/' && path[0] != '@') || len < 2 || len >= sizeof(addr.sun_path)) {
+            std::fprintf(stderr, "notify: unusable NOTIFY_SOCKET %s\n", path);
+            return false;
+        }
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path, len);
+        if (path[0] == '@') addr.sun_path[0] = '\0';
+        addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + len + (path[0] == '@' ? 0 : 1));
+        fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            std::perror("notify: socket");
+            return false;
+        }
+        return true;
+    }
+
+    bool send_msg(const char* text) {
+        if (sendto(fd, text, std::strlen(text), MSG_NOSIGNAL, reinterpret_cast<const sockaddr*>(&addr), addr_len) < 0)
+            return false;
+        datagrams.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Ping only while the engine answers. The manager does the rest: a hung
+    // engine misses the deadline and gets restarted.
+    void watchdog_tick() {
+        if (monitor.responsive()) {
+            if (stalled) std::fprintf(stderr, "notify: engine responding again\n");
+            stalled = false;
+            if (send_msg("WATCHDOG=1")) pings.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (!stalled) std::fprintf(stderr, "notify: engine poll loop not responding, withholding watchdog pings\n");
+        stalled = true;
+        withheld.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void status_tick(std::chrono::steady_clock::time_point ready_by) {
+        alloc_cycle_begin(allocs);
+        monitor.snapshot(probes);
+        format_status_line(probes, status, sizeof(status));
+        if (!ready) {
+            bool reported = true;
+            for (const auto& p : probes)
+                if (!p.first_result) reported = false;
+            if (reported || std::chrono::steady_clock::now() >= ready_by) {
+                std::snprintf(msg, sizeof(msg), "READY=1\nSTATUS=%s", status);
+                ready = send_msg(msg);
+                if (ready) std::memcpy(sent_status, status, sizeof(status));
+            }
+        } else if (std::strcmp(status, sent_status) != 0) {
+            std::snprintf(msg, sizeof(msg), "STATUS=%s", status);
+            if (send_msg(msg)) std::memcpy(sent_status, status, sizeof(status));
+        }
+        alloc_cycle_end(allocs);
+    }
+
+    void run() {
+        using clock = std::chrono::steady_clock;
+        const auto start = clock::now();
+        const auto ready_by = start + std::chrono::milliseconds(std::max(opts.ready_timeout_ms, 0));
+        const auto status_every = std::chrono::milliseconds(std::max(opts.status_interval_ms, 50));
+        // Half the interval, as sd_notify(3) recommends: one late ping is not yet fatal.
+        const auto ping_every = std::chrono::microseconds(std::max(watchdog / 2, 1000LL));
+        auto next_status = start, next_ping = start;
+        std::unique_lock<std::mutex> lk(mu);
+        while (!stopping) {
+            const auto now = clock::now();
+            lk.unlock();
+            if (watchdog && now >= next_ping) {
+                watchdog_tick();
+                next_ping = std::max(next_ping + ping_every, now);
+            }
+            if (now >= next_status) {
+                status_tick(ready_by);
+                next_status = std::max(next_status + status_every, now);
+            }
+            lk.lock();
+            cv.wait_until(lk, watchdog ? std::min(next_status, next_ping) : next_status, [&] { return stopping; });
+        }
+    }
+};
+
+ServiceNotifier::ServiceNotifier(Monitor& monitor) : ServiceNotifier(monitor, Options()) {}
+
+ServiceNotifier::ServiceNotifier(Monitor& monitor, Options opts)
+    : impl_(std::make_unique<Impl>(monitor, opts)) {}
+
+ServiceNotifier::~ServiceNotifier() { stop(); }
+
+bool ServiceNotifier::start() {
+    Impl& n = *impl_;
+    if (n.thread.joinable()) return true;
+    const char* path = std::getenv("NOTIFY_SOCKET");
+    if (!path || !*path) return false;
+    if (n.fd < 0 && !n.open_socket(path)) return false;
+    n.watchdog = watchdog_from_env();
+    n.status[0] = n.sent_status[0] = '\0';
+    n.ready = false;
+    n.stopping = false;
+    n.thread = std::thread([&n] { n.run(); });
+    if (n.watchdog)
+        std::fprintf(stderr, "notify: %s, watchdog ping every %lld ms\n", path, n.watchdog / 2000);
+    else
+        std::fprintf(stderr, "notify: %s\n", path);
+    return true;
+}
+
+void ServiceNotifier::stop() {
+    Impl& n = *impl_;
+    if (!n.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(n.mu);
+        n.stopping = true;
+    }
+    n.cv.notify_all();
+    n.thread.join();
+    n.send_msg("STOPPING=1");
+    close(n.fd);
+    n.fd = -1;
+    alloc_report(n.allocs);
+}
+
+long long ServiceNotifier::watchdog_us() const { return impl_->watchdog; }
+
+ServiceNotifier::Counters ServiceNotifier::counters() const {
+    const Impl& n = *impl_;
+    Counters c;
+    c.datagrams = n.datagrams.load(std::memory_order_relaxed);
+    c.pings = n.pings.load(std::memory_order_relaxed);
+    c.withheld = n.withheld.load(std::memory_order_relaxed);
+    return c;
+}
+
+}  // namespace nsm
@@ -0,0 +1,70 @@
+/*
+ * Service manager notifications for a Monitor run as a daemon: the sd_notify
+ * datagram protocol, spoken directly (no libsystemd)
+ *
+ *   READY=1        once every probe has reported (or ready_timeout_ms has passed)
+ *   STATUS=...     the one-line status text, whenever it changes
+ *   WATCHDOG=1     every half WATCHDOG_USEC, but only while the engine's poll
+ *                  loop keeps coming round (Monitor::responsive()); a hung engine
+ *                  stops the pings and the manager restarts the service
+ *   STOPPING=1     from stop()
+ *
+ * The socket comes from NOTIFY_SOCKET (a path, or "@name" for the abstract
+ * namespace) and the watchdog from WATCHDOG_USEC and WATCHDOG_PID, as the
+ * service manager sets them. For a unit with Type=notify and WatchdogSec=:
+ *
+ *     nsm::ServiceNotifier notifier(monitor);
+ *     notifier.start();       // false outside a service manager
+ *
+ * Any Unix datagram socket stands in for the manager:
+ *
+ *     socat -u UNIX-RECV:/tmp/notify STDOUT &
+ *     NOTIFY_SOCKET=/tmp/notify WATCHDOG_USEC=2000000 net_serial_monitor --headless
+ */
+#ifndef NSM_SERVICE_NOTIFY_H
+#define NSM_SERVICE_NOTIFY_H
+
+#include "netserialmon.h"
+
+#include <memory>
+
+namespace nsm {
+
+class ServiceNotifier {
+public:
+    struct Options {
+        int ready_timeout_ms = 30000;   // READY=1 by then even if some probes have not reported
+        int status_interval_ms = 1000;  // how often the status text is checked for changes
+    };
+
+    // Running totals
+    struct Counters {
+        unsigned long long datagrams = 0;   // sent
+        unsigned long long pings = 0;       // WATCHDOG=1 among them
+        unsigned long long withheld = 0;    // pings not sent because the engine did not respond
+    };
+
+    explicit ServiceNotifier(Monitor& monitor);
+    ServiceNotifier(Monitor& monitor, Options opts);
+    ~ServiceNotifier();             // stops the notifier
+    ServiceNotifier(const ServiceNotifier&) = delete;
+    ServiceNotifier& operator=(const ServiceNotifier&) = delete;
+
+    // Read the environment and start notifying. False if NOTIFY_SOCKET is not set,
+    // or, with a message on stderr, if it is not usable.
+    bool start();
+    // Send STOPPING=1 and stop.
+    void stop();
+
+    // The watchdog interval in microseconds, 0 if there is none for this process.
+    long long watchdog_us() const;
+    Counters counters() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace nsm
+
+#endif  // NSM_SERVICE_NOTIFY_H
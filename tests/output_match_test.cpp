@@ -0,0 +1,130 @@
+/*
+ * Tests of the output matchers (output_match.h): the regex to DFA compiler and
+ * the streaming metric extraction, fed both whole and a byte at a time.
+ */
+#include "output_match.h"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (ok) return;
+    std::fprintf(stderr, "FAIL: %s\n", what);
+    ++failures;
+}
+
+// The metric found in output, NAN if none; the same whether output arrives at
+// once or a byte at a time (as it may from a pipe).
+double metric_of(const char* pattern, const std::string& output) {
+    nsm::OutputMatchers m;
+    std::string err;
+    if (!m.compile_metric(pattern, err)) {
+        std::fprintf(stderr, "FAIL: %s: %s\n", pattern, err.c_str());
+        ++failures;
+        return NAN;
+    }
+    nsm::MatchState whole, bytes;
+    whole.reset(m);
+    bytes.reset(m);
+    whole.feed(m, output.data(), output.size());
+    for (char c : output) bytes.feed(m, &c, 1);
+    whole.finish(m);
+    bytes.finish(m);
+    const double a = whole.has_metric ? whole.metric : NAN, b = bytes.has_metric ? bytes.metric : NAN;
+    if (!(a == b || (std::isnan(a) && std::isnan(b)))) {
+        std::fprintf(stderr, "FAIL: %s: %g fed whole, %g a byte at a time\n", pattern, a, b);
+        ++failures;
+    }
+    return a;
+}
+
+void expect_metric(const char* pattern, const std::string& output, double want) {
+    const double got = metric_of(pattern, output);
+    if (got == want || (std::isnan(got) && std::isnan(want))) return;
+    std::fprintf(stderr, "FAIL: %s on \"%s\": got %g, want %g\n", pattern, output.c_str(), got, want);
+    ++failures;
+}
+
+bool found(const char* pattern, const std::string& output) {
+    nsm::Dfa d;
+    std::string err;
+    if (!d.compile(pattern, true, err)) {
+        std::fprintf(stderr, "FAIL: %s: %s\n", pattern, err.c_str());
+        ++failures;
+        return false;
+    }
+    int s = d.start();
+    for (char c : output) {
+        s = d.step(s, static_cast<unsigned char>(c));
+        if (s == nsm::Dfa::kDead) s = d.start();
+        if (d.accepting(s)) return true;
+    }
+    return false;
+}
+
+bool compiles(const char* pattern) {
+    nsm::Dfa d;
+    std::string err;
+    return d.compile(pattern, true, err);
+}
+
+}  // namespace
+
+int main() {
+    // Search patterns (match_ok / match_fail)
+    check(found("ready", "service is ready\n"), "literal");
+    check(!found("ready", "service is read\n"), "literal absent");
+    check(found("err(or)?: [0-9]+", "err: 42"), "group, ?, class, +");
+    check(found("a|b.d", "xxbzd"), "alternation and '.'");
+    check(found("\\d\\d:\\d\\d", "at 12:34"), "\\d");
+    check(found("[^ ]+=", "key=value"), "negated class");
+    check(!found("a.b", "a\nb"), "'.' does not match a newline");
+
+    check(!compiles("("), "unbalanced '(' rejected");
+    check(!compiles("a)"), "unbalanced ')' rejected");
+    check(!compiles("*a"), "quantifier without operand rejected");
+    check(!compiles("[abc"), "unterminated class rejected");
+    check(!compiles("^up$"), "anchors rejected");
+    check(compiles(""), "empty pattern");
+
+    // Metrics: prefix, group and suffix
+    expect_metric("time=([0-9.]+) ms", "64 bytes: time=12.3 ms\n", 12.3);
+    expect_metric("time=([0-9.]+) ms", "time=12.3 s\n", NAN);
+    expect_metric("time=([0-9.]+)", "time=1 time=2 time=3", 3);    // the last occurrence wins
+    expect_metric("load (\\d+)%", "cpu load 81%\n", 81);
+
+    // Empty prefix: the group may start at any byte
+    expect_metric("(\\d+)", "abc 42", 42);
+    expect_metric("(\\d+)", "abc 42\n", 42);
+    expect_metric("(\\d+)", "no number here", NAN);
+    expect_metric("([0-9.]+) ms", "rtt 12.3 ms", 12.3);
+    expect_metric("([0-9.]+) ms", "rtt 12.3 s, then 7 ms", 7);
+    expect_metric("\\s*(\\d+)", "x 7 y", 7);
+    expect_metric("()", "abc", NAN);
+
+    // Empty group
+    expect_metric("time=()", "time=5", NAN);
+    expect_metric("time=()ms", "time=ms time=5ms", NAN);
+    expect_metric("x(a*)y", "xy", NAN);
+
+    // Empty suffix: a number up to the end of the output counts
+    expect_metric("temp=(\\d+)", "temp=21", 21);
+    expect_metric("temp=(\\d+)", "temp=21\n", 21);
+    expect_metric("temp=([0-9.]+)", "temp=21.5 temp=", 21.5);
+
+    // A long run of bytes that never start the group must not build up state
+    expect_metric("(\\d+)", std::string(1 << 20, 'x') + "5", 5);
+    expect_metric("([0-9.]+) ms", std::string(1 << 20, ' ') + "9 ms", 9);
+
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("output_match: all checks passed\n");
+    return 0;
+}